@@ -1,23 +1,40 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include "utlist.h"
 #include "mle.h"
 
-// Return a new async_proc_t
+static void _async_proc_timeout(editor_t* editor, void* udata);
+
+// Return a new async_proc_t, or NULL if shell_cmd could not be spawned
 async_proc_t* async_proc_new(bview_t* invoker, int timeout_sec, int timeout_usec, async_proc_cb_t callback, char* shell_cmd) {
     async_proc_t* aproc;
+    pid_t pid;
+    int pipefd;
+
+    // Spawn shell_cmd
+    if (proc_spawn(shell_cmd, NULL, &pipefd, NULL, &pid) != MLE_OK) {
+        return NULL;
+    }
+
+    // Never block the editor on a read
+    fcntl(pipefd, F_SETFL, fcntl(pipefd, F_GETFL) | O_NONBLOCK);
 
     // Make async proc
     aproc = calloc(1, sizeof(async_proc_t));
     async_proc_set_invoker(aproc, invoker);
-    aproc->pipe = popen(shell_cmd, "r");
-    setvbuf(aproc->pipe, NULL, _IONBF, 0);
-    aproc->pipefd = fileno(aproc->pipe);
-    aproc->timeout.tv_sec = timeout_sec;
-    aproc->timeout.tv_usec = timeout_usec;
+    aproc->pid = pid;
+    aproc->pipefd = pipefd;
     aproc->callback = callback;
 
+    // Wake editor loop on output and at timeout, if any
     DL_APPEND(aproc->editor->async_procs, aproc);
+    editor_watch_fd(aproc->editor, aproc->pipefd, aproc);
+    if (timeout_sec > 0 || timeout_usec > 0) {
+        editor_add_timer(aproc->editor, (long)timeout_sec * 1000 + timeout_usec / 1000, _async_proc_timeout, aproc, &aproc->timeout_timer);
+    }
     return aproc;
 }
 
@@ -32,13 +49,61 @@ int async_proc_set_invoker(async_proc_t* aproc, bview_t* invoker) {
     return MLE_OK;
 }
 
-// Destroy an async_proc_t
+// Read what aproc has written, up to MLE_ASYNC_READ_MAX bytes, and pass it to
+// its callback in one call. Whatever is left stays in the pipe until the next
+// wakeup so a chatty proc cannot starve tty input. Sets is_done on eof or
+// error. Return number of bytes read.
+size_t async_proc_read(async_proc_t* aproc) {
+    editor_t* editor;
+    size_t len;
+    ssize_t nbytes;
+
+    // Read into editor-wide buffer, reused across procs and wakeups
+    editor = aproc->editor;
+    if (!editor->async_readbuf) {
+        editor->async_readbuf = malloc(MLE_ASYNC_READ_MAX + 1);
+    }
+    len = 0;
+    while (len < MLE_ASYNC_READ_MAX) {
+        nbytes = read(aproc->pipefd, editor->async_readbuf + len, MLE_ASYNC_READ_MAX - len);
+        if (nbytes > 0) {
+            len += (size_t)nbytes;
+        } else if (nbytes < 0 && errno == EINTR) {
+            continue;
+        } else if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break; // Drained
+        } else {
+            aproc->is_done = 1; // Eof or error
+            break;
+        }
+    }
+    if (len > 0) {
+        editor->async_readbuf[len] = '\0';
+        aproc->callback(aproc, editor->async_readbuf, len, 0, 0, 0);
+    }
+    return len;
+}
+
+// Destroy an async_proc_t. It is reaped in the background, so this never
+// blocks. If destroyed before eof, its process group is cancelled too.
 int async_proc_destroy(async_proc_t* aproc) {
     DL_DELETE(aproc->editor->async_procs, aproc);
-    pclose(aproc->pipe);
+    editor_unwatch_fd(aproc->editor, aproc->pipefd);
+    if (aproc->timeout_timer) editor_remove_timer(aproc->editor, aproc->timeout_timer);
+    close(aproc->pipefd);
+    proc_reap(aproc->editor, aproc->pid, aproc->is_done ? 0 : 1);
     if (aproc->invoker && aproc->invoker->async_proc == aproc) {
         aproc->invoker->async_proc = NULL;
     }
     free(aproc);
     return MLE_OK;
 }
+
+// Timer callback that closes an async proc at its timeout
+static void _async_proc_timeout(editor_t* editor, void* udata) {
+    async_proc_t* aproc;
+    aproc = (async_proc_t*)udata;
+    aproc->timeout_timer = NULL; // Freed by caller
+    aproc->callback(aproc, NULL, 0, 0, 0, 1);
+    async_proc_destroy(aproc);
+}
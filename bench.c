@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/time.h>
+#include "mle.h"
+
+#define MLE_BENCH_RENDER_LINES 10000
+#define MLE_BENCH_RENDER_LINE_LEN 200
+#define MLE_BENCH_RENDER_ITERS 20
+#define MLE_BENCH_DISPLAY_LINES 5000
+#define MLE_BENCH_DISPLAY_FRAMES 2000
+#define MLE_BENCH_KMAP_LOOKUPS 10000000
+#define MLE_BENCH_APROC_LINES 2000000
+
+static int _bench_render(editor_t* editor, char* name, int is_utf8);
+static int _bench_display(editor_t* editor, char* name);
+static int _bench_kmap(editor_t* editor, char* name);
+static int _bench_aproc(editor_t* editor, char* name);
+static void _bench_aproc_cb(async_proc_t* aproc, char* buf, size_t buf_len, int is_error, int is_eof, int is_timeout);
+static uint64_t _bench_hash_cells(uint64_t hash, struct tb_cell* cells, int len);
+
+// Run a micro-benchmark by name and print results to stdout
+int bench_run(editor_t* editor, char* name) {
+    if (strcmp(name, "render") == 0) {
+        return _bench_render(editor, name, 0);
+    } else if (strcmp(name, "render_utf8") == 0) {
+        return _bench_render(editor, name, 1);
+    } else if (strcmp(name, "display") == 0) {
+        return _bench_display(editor, name);
+    } else if (strcmp(name, "kmap") == 0) {
+        return _bench_kmap(editor, name);
+    } else if (strcmp(name, "aproc") == 0) {
+        return _bench_aproc(editor, name);
+    }
+    MLE_LOG_ERR("Unknown benchmark: %s\n", name);
+    return MLE_ERR;
+}
+
+// Render 10k long lines into cells. If is_utf8 is set, every 10th char is
+// non-ASCII to exercise the per-codepoint path.
+static int _bench_render(editor_t* editor, char* name, int is_utf8) {
+    bview_t* bview;
+    bline_t* bline;
+    struct tb_cell* cells;
+    struct timeval start;
+    struct timeval stop;
+    char* data;
+    size_t data_len;
+    long elapsed_ms;
+    int i;
+    int j;
+
+    // Make buffer data
+    data = malloc(MLE_BENCH_RENDER_LINES * (MLE_BENCH_RENDER_LINE_LEN * 2 + 1));
+    data_len = 0;
+    for (i = 0; i < MLE_BENCH_RENDER_LINES; i++) {
+        for (j = 0; j < MLE_BENCH_RENDER_LINE_LEN; j++) {
+            if (is_utf8 && j % 10 == 0) {
+                memcpy(data + data_len, "\xc3\xa9", 2);
+                data_len += 2;
+            } else {
+                data[data_len++] = j % 20 == 19 ? ' ' : 'a' + (j % 26);
+            }
+        }
+        data[data_len++] = '\n';
+    }
+
+    // Make bview wide enough to render whole lines
+    bview = bview_new(editor, NULL, 0, NULL);
+    bview_resize(bview, 0, 0, MLE_BENCH_RENDER_LINE_LEN + 16, 50);
+    buffer_set(bview->buffer, data, (bint_t)data_len);
+    cells = malloc(sizeof(struct tb_cell) * bview->rect_buffer.w);
+
+    // Render
+    gettimeofday(&start, NULL);
+    for (i = 0; i < MLE_BENCH_RENDER_ITERS; i++) {
+        for (bline = bview->buffer->first_line; bline; bline = bline->next) {
+            bview_render_bline_cells(bview, bline, 0, 0, cells);
+        }
+    }
+    gettimeofday(&stop, NULL);
+    elapsed_ms = util_timeval_diff_ms(&stop, &start);
+
+    printf("%s: %d lines x %d iters in %ld ms (%.1f ns/line)\n",
+        name, MLE_BENCH_RENDER_LINES, MLE_BENCH_RENDER_ITERS, elapsed_ms,
+        (double)elapsed_ms * 1000000.0 / ((double)MLE_BENCH_RENDER_LINES * MLE_BENCH_RENDER_ITERS)
+    );
+
+    free(cells);
+    free(data);
+    bview_destroy(bview);
+    return MLE_OK;
+}
+
+// Scroll through the active buffer one line per frame, calling
+// editor_display each time. If no file was opened, a generated source file is
+// used. Cells are hashed after every frame so that output can be compared
+// across builds; with `make mle_headless` this needs no tty.
+static int _bench_display(editor_t* editor, char* name) {
+    bview_t* bview;
+    mark_t* mark;
+    char* data;
+    size_t data_len;
+    uint64_t hash;
+    uint64_t start_us;
+    uint64_t elapsed_us;
+    int i;
+
+    bview = editor->active_edit;
+    mark = bview->active_cursor->mark;
+
+    // Fill blank buffer with some highlightable code
+    if (bview->buffer->byte_count < 1) {
+        data = malloc(MLE_BENCH_DISPLAY_LINES * 64);
+        data_len = 0;
+        for (i = 0; i < MLE_BENCH_DISPLAY_LINES; i++) {
+            data_len += sprintf(data + data_len, "    if (x%d > %d) { return \"str%d\"; } // note\n", i, i * 7, i % 100);
+        }
+        buffer_set(bview->buffer, data, (bint_t)data_len);
+        bview_set_syntax(bview, "syn_generic");
+        free(data);
+    }
+
+    if (tb_init() < 0) {
+        MLE_LOG_ERR("Could not init termbox for %s\n", name);
+        return MLE_ERR;
+    }
+    editor_resize(editor, -1, -1);
+    mark_move_beginning(mark);
+
+    // Display frames
+    hash = 14695981039346656037ULL;
+    start_us = perf_now_us();
+    for (i = 0; i < MLE_BENCH_DISPLAY_FRAMES; i++) {
+        if (mark_move_vert(mark, 1) != MLBUF_OK || mark->bline->next == NULL) {
+            mark_move_beginning(mark);
+        }
+        bview_rectify_viewport(bview);
+        editor_display(editor);
+        hash = _bench_hash_cells(hash, tb_cell_buffer(), tb_width() * tb_height());
+    }
+    elapsed_us = perf_now_us() - start_us;
+    tb_shutdown();
+
+    printf("%s: %d frames at %dx%d in %llu ms (%.1f fps) hash=%016llx\n",
+        name, MLE_BENCH_DISPLAY_FRAMES, editor->w, editor->h,
+        (unsigned long long)(elapsed_us / 1000),
+        elapsed_us > 0 ? (double)MLE_BENCH_DISPLAY_FRAMES * 1000000.0 / (double)elapsed_us : 0.0,
+        (unsigned long long)hash
+    );
+    return MLE_OK;
+}
+
+// Look up commands for a mix of typed chars, ctrl keys and a numeric binding
+// (M-y 5 u) on the active bview's kmap stack. Commands are not run.
+static int _bench_kmap(editor_t* editor, char* name) {
+    kinput_t inputs[] = {
+        { 0, 'h', 0 }, { 0, 'e', 0 }, { 0, 'l', 0 }, { 0, 'l', 0 }, { 0, 'o', 0 },
+        { 0, 0, TB_KEY_CTRL_A }, { 0, 0, TB_KEY_ARROW_DOWN },
+        { TB_MOD_ALT, 'y', 0 }, { 0, '5', 0 }, { 0, 'u', 0 },
+        { 0, ' ', 0 }, { 0, '1', 0 }, { 0, 0, TB_KEY_CTRL_E }
+    };
+    int inputs_len;
+    loop_context_t loop_ctx;
+    cmd_context_t ctx;
+    cmd_funcref_t* funcref;
+    uint64_t start_us;
+    uint64_t elapsed_us;
+    long found;
+    long i;
+
+    memset(&loop_ctx, 0, sizeof(loop_context_t));
+    memset(&ctx, 0, sizeof(cmd_context_t));
+    ctx.editor = editor;
+    ctx.loop_ctx = &loop_ctx;
+    inputs_len = sizeof(inputs) / sizeof(kinput_t);
+    found = 0;
+
+    start_us = perf_now_us();
+    for (i = 0; i < MLE_BENCH_KMAP_LOOKUPS; i++) {
+        ctx.input = inputs[i % inputs_len];
+        if ((funcref = editor_get_command(editor, &ctx, NULL)) != NULL || !loop_ctx.need_more_input) {
+            if (funcref) found += 1;
+            loop_ctx.binding_node = NULL;
+            loop_ctx.wildcard_params_len = 0;
+            loop_ctx.numeric_params_len = 0;
+        }
+    }
+    elapsed_us = perf_now_us() - start_us;
+
+    printf("%s: %d lookups (%ld commands) in %llu ms (%.1f M lookups/s)\n",
+        name, MLE_BENCH_KMAP_LOOKUPS, found,
+        (unsigned long long)(elapsed_us / 1000),
+        elapsed_us > 0 ? (double)MLE_BENCH_KMAP_LOOKUPS / (double)elapsed_us : 0.0
+    );
+    return MLE_OK;
+}
+
+// Drain an async proc that writes grep-like output one line at a time.
+// Output is counted, not inserted, so this measures only the read path.
+static int _bench_aproc(editor_t* editor, char* name) {
+    async_proc_t* aproc;
+    struct pollfd pfd;
+    char* cmd;
+    size_t counts[2]; // Bytes, callbacks
+    uint64_t start_us;
+    uint64_t elapsed_us;
+
+    asprintf(&cmd, "yes './src/some/dir/file.c:1234:    if (match) { return found; }' | head -n %d", MLE_BENCH_APROC_LINES);
+    memset(counts, 0, sizeof(counts));
+    start_us = perf_now_us();
+    aproc = async_proc_new(editor->active_edit, 0, 0, _bench_aproc_cb, cmd);
+    free(cmd);
+    if (!aproc) {
+        MLE_LOG_ERR("Could not spawn proc for %s\n", name);
+        return MLE_ERR;
+    }
+    aproc->udata = counts;
+    pfd.fd = aproc->pipefd;
+    pfd.events = POLLIN;
+    while (!aproc->is_done) {
+        poll(&pfd, 1, -1);
+        async_proc_read(aproc);
+    }
+    elapsed_us = perf_now_us() - start_us;
+    async_proc_destroy(aproc);
+
+    printf("%s: %d lines, %zu bytes in %zu callbacks in %llu ms (%.1f MB/s)\n",
+        name, MLE_BENCH_APROC_LINES, counts[0], counts[1],
+        (unsigned long long)(elapsed_us / 1000),
+        elapsed_us > 0 ? (double)counts[0] / (double)elapsed_us : 0.0
+    );
+    return MLE_OK;
+}
+
+// Count bytes and callbacks for _bench_aproc
+static void _bench_aproc_cb(async_proc_t* aproc, char* buf, size_t buf_len, int is_error, int is_eof, int is_timeout) {
+    size_t* counts;
+    counts = (size_t*)aproc->udata;
+    counts[0] += buf_len;
+    counts[1] += 1;
+}
+
+// Fold len cells into an FNV-1a hash
+static uint64_t _bench_hash_cells(uint64_t hash, struct tb_cell* cells, int len) {
+    uint32_t vals[3];
+    unsigned char* byte;
+    int i;
+    int j;
+    for (i = 0; i < len; i++) {
+        vals[0] = cells[i].ch;
+        vals[1] = cells[i].fg;
+        vals[2] = cells[i].bg;
+        byte = (unsigned char*)vals;
+        for (j = 0; j < (int)sizeof(vals); j++) {
+            hash ^= byte[j];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
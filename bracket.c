@@ -0,0 +1,500 @@
+#include <stdlib.h>
+#include <string.h>
+#include "uthash.h"
+#include "mle.h"
+
+// Per-buffer bracket nesting index. Each line gets a summary per bracket
+// type (paren, square, curly): its net depth change, the lowest depth reached
+// right after a closing bracket and the lowest depth right before an opening
+// bracket, both relative to the depth at the start of the line. The line
+// summaries are kept in order in a treap keyed by position, each node also
+// holding the combined summary of its subtree. This answers "first line after
+// L whose depth drops to T" and "last line before L with an opening bracket
+// at depth < T" in O(log n), and inserting or deleting k lines costs
+// O(k + log n). Only the lines at either end are scanned char by char.
+
+#define MLE_BRACKET_INF (INT_MAX / 2)
+#define MLE_BRACKET_SIZE(node) ((node) ? (node)->size : 0)
+
+static bracket_index_t* _bracket_index_get(editor_t* editor, buffer_t* buffer);
+static void _bracket_index_rebuild(bracket_index_t* idx);
+static bracket_node_t* _bracket_index_build(bracket_index_t* idx, bline_t* bline, bint_t num_lines);
+static uint32_t _bracket_index_rand(bracket_index_t* idx);
+static void _bracket_node_pull(bracket_node_t* node);
+static void _bracket_node_pull_all(bracket_node_t* node);
+static void _bracket_node_set(bracket_node_t* node, bint_t line_index, bline_t* bline);
+static void _bracket_node_split(bracket_node_t* node, bint_t count, bracket_node_t** ret_left, bracket_node_t** ret_right);
+static bracket_node_t* _bracket_node_merge(bracket_node_t* left, bracket_node_t* right);
+static void _bracket_node_free(bracket_node_t* node);
+static void _bracket_sum_line(bline_t* bline, bracket_sum_t* sum);
+static void _bracket_sum_combine(bracket_sum_t* a, bracket_sum_t* b, bracket_sum_t* ret);
+static int _bracket_tree_prefix(bracket_index_t* idx, int type, bint_t line_index);
+static bint_t _bracket_tree_find_first(bracket_node_t* node, int type, bint_t base, bint_t from, int* depth, int target);
+static bint_t _bracket_tree_find_last(bracket_node_t* node, int type, bint_t base, bint_t to, int* depth, int target);
+static int _bracket_find_before(bracket_index_t* idx, int type, bline_t* bline, bint_t col, int target, bline_t** ret_line, bint_t* ret_col);
+static int _bracket_find_before_in_line(bracket_index_t* idx, int type, bline_t* bline, bint_t col, int target, bint_t* ret_col);
+static int _bracket_get_type(uint32_t ch, int* ret_is_closing);
+
+// Find bracket matching the one under mark. Return MLE_OK if found.
+int bracket_index_find_pair(editor_t* editor, mark_t* mark, bline_t** ret_line, bint_t* ret_col) {
+    bracket_index_t* idx;
+    bline_t* bline;
+    bint_t col;
+    bint_t line_index;
+    int type;
+    int is_closing;
+    int is_mark_closing;
+    int target;
+    int depth;
+
+    bline = mark->bline;
+    if (mark->col >= bline->char_count) return MLE_ERR;
+    if ((type = _bracket_get_type(bline->chars[mark->col].ch, &is_mark_closing)) < 0) return MLE_ERR;
+    idx = _bracket_index_get(editor, bline->buffer);
+
+    // Get depth before mark
+    target = _bracket_tree_prefix(idx, type, bline->line_index);
+    for (col = 0; col < mark->col; col++) {
+        if (_bracket_get_type(bline->chars[col].ch, &is_closing) == type) {
+            target += is_closing ? -1 : 1;
+        }
+    }
+
+    if (is_mark_closing) {
+        // Find last opening bracket before mark at a lower depth
+        return _bracket_find_before(idx, type, bline, mark->col, target, ret_line, ret_col);
+    }
+
+    // Find first closing bracket after mark that drops back to target depth
+    depth = target + 1;
+    for (col = mark->col + 1; col < bline->char_count; col++) {
+        if (_bracket_get_type(bline->chars[col].ch, &is_closing) != type) continue;
+        depth += is_closing ? -1 : 1;
+        if (depth <= target) {
+            *ret_line = bline;
+            *ret_col = col;
+            return MLE_OK;
+        }
+    }
+    depth = _bracket_tree_prefix(idx, type, bline->line_index + 1);
+    line_index = _bracket_tree_find_first(idx->root, type, 0, bline->line_index + 1, &depth, target);
+    if (line_index < 0) return MLE_ERR;
+    buffer_get_bline(bline->buffer, line_index, &bline);
+    if (!bline) return MLE_ERR;
+    depth = _bracket_tree_prefix(idx, type, line_index);
+    for (col = 0; col < bline->char_count; col++) {
+        if (_bracket_get_type(bline->chars[col].ch, &is_closing) != type) continue;
+        depth += is_closing ? -1 : 1;
+        if (is_closing && depth <= target) {
+            *ret_line = bline;
+            *ret_col = col;
+            return MLE_OK;
+        }
+    }
+    return MLE_ERR;
+}
+
+// Find innermost unmatched opening bracket before mark. Return MLE_OK if
+// found.
+int bracket_index_find_top(editor_t* editor, mark_t* mark, bline_t** ret_line, bint_t* ret_col) {
+    bracket_index_t* idx;
+    bline_t* bline;
+    bline_t* found_line;
+    bint_t found_col;
+    bint_t col;
+    int target[3];
+    int type;
+    int is_closing;
+    int rv;
+
+    bline = mark->bline;
+    idx = _bracket_index_get(editor, bline->buffer);
+
+    // Get depth of each bracket type before mark
+    for (type = 0; type < 3; type++) {
+        target[type] = _bracket_tree_prefix(idx, type, bline->line_index);
+    }
+    for (col = 0; col < mark->col && col < bline->char_count; col++) {
+        if ((type = _bracket_get_type(bline->chars[col].ch, &is_closing)) >= 0) {
+            target[type] += is_closing ? -1 : 1;
+        }
+    }
+
+    // Pick the closest of each type's enclosing bracket
+    rv = MLE_ERR;
+    for (type = 0; type < 3; type++) {
+        if (_bracket_find_before(idx, type, bline, MLE_MIN(mark->col, bline->char_count), target[type], &found_line, &found_col) != MLE_OK) {
+            continue;
+        }
+        if (rv != MLE_OK
+            || found_line->line_index > (*ret_line)->line_index
+            || (found_line == *ret_line && found_col > *ret_col)
+        ) {
+            *ret_line = found_line;
+            *ret_col = found_col;
+            rv = MLE_OK;
+        }
+    }
+    return rv;
+}
+
+// Update index of buffer after an edit
+int bracket_index_update(editor_t* editor, buffer_t* buffer, baction_t* action) {
+    bracket_index_t* idx;
+    bracket_node_t* left;
+    bracket_node_t* mid;
+    bracket_node_t* right;
+    bint_t start;
+    HASH_FIND_PTR(editor->bracket_index_map, &buffer, idx);
+    if (!idx || idx->is_stale) {
+        return MLE_OK; // Not indexed or already pending rebuild
+    }
+    if (!action
+        || !action->start_line
+        || action->start_line->line_index != action->start_line_index
+        || MLE_BRACKET_SIZE(idx->root) + action->line_delta != buffer->line_count
+    ) {
+        idx->is_stale = 1;
+        return MLE_OK;
+    }
+
+    start = action->start_line_index;
+    if (start + 1 - MLE_MIN(0, action->line_delta) > MLE_BRACKET_SIZE(idx->root)) {
+        idx->is_stale = 1;
+        return MLE_OK;
+    }
+    if (action->line_delta != 0) {
+        _bracket_node_split(idx->root, start + 1, &left, &right);
+        if (action->line_delta > 0) {
+            // Lines were inserted after start
+            mid = _bracket_index_build(idx, action->start_line->next, action->line_delta);
+            left = _bracket_node_merge(left, mid);
+        } else {
+            // Lines were deleted after start
+            _bracket_node_split(right, -action->line_delta, &mid, &right);
+            _bracket_node_free(mid);
+        }
+        idx->root = _bracket_node_merge(left, right);
+    }
+    _bracket_node_set(idx->root, start, action->start_line);
+    return MLE_OK;
+}
+
+// Free index of buffer
+int bracket_index_destroy(editor_t* editor, buffer_t* buffer) {
+    bracket_index_t* idx;
+    HASH_FIND_PTR(editor->bracket_index_map, &buffer, idx);
+    if (!idx) return MLE_OK;
+    HASH_DEL(editor->bracket_index_map, idx);
+    _bracket_node_free(idx->root);
+    free(idx);
+    return MLE_OK;
+}
+
+// Get index of buffer, building it if needed
+static bracket_index_t* _bracket_index_get(editor_t* editor, buffer_t* buffer) {
+    bracket_index_t* idx;
+    HASH_FIND_PTR(editor->bracket_index_map, &buffer, idx);
+    if (!idx) {
+        idx = calloc(1, sizeof(bracket_index_t));
+        idx->buffer = buffer;
+        idx->seed = 2463534242u;
+        idx->is_stale = 1;
+        HASH_ADD_PTR(editor->bracket_index_map, buffer, idx);
+    }
+    if (idx->is_stale || MLE_BRACKET_SIZE(idx->root) != buffer->line_count) {
+        _bracket_index_rebuild(idx);
+    }
+    return idx;
+}
+
+// Summarize every line and build tree
+static void _bracket_index_rebuild(bracket_index_t* idx) {
+    _bracket_node_free(idx->root);
+    idx->is_stale = 0;
+    idx->root = _bracket_index_build(idx, idx->buffer->first_line, idx->buffer->line_count);
+}
+
+// Build a treap of num_lines lines starting at bline in O(num_lines). Nodes
+// are appended in order, keeping the right spine on a stack. If the buffer
+// runs out of lines, mark the index stale.
+static bracket_node_t* _bracket_index_build(bracket_index_t* idx, bline_t* bline, bint_t num_lines) {
+    bracket_node_t** stack;
+    bracket_node_t* node;
+    bracket_node_t* last;
+    bint_t stack_len;
+    bint_t i;
+    if (num_lines < 1) return NULL;
+    stack = malloc(sizeof(bracket_node_t*) * num_lines);
+    stack_len = 0;
+    for (i = 0; i < num_lines; i++) {
+        if (!bline) idx->is_stale = 1;
+        node = calloc(1, sizeof(bracket_node_t));
+        node->priority = _bracket_index_rand(idx);
+        _bracket_sum_line(bline, &node->line);
+        last = NULL;
+        while (stack_len > 0 && stack[stack_len - 1]->priority < node->priority) {
+            last = stack[--stack_len];
+        }
+        node->left = last;
+        if (stack_len > 0) stack[stack_len - 1]->right = node;
+        stack[stack_len++] = node;
+        if (bline) bline = bline->next;
+    }
+    node = stack[0];
+    free(stack);
+    _bracket_node_pull_all(node);
+    return node;
+}
+
+// Return next node priority (xorshift32)
+static uint32_t _bracket_index_rand(bracket_index_t* idx) {
+    idx->seed ^= idx->seed << 13;
+    idx->seed ^= idx->seed >> 17;
+    idx->seed ^= idx->seed << 5;
+    return idx->seed;
+}
+
+// Recompute size and subtree summary of node from its children
+static void _bracket_node_pull(bracket_node_t* node) {
+    bracket_sum_t sum;
+    node->size = 1 + MLE_BRACKET_SIZE(node->left) + MLE_BRACKET_SIZE(node->right);
+    sum = node->line;
+    if (node->left) _bracket_sum_combine(&node->left->sum, &node->line, &sum);
+    if (node->right) {
+        _bracket_sum_combine(&sum, &node->right->sum, &node->sum);
+    } else {
+        node->sum = sum;
+    }
+}
+
+// Recompute every node under node, children first
+static void _bracket_node_pull_all(bracket_node_t* node) {
+    if (!node) return;
+    _bracket_node_pull_all(node->left);
+    _bracket_node_pull_all(node->right);
+    _bracket_node_pull(node);
+}
+
+// Re-summarize line at line_index and update its path to node
+static void _bracket_node_set(bracket_node_t* node, bint_t line_index, bline_t* bline) {
+    bint_t left_size;
+    if (!node) return;
+    left_size = MLE_BRACKET_SIZE(node->left);
+    if (line_index < left_size) {
+        _bracket_node_set(node->left, line_index, bline);
+    } else if (line_index == left_size) {
+        _bracket_sum_line(bline, &node->line);
+    } else {
+        _bracket_node_set(node->right, line_index - left_size - 1, bline);
+    }
+    _bracket_node_pull(node);
+}
+
+// Split node into its first count lines and the rest
+static void _bracket_node_split(bracket_node_t* node, bint_t count, bracket_node_t** ret_left, bracket_node_t** ret_right) {
+    bint_t left_size;
+    if (!node) {
+        *ret_left = NULL;
+        *ret_right = NULL;
+        return;
+    }
+    left_size = MLE_BRACKET_SIZE(node->left);
+    if (count <= left_size) {
+        _bracket_node_split(node->left, count, ret_left, &node->left);
+        *ret_right = node;
+    } else {
+        _bracket_node_split(node->right, count - left_size - 1, &node->right, ret_right);
+        *ret_left = node;
+    }
+    _bracket_node_pull(node);
+}
+
+// Join left followed by right
+static bracket_node_t* _bracket_node_merge(bracket_node_t* left, bracket_node_t* right) {
+    if (!left) return right;
+    if (!right) return left;
+    if (left->priority > right->priority) {
+        left->right = _bracket_node_merge(left->right, right);
+        _bracket_node_pull(left);
+        return left;
+    }
+    right->left = _bracket_node_merge(left, right->left);
+    _bracket_node_pull(right);
+    return right;
+}
+
+// Free node and its subtree
+static void _bracket_node_free(bracket_node_t* node) {
+    if (!node) return;
+    _bracket_node_free(node->left);
+    _bracket_node_free(node->right);
+    free(node);
+}
+
+// Summarize bracket depth changes in a line. A NULL bline is an empty line.
+static void _bracket_sum_line(bline_t* bline, bracket_sum_t* sum) {
+    bint_t i;
+    int type;
+    for (type = 0; type < 3; type++) {
+        sum->delta[type] = 0;
+        sum->min_after[type] = MLE_BRACKET_INF;
+        sum->min_before[type] = MLE_BRACKET_INF;
+    }
+    if (!bline) return;
+    // Brackets are ASCII and UTF-8 continuation bytes never are, so scan bytes
+    for (i = 0; i < bline->data_len; i++) {
+        switch (bline->data[i]) {
+            case '(': type = 0; break;
+            case '[': type = 1; break;
+            case '{': type = 2; break;
+            case ')': type = 3; break;
+            case ']': type = 4; break;
+            case '}': type = 5; break;
+            default: continue;
+        }
+        if (type < 3) {
+            if (sum->delta[type] < sum->min_before[type]) sum->min_before[type] = sum->delta[type];
+            sum->delta[type] += 1;
+        } else {
+            type -= 3;
+            sum->delta[type] -= 1;
+            if (sum->delta[type] < sum->min_after[type]) sum->min_after[type] = sum->delta[type];
+        }
+    }
+}
+
+// Combine summary a followed by summary b
+static void _bracket_sum_combine(bracket_sum_t* a, bracket_sum_t* b, bracket_sum_t* ret) {
+    int type;
+    for (type = 0; type < 3; type++) {
+        ret->min_after[type] = MLE_MIN(a->min_after[type], a->delta[type] + b->min_after[type]);
+        ret->min_before[type] = MLE_MIN(a->min_before[type], a->delta[type] + b->min_before[type]);
+        ret->delta[type] = a->delta[type] + b->delta[type];
+    }
+}
+
+// Return depth at the start of line_index
+static int _bracket_tree_prefix(bracket_index_t* idx, int type, bint_t line_index) {
+    bracket_node_t* node;
+    int depth;
+    depth = 0;
+    node = idx->root;
+    // Sum everything left of the path from root to line_index
+    while (node) {
+        if (line_index <= MLE_BRACKET_SIZE(node->left)) {
+            node = node->left;
+            continue;
+        }
+        if (node->left) depth += node->left->sum.delta[type];
+        depth += node->line.delta[type];
+        line_index -= MLE_BRACKET_SIZE(node->left) + 1;
+        node = node->right;
+    }
+    return depth;
+}
+
+// Return first line >= from where depth after a closing bracket drops to
+// target or below, or -1. depth is the depth at the start of line from. base
+// is the line index of the first line under node.
+static bint_t _bracket_tree_find_first(bracket_node_t* node, int type, bint_t base, bint_t from, int* depth, int target) {
+    bint_t self_index;
+    bint_t rv;
+    if (!node || base + node->size <= from) return -1;
+    if (base >= from && *depth + node->sum.min_after[type] > target) {
+        *depth += node->sum.delta[type];
+        return -1;
+    }
+    rv = _bracket_tree_find_first(node->left, type, base, from, depth, target);
+    if (rv >= 0) return rv;
+    self_index = base + MLE_BRACKET_SIZE(node->left);
+    if (self_index >= from) {
+        if (*depth + node->line.min_after[type] <= target) return self_index;
+        *depth += node->line.delta[type];
+    }
+    return _bracket_tree_find_first(node->right, type, self_index + 1, from, depth, target);
+}
+
+// Return last line < to with an opening bracket at depth below target, or -1.
+// depth is the depth at the start of line to. base is the line index of the
+// first line under node.
+static bint_t _bracket_tree_find_last(bracket_node_t* node, int type, bint_t base, bint_t to, int* depth, int target) {
+    bint_t self_index;
+    bint_t rv;
+    int start;
+    if (!node || base >= to) return -1;
+    if (base + node->size <= to) {
+        start = *depth - node->sum.delta[type];
+        if (start + node->sum.min_before[type] >= target) {
+            *depth = start;
+            return -1;
+        }
+    }
+    self_index = base + MLE_BRACKET_SIZE(node->left);
+    rv = _bracket_tree_find_last(node->right, type, self_index + 1, to, depth, target);
+    if (rv >= 0) return rv;
+    if (self_index < to) {
+        start = *depth - node->line.delta[type];
+        if (start + node->line.min_before[type] < target) return self_index;
+        *depth = start;
+    }
+    return _bracket_tree_find_last(node->left, type, base, to, depth, target);
+}
+
+// Find last opening bracket of type before col in bline (or any line before
+// it) at a depth below target
+static int _bracket_find_before(bracket_index_t* idx, int type, bline_t* bline, bint_t col, int target, bline_t** ret_line, bint_t* ret_col) {
+    bint_t line_index;
+    int depth;
+
+    // Look in bline before col
+    if (_bracket_find_before_in_line(idx, type, bline, col, target, ret_col) == MLE_OK) {
+        *ret_line = bline;
+        return MLE_OK;
+    }
+
+    // Look in last qualifying line before bline
+    depth = _bracket_tree_prefix(idx, type, bline->line_index);
+    line_index = _bracket_tree_find_last(idx->root, type, 0, bline->line_index, &depth, target);
+    if (line_index < 0) return MLE_ERR;
+    buffer_get_bline(bline->buffer, line_index, &bline);
+    if (!bline) return MLE_ERR;
+    if (_bracket_find_before_in_line(idx, type, bline, bline->char_count, target, ret_col) == MLE_OK) {
+        *ret_line = bline;
+        return MLE_OK;
+    }
+    return MLE_ERR;
+}
+
+// Find last opening bracket of type before col in bline at a depth below
+// target
+static int _bracket_find_before_in_line(bracket_index_t* idx, int type, bline_t* bline, bint_t col, int target, bint_t* ret_col) {
+    bint_t c;
+    int depth;
+    int is_closing;
+    int rv;
+    rv = MLE_ERR;
+    depth = _bracket_tree_prefix(idx, type, bline->line_index);
+    for (c = 0; c < col; c++) {
+        if (_bracket_get_type(bline->chars[c].ch, &is_closing) != type) continue;
+        if (!is_closing && depth < target) {
+            *ret_col = c;
+            rv = MLE_OK;
+        }
+        depth += is_closing ? -1 : 1;
+    }
+    return rv;
+}
+
+// Return bracket type (0=paren, 1=square, 2=curly) of ch or -1
+static int _bracket_get_type(uint32_t ch, int* ret_is_closing) {
+    switch (ch) {
+        case '(': *ret_is_closing = 0; return 0;
+        case '[': *ret_is_closing = 0; return 1;
+        case '{': *ret_is_closing = 0; return 2;
+        case ')': *ret_is_closing = 1; return 0;
+        case ']': *ret_is_closing = 1; return 1;
+        case '}': *ret_is_closing = 1; return 2;
+    }
+    return -1;
+}
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "uthash.h"
+#include "mle.h"
+
+static browse_dir_t* _browse_get_dir(editor_t* editor, char* path);
+static int _browse_read_dir(char* path, browse_entry_t** ret_entries, size_t* ret_entries_len);
+static void _browse_free_dir(browse_dir_t* dir);
+static void _browse_list_rows(browse_t* self, char* path, int depth, browse_row_t** ret_rows, size_t* ret_rows_len);
+static void _browse_insert_rows(browse_t* self, size_t index, browse_row_t* rows, size_t rows_len);
+static void _browse_format_rows(browse_row_t* rows, size_t rows_len, int is_leading_nl, char** ret_data, size_t* ret_data_len);
+static void _browse_reset_rows(browse_t* self);
+static int _browse_entry_cmp(const void* a, const void* b);
+
+// Browse dir tree at root. Dirs are read when first expanded, and listings
+// and stat results are cached on the editor until the dir changes. Return
+// NULL if root is not a dir.
+browse_t* browse_new(editor_t* editor, char* root) {
+    browse_t* self;
+    char* real_root;
+    if (!(real_root = realpath(root, NULL)) || !util_is_dir(real_root)) {
+        MLE_SET_ERR(editor, "Cannot browse to: '%s'", root);
+        if (real_root) free(real_root);
+        return NULL;
+    }
+    self = calloc(1, sizeof(browse_t));
+    self->editor = editor;
+    self->root = real_root;
+    _browse_reset_rows(self);
+    return self;
+}
+
+// Set ret_data to all rows, one per line
+int browse_get_text(browse_t* self, char** ret_data, size_t* ret_data_len) {
+    _browse_format_rows(self->rows, self->rows_len, 0, ret_data, ret_data_len);
+    return MLE_OK;
+}
+
+// Set bview that shows rows
+int browse_set_invoker(browse_t* self, bview_t* invoker) {
+    self->invoker = invoker;
+    invoker->browse = self;
+    return MLE_OK;
+}
+
+// Return row shown on line index of invoker, or NULL if none
+browse_row_t* browse_get_row(browse_t* self, size_t index) {
+    return index < self->rows_len ? &self->rows[index] : NULL;
+}
+
+// Expand or collapse dir row at index, updating only its lines in invoker
+int browse_toggle(browse_t* self, size_t index) {
+    browse_row_t* row;
+    browse_row_t* rows;
+    mark_t* mark_a;
+    mark_t* mark_b;
+    bline_t* bline;
+    size_t rows_len;
+    size_t end;
+    char* data;
+    size_t data_len;
+
+    if (index >= self->rows_len || !self->rows[index].is_dir || self->rows[index].depth < 0) return MLE_ERR;
+    row = &self->rows[index];
+
+    if (row->is_expanded) {
+        // Collapse: drop rows deeper than row
+        for (end = index + 1; end < self->rows_len && self->rows[end].depth > row->depth; end++) {
+            free(self->rows[end].path);
+        }
+        if (self->invoker && end > index + 1) {
+            mark_a = buffer_add_mark(self->invoker->buffer, NULL, 0);
+            mark_b = buffer_add_mark(self->invoker->buffer, NULL, 0);
+            buffer_get_bline(self->invoker->buffer, (bint_t)index, &bline);
+            mark_move_to(mark_a, (bint_t)index, bline->char_count);
+            buffer_get_bline(self->invoker->buffer, (bint_t)(end - 1), &bline);
+            mark_move_to(mark_b, (bint_t)(end - 1), bline->char_count);
+            mark_delete_between_mark(mark_a, mark_b);
+            mark_destroy(mark_a);
+            mark_destroy(mark_b);
+        }
+        memmove(self->rows + index + 1, self->rows + end, sizeof(browse_row_t) * (self->rows_len - end));
+        self->rows_len -= end - (index + 1);
+        self->rows[index].is_expanded = 0;
+        return MLE_OK;
+    }
+
+    // Expand: list dir below row
+    _browse_list_rows(self, row->path, row->depth + 1, &rows, &rows_len);
+    if (self->invoker && rows_len > 0) {
+        _browse_format_rows(rows, rows_len, 1, &data, &data_len);
+        mark_a = buffer_add_mark(self->invoker->buffer, NULL, 0);
+        buffer_get_bline(self->invoker->buffer, (bint_t)index, &bline);
+        mark_move_to(mark_a, (bint_t)index, bline->char_count);
+        mark_insert_before(mark_a, data, (bint_t)data_len);
+        mark_destroy(mark_a);
+        free(data);
+    }
+    _browse_insert_rows(self, index + 1, rows, rows_len);
+    self->rows[index].is_expanded = 1;
+    if (rows) free(rows);
+    return MLE_OK;
+}
+
+// Browse a different root, e.g., the parent dir, and refill invoker
+int browse_set_root(browse_t* self, char* root) {
+    char* real_root;
+    char* data;
+    size_t data_len;
+    size_t i;
+    if (!(real_root = realpath(root, NULL)) || !util_is_dir(real_root)) {
+        if (real_root) free(real_root);
+        MLE_RETURN_ERR(self->editor, "Cannot browse to: '%s'", root);
+    }
+    for (i = 0; i < self->rows_len; i++) free(self->rows[i].path);
+    self->rows_len = 0;
+    free(self->root);
+    self->root = real_root;
+    _browse_reset_rows(self);
+    if (self->invoker) {
+        browse_get_text(self, &data, &data_len);
+        buffer_set(self->invoker->buffer, data, (bint_t)data_len);
+        mark_move_beginning(self->invoker->active_cursor->mark);
+        free(data);
+    }
+    return MLE_OK;
+}
+
+// Free a browse_t. Cached listings stay on the editor.
+int browse_destroy(browse_t* self) {
+    size_t i;
+    if (self->invoker && self->invoker->browse == self) {
+        self->invoker->browse = NULL;
+    }
+    for (i = 0; i < self->rows_len; i++) free(self->rows[i].path);
+    if (self->rows) free(self->rows);
+    free(self->root);
+    free(self);
+    return MLE_OK;
+}
+
+// Free cached listings
+int browse_clear_cache(editor_t* editor) {
+    browse_dir_t* dir;
+    browse_dir_t* dir_tmp;
+    HASH_ITER(hh, editor->browse_dirs, dir, dir_tmp) {
+        HASH_DEL(editor->browse_dirs, dir);
+        _browse_free_dir(dir);
+    }
+    return MLE_OK;
+}
+
+// Return listing of path, reading it if not cached or if it changed
+static browse_dir_t* _browse_get_dir(editor_t* editor, char* path) {
+    browse_dir_t* dir;
+    struct stat st;
+    if (stat(path, &st) != 0) return NULL;
+    HASH_FIND_STR(editor->browse_dirs, path, dir);
+    if (dir) {
+        if (dir->mtime.tv_sec == st.st_mtim.tv_sec && dir->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            return dir;
+        }
+        HASH_DEL(editor->browse_dirs, dir);
+        _browse_free_dir(dir);
+    }
+    dir = calloc(1, sizeof(browse_dir_t));
+    dir->path = strdup(path);
+    dir->mtime = st.st_mtim;
+    if (_browse_read_dir(path, &dir->entries, &dir->entries_len) != MLE_OK) {
+        _browse_free_dir(dir);
+        return NULL;
+    }
+    HASH_ADD_KEYPTR(hh, editor->browse_dirs, dir->path, strlen(dir->path), dir);
+    return dir;
+}
+
+// Read entries of path with getdents64, skipping dot files. d_type is
+// trusted where the fs fills it; symlinks and unknowns are stat'd once.
+static int _browse_read_dir(char* path, browse_entry_t** ret_entries, size_t* ret_entries_len) {
+    char buf[32 * 1024] __attribute__((aligned(__alignof__(struct dirent64))));
+    struct dirent64* ent;
+    struct stat st;
+    browse_entry_t* entries;
+    size_t entries_len;
+    size_t entries_size;
+    long nbytes;
+    long off;
+    mode_t mode;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return MLE_ERR;
+    entries = NULL;
+    entries_len = 0;
+    entries_size = 0;
+    while ((nbytes = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (off = 0; off < nbytes; off += ent->d_reclen) {
+            ent = (struct dirent64*)(buf + off);
+            if (ent->d_name[0] == '.') continue;
+            if (ent->d_type == DT_DIR) {
+                mode = S_IFDIR;
+            } else if (ent->d_type == DT_REG) {
+                mode = S_IFREG;
+            } else if (fstatat(fd, ent->d_name, &st, 0) == 0) {
+                mode = st.st_mode & S_IFMT;
+            } else {
+                mode = 0; // E.g., dangling symlink
+            }
+            if (entries_len + 1 > entries_size) {
+                entries_size = entries_size ? entries_size * 2 : 64;
+                entries = realloc(entries, sizeof(browse_entry_t) * entries_size);
+            }
+            entries[entries_len].name = strdup(ent->d_name);
+            entries[entries_len].mode = mode;
+            entries_len += 1;
+        }
+    }
+    close(fd);
+    qsort(entries, entries_len, sizeof(browse_entry_t), _browse_entry_cmp);
+    *ret_entries = entries;
+    *ret_entries_len = entries_len;
+    return MLE_OK;
+}
+
+// Free a browse_dir_t
+static void _browse_free_dir(browse_dir_t* dir) {
+    size_t i;
+    for (i = 0; i < dir->entries_len; i++) free(dir->entries[i].name);
+    if (dir->entries) free(dir->entries);
+    free(dir->path);
+    free(dir);
+}
+
+// Make rows for entries of path
+static void _browse_list_rows(browse_t* self, char* path, int depth, browse_row_t** ret_rows, size_t* ret_rows_len) {
+    browse_dir_t* dir;
+    browse_row_t* rows;
+    size_t i;
+    *ret_rows = NULL;
+    *ret_rows_len = 0;
+    if (!(dir = _browse_get_dir(self->editor, path)) || dir->entries_len < 1) return;
+    rows = calloc(dir->entries_len, sizeof(browse_row_t));
+    for (i = 0; i < dir->entries_len; i++) {
+        asprintf(&rows[i].path, "%s%s%s", path, strcmp(path, "/") == 0 ? "" : "/", dir->entries[i].name);
+        rows[i].depth = depth;
+        rows[i].is_dir = S_ISDIR(dir->entries[i].mode) ? 1 : 0;
+    }
+    *ret_rows = rows;
+    *ret_rows_len = dir->entries_len;
+}
+
+// Insert rows at index. Takes ownership of row paths.
+static void _browse_insert_rows(browse_t* self, size_t index, browse_row_t* rows, size_t rows_len) {
+    if (rows_len < 1) return;
+    if (self->rows_len + rows_len > self->rows_size) {
+        self->rows_size = MLE_MAX(self->rows_size * 2, self->rows_len + rows_len);
+        self->rows = realloc(self->rows, sizeof(browse_row_t) * self->rows_size);
+    }
+    memmove(self->rows + index + rows_len, self->rows + index, sizeof(browse_row_t) * (self->rows_len - index));
+    memcpy(self->rows + index, rows, sizeof(browse_row_t) * rows_len);
+    self->rows_len += rows_len;
+}
+
+// Format rows as indented names, dirs with a trailing slash
+static void _browse_format_rows(browse_row_t* rows, size_t rows_len, int is_leading_nl, char** ret_data, size_t* ret_data_len) {
+    char* data;
+    char* name;
+    size_t data_len;
+    size_t data_size;
+    size_t need;
+    size_t i;
+    int d;
+    data = NULL;
+    data_len = 0;
+    data_size = 0;
+    for (i = 0; i < rows_len; i++) {
+        if (rows[i].depth < 0) {
+            name = "..";
+        } else {
+            name = strrchr(rows[i].path, '/');
+            name = name ? name + 1 : rows[i].path;
+        }
+        need = strlen(name) + (size_t)MLE_MAX(0, rows[i].depth) * 2 + 3;
+        if (data_len + need > data_size) {
+            data_size = MLE_MAX(data_size * 2, data_len + need);
+            data = realloc(data, data_size);
+        }
+        if (is_leading_nl || i > 0) data[data_len++] = '\n';
+        for (d = 0; d < rows[i].depth; d++) {
+            data[data_len++] = ' ';
+            data[data_len++] = ' ';
+        }
+        memcpy(data + data_len, name, strlen(name));
+        data_len += strlen(name);
+        if (rows[i].is_dir && rows[i].depth >= 0) data[data_len++] = '/';
+    }
+    if (!data) data = calloc(1, 1);
+    *ret_data = data;
+    *ret_data_len = data_len;
+}
+
+// Fill rows with parent dir row and top level of root
+static void _browse_reset_rows(browse_t* self) {
+    browse_row_t parent;
+    browse_row_t* rows;
+    size_t rows_len;
+    parent.path = strdup(self->root);
+    parent.depth = -1;
+    parent.is_dir = 1;
+    parent.is_expanded = 0;
+    _browse_insert_rows(self, 0, &parent, 1);
+    _browse_list_rows(self, self->root, 0, &rows, &rows_len);
+    _browse_insert_rows(self, 1, rows, rows_len);
+    if (rows) free(rows);
+}
+
+// qsort comparator for browse_entry_t by name
+static int _browse_entry_cmp(const void* a, const void* b) {
+    return strcmp(((browse_entry_t*)a)->name, ((browse_entry_t*)b)->name);
+}
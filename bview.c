@@ -9,6 +9,8 @@ static void _bview_deinit(bview_t* self);
 static buffer_t* _bview_open_buffer(bview_t* self, char* path, int path_len);
 static void _bview_draw_prompt(bview_t* self);
 static void _bview_draw_status(bview_t* self);
+static void _bview_status_print(editor_t* editor, int* x, uint16_t fg, uint16_t bg, char* str);
+static void _bview_status_print_num(editor_t* editor, int* x, uint16_t fg, uint16_t bg, bint_t num);
 static void _bview_draw_edit(bview_t* self, int x, int y, int w, int h);
 static void _bview_draw_bline(bview_t* self, bline_t* bline, int rect_y);
 static void _bview_buffer_callback(buffer_t* buffer, baction_t* action, void* udata);
@@ -16,6 +18,19 @@ static int _bview_rectify_viewport_dim(bview_t* self, bline_t* bline, bint_t vpo
 static bint_t _bview_get_col_from_vcol(bview_t* self, bline_t* bline, bint_t vcol);
 static int _bview_set_linenum_width(bview_t* self);
 static void _bview_highlight_bracket_pair(bview_t* self, mark_t* mark);
+static void _bview_damage_action(bview_t* self, baction_t* action);
+static void _bview_damage_screen_row(bview_t* self, int screen_y);
+static uint64_t _bview_get_sel_hash(bview_t* self, int* ret_count, bint_t* ret_lo_line, bint_t* ret_hi_line);
+static void _bview_restyle_sel_lines(bview_t* self);
+static void _bview_restyle_lines(bview_t* self, bint_t start_line_index, bint_t end_line_index);
+static void _bview_shift_rows(bview_t* self, int delta);
+static void _bview_draw_gutter(bview_t* self, bline_t* bline, int rect_y, int is_cursor_line, bint_t viewport_x, bint_t viewport_x_vcol);
+static void _bview_fill_cells(struct tb_cell* cells, int len, uint32_t ch, uint16_t fg, uint16_t bg);
+static void _bview_fill_num(struct tb_cell* cells, int width, bint_t num, uint16_t fg, uint16_t bg);
+static int _bview_count_digits(bint_t num);
+static struct tb_cell* _bview_get_bline_cells(bview_t* self, bline_t* bline, bint_t viewport_x, int is_cursor_line);
+static void _bview_uncache_bline(bview_t* self, bline_t* bline);
+static void _bview_clear_cell_cache(bview_t* self);
 static int _bview_get_screen_coords(bview_t* self, mark_t* mark, int* ret_x, int* ret_y, struct tb_cell** optret_cell);
 
 // Create a new bview
@@ -38,6 +53,7 @@ bview_t* bview_new(editor_t* editor, char* opt_path, int opt_path_len, buffer_t*
     self->tab_to_space = editor->tab_to_space;
     self->viewport_scope_x = editor->viewport_scope_x;
     self->viewport_scope_y = editor->viewport_scope_y;
+    self->is_damaged = 1;
     getcwd(self->init_cwd, PATH_MAX + 1);
 
     // Open buffer
@@ -65,6 +81,8 @@ int bview_open(bview_t* self, char* path, int path_len) {
 int bview_destroy(bview_t* self) {
     _bview_deinit(self);
     if (self->path) free(self->path);
+    if (self->damage_rows) free(self->damage_rows);
+    _bview_clear_cell_cache(self);
     // TODO ensure everything freed
     free(self);
     return MLE_OK;
@@ -122,6 +140,13 @@ int bview_resize(bview_t* self, int x, int y, int w, int h) {
         self->rect_buffer.h = ah;
     }
 
+    // Resize damage_rows and repaint
+    if (self->damage_rows_len != self->rect_buffer.h) {
+        self->damage_rows_len = MLE_MAX(0, self->rect_buffer.h);
+        self->damage_rows = realloc(self->damage_rows, self->damage_rows_len + 1);
+    }
+    bview_damage(self);
+
     if (self->split_child) {
         bview_resize(
             self->split_child,
@@ -149,12 +174,15 @@ bview_t* bview_get_split_root(bview_t* self) {
 
 // Draw bview to screen
 int bview_draw(bview_t* self) {
+    uint64_t start_us;
+    start_us = perf_now_us();
     if (MLE_BVIEW_IS_PROMPT(self)) {
         _bview_draw_prompt(self);
     } else if (MLE_BVIEW_IS_STATUS(self)) {
         _bview_draw_status(self);
     }
     _bview_draw_edit(self, self->x, self->y, self->w, self->h);
+    perf_record(self->editor, MLE_PERF_DRAW, start_us);
     return MLE_OK;
 }
 
@@ -178,6 +206,8 @@ int bview_draw_cursor(bview_t* self, int set_real_cursor) {
             // Set fake cursor
             tb_change_cell(screen_x, screen_y, cell->ch, cell->fg, cell->bg | (cursor->is_asleep ? TB_RED : TB_CYAN)); // TODO configurable
         }
+        // Repaint this row next frame in case the cursor moves away
+        _bview_damage_screen_row(self, screen_y);
         if (self->editor->highlight_bracket_pairs) {
             _bview_highlight_bracket_pair(self, mark);
         }
@@ -185,6 +215,98 @@ int bview_draw_cursor(bview_t* self, int set_real_cursor) {
     return MLE_OK;
 }
 
+// Mark entire bview for repaint on next draw
+int bview_damage(bview_t* self) {
+    self->is_damaged = 1;
+    _bview_clear_cell_cache(self); // Styles may have changed
+    return MLE_OK;
+}
+
+// Mark lines start_line_index thru end_line_index (inclusive) for repaint on
+// next draw. An end_line_index of -1 means thru the bottom of the viewport.
+// Rows are relative to the last drawn viewport; if the viewport moves before
+// the next draw, the whole bview is repainted anyway.
+int bview_damage_lines(bview_t* self, bint_t start_line_index, bint_t end_line_index) {
+    bint_t start_row;
+    bint_t end_row;
+    if (self->is_damaged || self->damage_rows_len < 1) {
+        return MLE_OK;
+    }
+    start_row = MLE_MAX(0, start_line_index - self->last_viewport_y);
+    if (end_line_index < 0) {
+        end_row = self->damage_rows_len - 1;
+    } else {
+        end_row = MLE_MIN(self->damage_rows_len - 1, end_line_index - self->last_viewport_y);
+    }
+    if (start_row <= end_row) {
+        memset(self->damage_rows + start_row, 1, (size_t)(end_row - start_row + 1));
+    }
+    return MLE_OK;
+}
+
+// Render rect_buffer.w cells of bline starting at viewport_x into cells
+int bview_render_bline_cells(bview_t* self, bline_t* bline, bint_t viewport_x, int is_cursor_line, struct tb_cell* cells) {
+    int rect_x;
+    bint_t char_col;
+    bint_t color_col;
+    bint_t byte_index;
+    size_t run;
+    int fg;
+    int bg;
+    int bg_extra;
+    uint32_t ch;
+    int char_w;
+    int i;
+
+    color_col = MLE_BVIEW_IS_EDIT(self) ? self->editor->color_col : -1;
+    bg_extra = MLE_BVIEW_IS_MENU(self) && is_cursor_line ? TB_REVERSE : 0;
+    rect_x = 0;
+    char_col = viewport_x;
+    while (rect_x < self->rect_buffer.w && char_col < bline->char_count) {
+        // Copy a run of printable ASCII in bulk. Each of those bytes is one
+        // char one cell wide, so no width or iswprint lookups are needed.
+        byte_index = bline->chars[char_col].index;
+        run = util_ascii_printable_len(bline->data + byte_index, (size_t)MLE_MIN(bline->data_len - byte_index, self->rect_buffer.w - rect_x));
+        if (run > 0) {
+            for (i = 0; i < (int)run; i++, char_col++) {
+                cells[rect_x++] = (struct tb_cell){
+                    (uint32_t)(unsigned char)bline->data[byte_index + i],
+                    bline->char_styles[char_col].fg,
+                    bline->char_styles[char_col].bg | bg_extra | (char_col == color_col ? TB_RED : 0)
+                };
+            }
+            continue;
+        }
+
+        // Render tab, control or non-ASCII char
+        ch = bline->chars[char_col].ch;
+        fg = bline->char_styles[char_col].fg;
+        bg = bline->char_styles[char_col].bg | bg_extra;
+        char_w = char_col == bline->char_count - 1
+            ? bline->char_vwidth - bline->chars[char_col].vcol
+            : bline->chars[char_col + 1].vcol - bline->chars[char_col].vcol;
+        if (ch == '\t') {
+            ch = ' ';
+        } else if (!iswprint(ch)) {
+            ch = '?';
+        }
+        if (color_col == char_col) {
+            bg |= TB_RED;
+        }
+        for (i = 0; i < char_w && rect_x < self->rect_buffer.w; i++) {
+            cells[rect_x++] = (struct tb_cell){ ch, fg, bg };
+        }
+        char_col++;
+    }
+
+    // Blank the rest of the row
+    for (; rect_x < self->rect_buffer.w; rect_x++) {
+        cells[rect_x] = (struct tb_cell){ ' ', self->rect_buffer.fg, self->rect_buffer.bg };
+    }
+
+    return MLE_OK;
+}
+
 // Push a kmap
 int bview_push_kmap(bview_t* bview, kmap_t* kmap) {
     kmap_node_t* node;
@@ -193,6 +315,7 @@ int bview_push_kmap(bview_t* bview, kmap_t* kmap) {
     node->bview = bview;
     DL_APPEND(bview->kmap_stack, node);
     bview->kmap_tail = node;
+    bview->kmap_dispatch_gen = -1;
     return MLE_OK;
 }
 
@@ -209,6 +332,7 @@ int bview_pop_kmap(bview_t* bview, kmap_t** optret_kmap) {
     bview->kmap_tail = node_to_pop->prev != node_to_pop ? node_to_pop->prev : NULL;
     DL_DELETE(bview->kmap_stack, node_to_pop);
     free(node_to_pop);
+    bview->kmap_dispatch_gen = -1;
     return MLE_OK;
 }
 
@@ -270,6 +394,7 @@ int bview_remove_cursor(bview_t* self, cursor_t* cursor) {
                 buffer_remove_srule(el->bview->buffer, el->sel_rule);
                 srule_destroy(el->sel_rule);
                 el->sel_rule = NULL;
+                editor_damage(self->editor, self->buffer);
             }
             if (el->cut_buffer) free(el->cut_buffer);
             free(el);
@@ -350,6 +475,47 @@ int bview_destroy_listener(bview_t* self, bview_listener_t* listener) {
     return MLE_OK;
 }
 
+// Queue data to append to the end of the buffer. Menus fed by async procs use
+// this so that output arriving between frames lands in a single insert.
+int bview_append(bview_t* self, char* data, size_t data_len) {
+    if (self->append_len + data_len > self->append_size) {
+        self->append_size = MLE_MAX(self->append_size * 2, self->append_len + data_len);
+        self->append_buf = realloc(self->append_buf, self->append_size);
+    }
+    memcpy(self->append_buf + self->append_len, data, data_len);
+    self->append_len += data_len;
+    return MLE_OK;
+}
+
+// Insert queued appends at the tail of the buffer
+int bview_flush_appends(bview_t* self) {
+    mark_t* active_mark;
+    int is_cursor_at_zero;
+    if (self->append_len < 1) return MLE_OK;
+
+    // Remember if cursor is at 0
+    active_mark = self->active_cursor->mark;
+    is_cursor_at_zero = active_mark->bline->line_index == 0 && active_mark->col == 0 ? 1 : 0;
+
+    // Insert at persistent tail mark
+    if (!self->append_mark) {
+        self->append_mark = buffer_add_mark(self->buffer, NULL, 0);
+    }
+    mark_move_end(self->append_mark);
+    mark_insert_before(self->append_mark, self->append_buf, (bint_t)self->append_len);
+    self->append_len = 0;
+    bview_rectify_viewport(self);
+
+    if (is_cursor_at_zero) mark_move_beginning(active_mark);
+    return MLE_OK;
+}
+
+// Drop queued appends, e.g., when the buffer is cleared
+int bview_discard_appends(bview_t* self) {
+    self->append_len = 0;
+    return MLE_OK;
+}
+
 // Rectify a viewport dimension. Return 1 if changed, else 0.
 static int _bview_rectify_viewport_dim(bview_t* self, bline_t* bline, bint_t vpos, int dim_scope, int dim_size, bint_t *view_vpos) {
     int rc;
@@ -444,20 +610,24 @@ static void _bview_buffer_callback(buffer_t* buffer, baction_t* action, void* ud
         bview_rectify_viewport(active);
     }
 
-    if (action && action->line_delta != 0) {
-        bview_t* bview;
-        bview_t* tmp1;
-        bview_t* tmp2;
-        CDL_FOREACH_SAFE2(editor->all_bviews, bview, tmp1, tmp2, all_prev, all_next) {
-            if (bview->buffer == buffer) {
-                // Adjust linenum_width
-                if (_bview_set_linenum_width(bview)) {
-                    bview_resize(bview, bview->x, bview->y, bview->w, bview->h);
-                }
-                // Adjust viewport_bline
-                buffer_get_bline(bview->buffer, bview->viewport_y, &bview->viewport_bline);
+    // Keep bracket index in sync
+    bracket_index_update(editor, buffer, action);
+
+    bview_t* bview;
+    bview_t* tmp1;
+    bview_t* tmp2;
+    CDL_FOREACH_SAFE2(editor->all_bviews, bview, tmp1, tmp2, all_prev, all_next) {
+        if (bview->buffer != buffer) continue;
+        if (action && action->line_delta != 0) {
+            // Adjust linenum_width
+            if (_bview_set_linenum_width(bview)) {
+                bview_resize(bview, bview->x, bview->y, bview->w, bview->h);
             }
+            // Adjust viewport_bline
+            buffer_get_bline(bview->buffer, bview->viewport_y, &bview->viewport_bline);
         }
+        // Repaint affected lines
+        _bview_damage_action(bview, action);
     }
 
     // Call bview listeners
@@ -470,11 +640,11 @@ static void _bview_buffer_callback(buffer_t* buffer, baction_t* action, void* ud
 static int _bview_set_linenum_width(bview_t* self) {
     int orig;
     orig = self->linenum_width;
-    self->abs_linenum_width = MLE_MAX(1, (int)(floor(log10((double)self->buffer->line_count))) + 1);
+    self->abs_linenum_width = _bview_count_digits(self->buffer->line_count);
     if (self->editor->linenum_type != MLE_LINENUM_TYPE_ABS) {
         self->rel_linenum_width = MLE_MAX(
             self->editor->linenum_type == MLE_LINENUM_TYPE_BOTH ? 1 : self->abs_linenum_width,
-            (int)(floor(log10((double)self->rect_buffer.h))) + 1
+            _bview_count_digits(self->rect_buffer.h)
         );
     } else {
         self->rel_linenum_width = 0;
@@ -498,6 +668,8 @@ static void _bview_deinit(bview_t* self) {
     while (self->kmap_tail) {
         bview_pop_kmap(self, NULL);
     }
+    if (self->kmap_dispatch.entries) free(self->kmap_dispatch.entries);
+    self->kmap_dispatch.entries = NULL;
 
     // Remove all syntax rules
     if (self->syntax) {
@@ -507,6 +679,7 @@ static void _bview_deinit(bview_t* self) {
             buffer_remove_srule(self->buffer, srule_node->srule);
         }
         buffer_set_styles_enabled(self->buffer, 1);
+        editor_damage(self->editor, self->buffer);
     }
 
     // Remove all cursors
@@ -520,15 +693,46 @@ static void _bview_deinit(bview_t* self) {
         self->async_proc = NULL;
     }
 
+    // Stop grep
+    if (self->grep) {
+        grep_destroy(self->grep);
+        self->grep = NULL;
+    }
+
+    // Detach from path index, which outlives the menu
+    if (self->fsindex) {
+        fsindex_set_invoker(self->fsindex, NULL);
+    }
+
+    // Drop browse rows
+    if (self->browse) {
+        browse_destroy(self->browse);
+        self->browse = NULL;
+    }
+
+    // Drop queued appends
+    if (self->append_mark) {
+        mark_destroy(self->append_mark);
+        self->append_mark = NULL;
+    }
+    if (self->append_buf) free(self->append_buf);
+    self->append_buf = NULL;
+    self->append_len = 0;
+    self->append_size = 0;
+
     // Remove all listeners
     DL_FOREACH_SAFE(self->listeners, listener, listener_tmp) {
         bview_destroy_listener(self, listener);
     }
 
+    // Drop rendered lines
+    _bview_clear_cell_cache(self);
+
     // Dereference/free buffer
     if (self->buffer) {
         self->buffer->ref_count -= 1;
         if (self->buffer->ref_count < 1) {
+            bracket_index_destroy(self->editor, self->buffer);
             buffer_destroy(self->buffer);
         }
     }
@@ -587,6 +791,7 @@ int bview_set_syntax(bview_t* self, char* opt_syntax) {
     }
 
     buffer_set_styles_enabled(self->buffer, 1);
+    editor_damage(self->editor, self->buffer);
 
     return use_syntax ? MLE_OK : MLE_ERR;
 }
@@ -619,121 +824,149 @@ static void _bview_draw_status(bview_t* self) {
     editor_t* editor;
     bview_t* active;
     bview_t* active_edit;
+    bview_t* bview_tmp;
     mark_t* mark;
+    bview_status_t status;
+    int x;
+    int has_errstr;
 
     editor = self->editor;
     active = editor->active;
     active_edit = editor->active_edit;
     mark = active_edit->active_cursor->mark;
+    has_errstr = editor->errstr[0] != '\0' ? 1 : 0;
 
-    // Prompt
+    // Renumber edit bviews if one was opened or closed
+    if (editor->is_edit_bview_num_dirty) {
+        x = 0;
+        CDL_FOREACH2(editor->all_bviews, bview_tmp, all_next) {
+            if (MLE_BVIEW_IS_EDIT(bview_tmp)) bview_tmp->edit_bview_num = ++x;
+        }
+        editor->is_edit_bview_num_dirty = 0;
+    }
+
+    // Snapshot status fields
+    memset(&status, 0, sizeof(bview_status_t));
     if (active == editor->prompt) {
-        tb_printf(editor->rect_status, 0, 0, TB_GREEN | TB_BOLD, TB_BLACK, "%-*.*s", editor->rect_status.w, editor->rect_status.w, self->editor->prompt->prompt_str);
+        status.prompt_str = editor->prompt->prompt_str;
+    } else {
+        status.kmap_name = active->kmap_tail->kmap->name;
+        status.syntax_name = active_edit->syntax ? active_edit->syntax->name : "none";
+        status.need_input = editor->loop_ctx->need_more_input ? 1 : 0;
+        status.is_anchored = active_edit->active_cursor->is_sel_bound_anchored ? 1 : 0;
+        status.macro_state = editor->is_recording_macro ? 1 : (editor->macro_apply ? 2 : 0);
+        status.async_frame = -1;
+        if (editor->async_procs) {
+            // Advance by wall clock; the loop wakes every MLE_ASYNC_FRAME_MS
+            status.async_frame = (int)((perf_now_us() / (MLE_ASYNC_FRAME_MS * 1000)) % 4);
+        }
+        status.bview_num = active_edit->edit_bview_num;
+        status.bview_count = editor->edit_bview_count;
+        status.line = mark->bline->line_index + 1;
+        status.line_count = active_edit->buffer->line_count;
+        status.col = mark->col;
+        status.char_count = mark->bline->char_count;
+    }
+
+    // Skip if nothing changed since last draw. A pending errstr always
+    // redraws, since a new error may follow another. It is only shown for one
+    // frame, so it is part of the snapshot to force the redraw that clears it.
+    status.has_errstr = has_errstr;
+    if (!self->is_damaged && !has_errstr && memcmp(&status, &editor->status_last, sizeof(bview_status_t)) == 0) {
+        return;
+    }
+    editor->status_last = status;
+    self->is_damaged = 0;
+
+    // Prompt
+    if (status.prompt_str) {
+        tb_printf(editor->rect_status, 0, 0, TB_GREEN | TB_BOLD, TB_BLACK, "%-*.*s", editor->rect_status.w, editor->rect_status.w, status.prompt_str);
         goto _bview_draw_status_end;
     }
 
-    // Macro indicator
-    int i_macro_fg, i_macro_bg;
-    char* i_macro;
-    if (editor->is_recording_macro) {
-        i_macro_fg = TB_RED | TB_BOLD;
-        i_macro_bg = TB_WHITE;
-        i_macro = "\xe2\x97\x8f";
-    } else if (editor->macro_apply) {
-        i_macro_fg = TB_WHITE | TB_BOLD;
-        i_macro_bg = TB_GREEN;
-        i_macro = "\xe2\x96\xb6";
+    // Render status line
+    x = 0;
+    _bview_status_print(editor, &x, TB_MAGENTA | TB_BOLD, 0, status.kmap_name);
+    _bview_status_print(editor, &x, 0, 0, "(");
+    if (status.need_input) {
+        _bview_status_print(editor, &x, TB_BLACK, TB_BLUE, "\xe2\x80\xa6");
     } else {
-        i_macro_fg = 0;
-        i_macro_bg = 0;
-        i_macro = ".";
-    }
-
-    // Anchor indicator
-    int i_anchor_fg, i_anchor_bg;
-    char* i_anchor;
-    if (active_edit->active_cursor->is_sel_bound_anchored) {
-        i_anchor_fg = TB_REVERSE | TB_BOLD;
-        i_anchor_bg = TB_DEFAULT;
-        i_anchor = "a";
+        _bview_status_print(editor, &x, 0, 0, ".");
+    }
+    if (status.is_anchored) {
+        _bview_status_print(editor, &x, TB_REVERSE | TB_BOLD, TB_DEFAULT, "a");
     } else {
-        i_anchor_fg = 0;
-        i_anchor_bg = 0;
-        i_anchor = ".";
-    }
-
-    // Async indicator
-    int i_async_fg, i_async_bg;
-    char* i_async;
-    static int i_async_idx = 0;
-    if (editor->async_procs) {
-        i_async_fg = TB_BLACK | TB_BOLD;
-        i_async_bg = TB_YELLOW;
-        if (i_async_idx < 100)      i_async = "\xe2\x96\x9d";
-        else if (i_async_idx < 200) i_async = "\xe2\x96\x97";
-        else if (i_async_idx < 300) i_async = "\xe2\x96\x96";
-        else if (i_async_idx < 400) i_async = "\xe2\x96\x98";
-        if (++i_async_idx >= 400) i_async_idx = 0;
+        _bview_status_print(editor, &x, 0, 0, ".");
+    }
+    if (status.macro_state == 1) {
+        _bview_status_print(editor, &x, TB_RED | TB_BOLD, TB_WHITE, "\xe2\x97\x8f");
+    } else if (status.macro_state == 2) {
+        _bview_status_print(editor, &x, TB_WHITE | TB_BOLD, TB_GREEN, "\xe2\x96\xb6");
     } else {
-        i_async_fg = 0;
-        i_async_bg = 0;
-        i_async = ".";
-    }
-
-    // Need-more-input icon
-    int i_needinput_fg;
-    int i_needinput_bg;
-    char* i_needinput;
-    if (editor->loop_ctx->need_more_input) {
-        i_needinput_fg = TB_BLACK;
-        i_needinput_bg = TB_BLUE;
-        i_needinput = "\xe2\x80\xa6";
+        _bview_status_print(editor, &x, 0, 0, ".");
+    }
+    if (status.async_frame >= 0) {
+        static char* i_async[] = { "\xe2\x96\x9d", "\xe2\x96\x97", "\xe2\x96\x96", "\xe2\x96\x98" };
+        _bview_status_print(editor, &x, TB_BLACK | TB_BOLD, TB_YELLOW, i_async[status.async_frame]);
     } else {
-        i_needinput_fg = 0;
-        i_needinput_bg = 0;
-        i_needinput = ".";
+        _bview_status_print(editor, &x, 0, 0, ".");
     }
-
-    // Bview num TODO pre-compute this
-    bview_t* bview_tmp;
-    int bview_count = 0;
-    int bview_num = 0;
-    CDL_FOREACH2(editor->all_bviews, bview_tmp, all_next) {
-        if (MLE_BVIEW_IS_EDIT(bview_tmp)) {
-            bview_count += 1;
-            if (bview_tmp == active_edit) bview_num = bview_count;
-        }
+    _bview_status_print(editor, &x, 0, 0, ")  buf:");
+    _bview_status_print_num(editor, &x, TB_BLUE | TB_BOLD, 0, status.bview_num);
+    _bview_status_print(editor, &x, 0, 0, "/");
+    _bview_status_print_num(editor, &x, TB_BLUE, 0, status.bview_count);
+    _bview_status_print(editor, &x, 0, 0, "  <");
+    _bview_status_print(editor, &x, TB_CYAN | TB_BOLD, 0, status.syntax_name);
+    _bview_status_print(editor, &x, 0, 0, ">  line:");
+    _bview_status_print_num(editor, &x, TB_YELLOW | TB_BOLD, 0, status.line);
+    _bview_status_print(editor, &x, 0, 0, "/");
+    _bview_status_print_num(editor, &x, TB_YELLOW, 0, status.line_count);
+    _bview_status_print(editor, &x, 0, 0, "  col:");
+    _bview_status_print_num(editor, &x, TB_YELLOW | TB_BOLD, 0, status.col);
+    _bview_status_print(editor, &x, 0, 0, "/");
+    _bview_status_print_num(editor, &x, TB_YELLOW, 0, status.char_count);
+    while (x < editor->rect_status.w) {
+        _bview_status_print(editor, &x, 0, 0, " ");
     }
 
-    // Render status line
-    tb_printf(editor->rect_status, 0, 0, 0, 0, "%*.*s", editor->rect_status.w, editor->rect_status.w, " ");
-    tb_printf_attr(editor->rect_status, 0, 0,
-        "@%d,%d;%s@%d,%d;"                                // mle_normal    mode
-        "(@%d,%d;%s@%d,%d;%s@%d,%d;%s@%d,%d;%s@%d,%d;)  " // (....)        need_input,anchor,macro,async
-        "buf:@%d,%d;%d@%d,%d;/@%d,%d;%d@%d,%d;  "         // buf[1/2]      bview num
-        "<@%d,%d;%s@%d,%d;>  "                            // <php>         syntax
-        "line:@%d,%d;%llu@%d,%d;/@%d,%d;%llu@%d,%d;  "    // line:1/100    line
-        "col:@%d,%d;%llu@%d,%d;/@%d,%d;%llu@%d,%d; ",     // col:0/80      col
-        TB_MAGENTA | TB_BOLD, 0, active->kmap_tail->kmap->name, 0, 0,
-        i_needinput_fg, i_needinput_bg, i_needinput,
-        i_anchor_fg, i_anchor_bg, i_anchor,
-        i_macro_fg, i_macro_bg, i_macro,
-        i_async_fg, i_async_bg, i_async, 0, 0,
-        TB_BLUE | TB_BOLD, 0, bview_num, 0, 0, TB_BLUE, 0, bview_count, 0, 0,
-        TB_CYAN | TB_BOLD, 0, active_edit->syntax ? active_edit->syntax->name : "none", 0, 0,
-        TB_YELLOW | TB_BOLD, 0, mark->bline->line_index + 1, 0, 0, TB_YELLOW, 0, active_edit->buffer->line_count, 0, 0,
-        TB_YELLOW | TB_BOLD, 0, mark->col, 0, 0, TB_YELLOW, 0, mark->bline->char_count, 0, 0
-    );
-
     // Overlay errstr if present
 _bview_draw_status_end:
-    if (editor->errstr[0] != '\0') {
+    if (has_errstr) {
         int errstrlen = strlen(editor->errstr) + 5; // Add 5 for "err! "
         tb_printf(editor->rect_status, editor->rect_status.w - errstrlen, 0, TB_WHITE | TB_BOLD, TB_RED, "err! %s", editor->errstr);
         editor->errstr[0] = '\0'; // Clear errstr
     }
 }
 
+// Print str on the status line at *x and advance *x. An fg or bg of 0 means
+// the status line default.
+static void _bview_status_print(editor_t* editor, int* x, uint16_t fg, uint16_t bg, char* str) {
+    uint32_t ch;
+    fg = fg ? fg : editor->rect_status.fg;
+    bg = bg ? bg : editor->rect_status.bg;
+    while (*str && *x < editor->rect_status.w) {
+        str += utf8_char_to_unicode(&ch, str, NULL);
+        tb_change_cell(editor->rect_status.x + *x, editor->rect_status.y, ch, fg, bg);
+        *x += 1;
+    }
+}
+
+// Print num on the status line at *x and advance *x
+static void _bview_status_print_num(editor_t* editor, int* x, uint16_t fg, uint16_t bg, bint_t num) {
+    char buf[24];
+    char* c;
+    int is_neg;
+    c = buf + sizeof(buf) - 1;
+    *c = '\0';
+    is_neg = num < 0 ? 1 : 0;
+    do {
+        *--c = '0' + (char)(is_neg ? -(num % 10) : num % 10);
+        num /= 10;
+    } while (num != 0);
+    if (is_neg) *--c = '-';
+    _bview_status_print(editor, x, fg, bg, c);
+}
+
 static void _bview_draw_edit(bview_t* self, int x, int y, int w, int h) {
     int split_w;
     int split_h;
@@ -743,6 +976,8 @@ static void _bview_draw_edit(bview_t* self, int x, int y, int w, int h) {
     int fg_attr;
     int bg_attr;
     bline_t* bline;
+    cursor_t* cursor;
+    bint_t scroll_delta;
 
     // Handle split
     if (self->split_child) {
@@ -789,6 +1024,31 @@ static void _bview_draw_edit(bview_t* self, int x, int y, int w, int h) {
             self->buffer, self->buffer->is_unsaved ? '*' : ' ');
     }
 
+    // Figure out what needs repainting. Changing the gutter repaints
+    // everything. A pure vertical scroll shifts the rows already drawn and
+    // renders only the rows scrolled into view. This saves rendering, not
+    // output: termbox still writes every cell that moved. Otherwise only rows damaged
+    // by edits, cursors (this frame's and last frame's) or a changed
+    // selection are redrawn.
+    scroll_delta = self->viewport_y - self->last_viewport_y;
+    if (self->linenum_width != self->last_linenum_width
+        || (self->editor->linenum_type != MLE_LINENUM_TYPE_ABS && self->active_cursor->mark->bline->line_index != self->last_cursor_line)
+    ) {
+        self->is_damaged = 1;
+    } else if (scroll_delta != 0) {
+        if (self->is_damaged || scroll_delta >= self->rect_buffer.h || -scroll_delta >= self->rect_buffer.h) {
+            self->is_damaged = 1;
+        } else {
+            _bview_shift_rows(self, (int)scroll_delta);
+            self->last_viewport_y = self->viewport_y;
+        }
+    }
+    _bview_restyle_sel_lines(self);
+    bview_damage_lines(self, self->last_cursor_line, self->last_cursor_line);
+    DL_FOREACH(self->cursors, cursor) {
+        bview_damage_lines(self, cursor->mark->bline->line_index, cursor->mark->bline->line_index);
+    }
+
     // Render lines and margins
     if (!self->viewport_bline) {
         buffer_get_bline(self->buffer, MLE_MAX(0, self->viewport_y), &self->viewport_bline);
@@ -797,31 +1057,33 @@ static void _bview_draw_edit(bview_t* self, int x, int y, int w, int h) {
     for (rect_y = 0; rect_y < self->rect_buffer.h; rect_y++) {
         if (self->viewport_y + rect_y < 0 || self->viewport_y + rect_y >= self->buffer->line_count || !bline) { // "|| !bline" See TODOs below
             // Draw pre/post blank
-            tb_printf(self->rect_lines, 0, rect_y, 0, 0, "%*c", self->linenum_width, '~');
-            tb_printf(self->rect_margin_left, 0, rect_y, 0, 0, "%c", ' ');
-            tb_printf(self->rect_margin_right, 0, rect_y, 0, 0, "%c", ' ');
-            tb_printf(self->rect_buffer, 0, rect_y, 0, 0, "%-*.*s", self->rect_buffer.w, self->rect_buffer.w, " ");
+            if (!self->is_damaged && !self->damage_rows[rect_y]) continue;
+            _bview_draw_gutter(self, NULL, rect_y, 0, 0, 0);
         } else {
             // Draw bline at self->rect_buffer self->viewport_y + rect_y
             // TODO How can bline be NULL here?
             // TODO How can self->viewport_y != self->viewport_bline->line_index ?
-            _bview_draw_bline(self, bline, rect_y);
+            if (self->is_damaged || self->damage_rows[rect_y]) {
+                _bview_draw_bline(self, bline, rect_y);
+            }
             bline = bline->next;
         }
     }
+
+    // Reset damage
+    self->is_damaged = 0;
+    memset(self->damage_rows, 0, self->damage_rows_len);
+    self->last_viewport_y = self->viewport_y;
+    self->last_linenum_width = self->linenum_width;
+    self->last_cursor_line = self->active_cursor->mark->bline->line_index;
 }
 
 static void _bview_draw_bline(bview_t* self, bline_t* bline, int rect_y) {
-    int rect_x;
-    bint_t char_col;
-    int fg;
-    int bg;
-    uint32_t ch;
-    int char_w;
     bint_t viewport_x;
     bint_t viewport_x_vcol;
-    int i;
     int is_cursor_line;
+    int screen_w;
+    struct tb_cell* cells;
 
     // Use viewport_x only for current line
     viewport_x = 0;
@@ -834,59 +1096,307 @@ static void _bview_draw_bline(bview_t* self, bline_t* bline, int rect_y) {
 
     // Draw linenums and margins
     if (MLE_BVIEW_IS_EDIT(self)) {
-        int linenum_fg = is_cursor_line ? TB_BOLD : 0;
-        if (self->editor->linenum_type == MLE_LINENUM_TYPE_ABS
-            || self->editor->linenum_type == MLE_LINENUM_TYPE_BOTH
-            || (self->editor->linenum_type == MLE_LINENUM_TYPE_REL && is_cursor_line)
+        _bview_draw_gutter(self, bline, rect_y, is_cursor_line, viewport_x, viewport_x_vcol);
+    }
+
+    // Copy rendered cells into termbox back buffer
+    screen_w = tb_width();
+    if (self->rect_buffer.y + rect_y >= tb_height() || self->rect_buffer.x >= screen_w) {
+        return;
+    }
+    cells = _bview_get_bline_cells(self, bline, viewport_x, is_cursor_line);
+    memcpy(
+        tb_cell_buffer() + (self->rect_buffer.y + rect_y) * screen_w + self->rect_buffer.x,
+        cells,
+        sizeof(struct tb_cell) * MLE_MIN(self->rect_buffer.w, screen_w - self->rect_buffer.x)
+    );
+}
+
+// Return rendered cells for bline, using the cache if possible
+static struct tb_cell* _bview_get_bline_cells(bview_t* self, bline_t* bline, bint_t viewport_x, int is_cursor_line) {
+    bview_cell_cache_t* entry;
+    int color_col;
+    color_col = MLE_BVIEW_IS_EDIT(self) ? self->editor->color_col : -1;
+
+    HASH_FIND_PTR(self->cell_cache, &bline, entry);
+    if (entry) {
+        HASH_DELETE(hh, self->cell_cache, entry);
+        if (entry->viewport_x == viewport_x
+            && entry->color_col == color_col
+            && entry->tab_width == self->buffer->tab_width
+            && entry->is_cursor_line == is_cursor_line
+            && entry->cells_len == self->rect_buffer.w
         ) {
-            tb_printf(self->rect_lines, 0, rect_y, linenum_fg, 0, "%*d", self->abs_linenum_width, (int)(bline->line_index + 1) % (int)pow(10, self->linenum_width));
-            if (self->editor->linenum_type == MLE_LINENUM_TYPE_BOTH) {
-                tb_printf(self->rect_lines, self->abs_linenum_width, rect_y, linenum_fg, 0, " %*d", self->rel_linenum_width, (int)abs(bline->line_index - self->active_cursor->mark->bline->line_index));
-            }
-        } else if (self->editor->linenum_type == MLE_LINENUM_TYPE_REL) {
-            tb_printf(self->rect_lines, 0, rect_y, linenum_fg, 0, "%*d", self->rel_linenum_width, (int)abs(bline->line_index - self->active_cursor->mark->bline->line_index));
+            // Hit; re-add to move to the back of the LRU
+            HASH_ADD_PTR(self->cell_cache, bline, entry);
+            return entry->cells;
         }
-        tb_printf(self->rect_margin_left, 0, rect_y, 0, 0, "%c", viewport_x > 0 && bline->char_count > 0 ? '^' : ' ');
-        if (bline->char_vwidth - viewport_x_vcol > self->rect_buffer.w) {
-            tb_printf(self->rect_margin_right, 0, rect_y, 0, 0, "%c", '$');
+    } else if (HASH_COUNT(self->cell_cache) >= MLE_BVIEW_CELL_CACHE_MAX) {
+        // Evict least recently used (the head) and reuse it
+        entry = self->cell_cache;
+        HASH_DELETE(hh, self->cell_cache, entry);
+    } else {
+        entry = calloc(1, sizeof(bview_cell_cache_t));
+    }
+
+    // Miss; render into entry
+    if (entry->cells_len != self->rect_buffer.w) {
+        entry->cells_len = self->rect_buffer.w;
+        entry->cells = realloc(entry->cells, sizeof(struct tb_cell) * MLE_MAX(1, entry->cells_len));
+    }
+    entry->bline = bline;
+    entry->viewport_x = viewport_x;
+    entry->color_col = color_col;
+    entry->tab_width = self->buffer->tab_width;
+    entry->is_cursor_line = is_cursor_line;
+    bview_render_bline_cells(self, bline, viewport_x, is_cursor_line, entry->cells);
+    HASH_ADD_PTR(self->cell_cache, bline, entry);
+    return entry->cells;
+}
+
+// Drop cached render of bline
+static void _bview_uncache_bline(bview_t* self, bline_t* bline) {
+    bview_cell_cache_t* entry;
+    HASH_FIND_PTR(self->cell_cache, &bline, entry);
+    if (entry) {
+        HASH_DELETE(hh, self->cell_cache, entry);
+        free(entry->cells);
+        free(entry);
+    }
+}
+
+// Free all cached renders
+static void _bview_clear_cell_cache(bview_t* self) {
+    bview_cell_cache_t* entry;
+    bview_cell_cache_t* entry_tmp;
+    HASH_ITER(hh, self->cell_cache, entry, entry_tmp) {
+        HASH_DELETE(hh, self->cell_cache, entry);
+        free(entry->cells);
+        free(entry);
+    }
+}
+
+// Damage lines touched by a buffer action
+static void _bview_damage_action(bview_t* self, baction_t* action) {
+    if (!action) {
+        bview_damage(self);
+    } else if (action->line_delta != 0 || (self->syntax && self->syntax->has_multi_rules)) {
+        // Lines shifted, or a multi-line rule may restyle everything below.
+        // Freed blines may be reused, so free the whole cell cache.
+        bview_damage_lines(self, action->start_line_index, -1);
+        _bview_clear_cell_cache(self);
+    } else {
+        bview_damage_lines(self, action->start_line_index, action->start_line_index);
+        _bview_uncache_bline(self, action->start_line);
+    }
+}
+
+// Damage a row given its screen y coordinate
+static void _bview_damage_screen_row(bview_t* self, int screen_y) {
+    int rect_y;
+    rect_y = screen_y - self->rect_buffer.y;
+    if (rect_y >= 0 && rect_y < self->damage_rows_len) {
+        self->damage_rows[rect_y] = 1;
+    }
+}
+
+// Shift rows drawn last frame (gutter, margins and buffer) by delta rows and
+// damage the rows scrolled into view. Pending row damage shifts with them.
+// This only skips re-rendering the shifted rows. tb_present diffs against a
+// front buffer we can't shift, so it still writes each moved cell.
+static void _bview_shift_rows(bview_t* self, int delta) {
+    struct tb_cell* cells;
+    int screen_w;
+    int row_w;
+    int rect_y;
+    int h;
+
+    h = self->rect_buffer.h;
+    screen_w = tb_width();
+    row_w = MLE_MIN(self->rect_margin_right.x + 1, screen_w) - self->rect_lines.x;
+    if (row_w < 1 || self->rect_buffer.y + h > tb_height()) {
+        bview_damage(self);
+        return;
+    }
+    cells = tb_cell_buffer() + self->rect_buffer.y * screen_w + self->rect_lines.x;
+
+    if (delta > 0) {
+        // Content moves up
+        for (rect_y = 0; rect_y < h - delta; rect_y++) {
+            memcpy(cells + rect_y * screen_w, cells + (rect_y + delta) * screen_w, sizeof(struct tb_cell) * row_w);
         }
+        memmove(self->damage_rows, self->damage_rows + delta, h - delta);
+        memset(self->damage_rows + (h - delta), 1, delta);
+    } else {
+        // Content moves down
+        delta = -delta;
+        for (rect_y = h - 1; rect_y >= delta; rect_y--) {
+            memcpy(cells + rect_y * screen_w, cells + (rect_y - delta) * screen_w, sizeof(struct tb_cell) * row_w);
+        }
+        memmove(self->damage_rows + delta, self->damage_rows, h - delta);
+        memset(self->damage_rows, 1, delta);
     }
+}
 
-    // Render 0 thru rect_buffer.w cell by cell
-    for (rect_x = 0, char_col = viewport_x; rect_x < self->rect_buffer.w; char_col++) {
-        char_w = 1;
-        if (char_col < bline->char_count) {
-            ch = bline->chars[char_col].ch;
-            fg = bline->char_styles[char_col].fg;
-            bg = bline->char_styles[char_col].bg;
-            char_w = char_col == bline->char_count - 1
-                ? bline->char_vwidth - bline->chars[char_col].vcol
-                : bline->chars[char_col + 1].vcol - bline->chars[char_col].vcol;
-            if (ch == '\t') {
-                ch = ' ';
-            } else if (!iswprint(ch)) {
-                ch = '?';
-            }
-            if (self->editor->color_col == char_col && MLE_BVIEW_IS_EDIT(self)) {
-                bg |= TB_RED;
-            }
+// Draw linenums and margins for bline at rect_y straight into termbox cells.
+// If bline is NULL, draw a '~' filler row including a blank buffer row.
+static void _bview_draw_gutter(bview_t* self, bline_t* bline, int rect_y, int is_cursor_line, bint_t viewport_x, bint_t viewport_x_vcol) {
+    struct tb_cell* row;
+    struct tb_cell* lines;
+    int screen_w;
+    uint16_t fg;
+    uint16_t bg;
+    bint_t rel;
+    int num_w;
+
+    screen_w = tb_width();
+    if (self->rect_lines.y + rect_y >= tb_height() || self->rect_margin_right.x >= screen_w) {
+        return;
+    }
+    row = tb_cell_buffer() + (self->rect_lines.y + rect_y) * screen_w;
+    lines = row + self->rect_lines.x;
+    fg = is_cursor_line ? TB_BOLD : self->rect_lines.fg;
+    bg = self->rect_lines.bg;
+
+    if (!bline) {
+        // Filler
+        _bview_fill_cells(lines, self->linenum_width, ' ', fg, bg);
+        if (self->linenum_width > 0) lines[self->linenum_width - 1].ch = '~';
+        _bview_fill_cells(row + self->rect_margin_left.x, 1, ' ', self->rect_margin_left.fg, self->rect_margin_left.bg);
+        _bview_fill_cells(row + self->rect_buffer.x, self->rect_buffer.w, ' ', self->rect_buffer.fg, self->rect_buffer.bg);
+        _bview_fill_cells(row + self->rect_margin_right.x, 1, ' ', self->rect_margin_right.fg, self->rect_margin_right.bg);
+        return;
+    }
+
+    rel = bline->line_index - self->active_cursor->mark->bline->line_index;
+    if (rel < 0) rel = -rel;
+    if (self->editor->linenum_type == MLE_LINENUM_TYPE_BOTH) {
+        _bview_fill_num(lines, self->abs_linenum_width, bline->line_index + 1, fg, bg);
+        _bview_fill_cells(lines + self->abs_linenum_width, 1, ' ', fg, bg);
+        _bview_fill_num(lines + self->abs_linenum_width + 1, self->rel_linenum_width, rel, fg, bg);
+    } else {
+        if (self->editor->linenum_type == MLE_LINENUM_TYPE_REL && !is_cursor_line) {
+            num_w = self->rel_linenum_width;
+            _bview_fill_num(lines, num_w, rel, fg, bg);
         } else {
-            break;
+            num_w = self->abs_linenum_width;
+            _bview_fill_num(lines, num_w, bline->line_index + 1, fg, bg);
         }
-        if (MLE_BVIEW_IS_MENU(self) && is_cursor_line) {
-            bg |= TB_REVERSE;
+        _bview_fill_cells(lines + num_w, self->linenum_width - num_w, ' ', fg, bg);
+    }
+    _bview_fill_cells(row + self->rect_margin_left.x, 1, viewport_x > 0 && bline->char_count > 0 ? '^' : ' ', self->rect_margin_left.fg, self->rect_margin_left.bg);
+    _bview_fill_cells(row + self->rect_margin_right.x, 1, bline->char_vwidth - viewport_x_vcol > self->rect_buffer.w ? '$' : ' ', self->rect_margin_right.fg, self->rect_margin_right.bg);
+}
+
+// Fill len cells with ch
+static void _bview_fill_cells(struct tb_cell* cells, int len, uint32_t ch, uint16_t fg, uint16_t bg) {
+    int i;
+    for (i = 0; i < len; i++) {
+        cells[i] = (struct tb_cell){ ch, fg, bg };
+    }
+}
+
+// Write num right-aligned in width cells, space padded. Leading digits that do
+// not fit are dropped.
+static void _bview_fill_num(struct tb_cell* cells, int width, bint_t num, uint16_t fg, uint16_t bg) {
+    int i;
+    for (i = width - 1; i >= 0; i--) {
+        cells[i] = (struct tb_cell){ (i == width - 1 || num > 0) ? (uint32_t)('0' + num % 10) : ' ', fg, bg };
+        num /= 10;
+    }
+}
+
+// Return number of decimal digits in num (at least 1)
+static int _bview_count_digits(bint_t num) {
+    int n;
+    for (n = 1; num >= 10; n++) {
+        num /= 10;
+    }
+    return n;
+}
+
+// Return a hash of the highlighted selections shown in self: those of its
+// own cursors, and of active_edit's if it shows the same buffer. Set
+// ret_count to the number of selections and ret_lo_line and ret_hi_line to
+// the lines they span (-1 if none).
+static uint64_t _bview_get_sel_hash(bview_t* self, int* ret_count, bint_t* ret_lo_line, bint_t* ret_hi_line) {
+    bview_t* views[2];
+    bview_t* active_edit;
+    cursor_t* cursor;
+    mark_t* lo;
+    mark_t* hi;
+    uint64_t hash;
+    int i;
+
+    views[0] = self;
+    active_edit = self->editor->active_edit;
+    views[1] = active_edit && active_edit != self && active_edit->buffer == self->buffer ? active_edit : NULL;
+    hash = 14695981039346656037ULL; // FNV-1a
+    *ret_count = 0;
+    *ret_lo_line = -1;
+    *ret_hi_line = -1;
+    for (i = 0; i < 2 && views[i]; i++) {
+        DL_FOREACH(views[i]->cursors, cursor) {
+            if (!cursor->sel_rule || bview_cursor_get_lo_hi(cursor, &lo, &hi) != MLE_OK) continue;
+            hash = (hash ^ (uint64_t)lo->bline->line_index) * 1099511628211ULL;
+            hash = (hash ^ (uint64_t)lo->col) * 1099511628211ULL;
+            hash = (hash ^ (uint64_t)hi->bline->line_index) * 1099511628211ULL;
+            hash = (hash ^ (uint64_t)hi->col) * 1099511628211ULL;
+            if (*ret_lo_line < 0 || lo->bline->line_index < *ret_lo_line) *ret_lo_line = lo->bline->line_index;
+            if (hi->bline->line_index > *ret_hi_line) *ret_hi_line = hi->bline->line_index;
+            *ret_count += 1;
         }
-        for (i = 0; i < char_w && rect_x < self->rect_buffer.w; i++) {
-            tb_change_cell(self->rect_buffer.x + rect_x + i, self->rect_buffer.y + rect_y, ch, fg, bg);
+    }
+    return *ret_count > 0 ? hash : 0;
+}
+
+// Restyle lines whose selection highlight changed since last frame. With one
+// selection before and after, only the lines between the old and new ends
+// change; otherwise restyle everything either selection spans.
+static void _bview_restyle_sel_lines(bview_t* self) {
+    uint64_t hash;
+    int count;
+    bint_t lo_line;
+    bint_t hi_line;
+
+    hash = _bview_get_sel_hash(self, &count, &lo_line, &hi_line);
+    if (hash == self->last_sel_hash) return;
+    if (count == 1 && self->last_sel_count == 1) {
+        _bview_restyle_lines(self, MLE_MIN(lo_line, self->last_sel_lo_line), MLE_MAX(lo_line, self->last_sel_lo_line));
+        _bview_restyle_lines(self, MLE_MIN(hi_line, self->last_sel_hi_line), MLE_MAX(hi_line, self->last_sel_hi_line));
+    } else if (count > 0 && self->last_sel_count > 0) {
+        _bview_restyle_lines(self, MLE_MIN(lo_line, self->last_sel_lo_line), MLE_MAX(hi_line, self->last_sel_hi_line));
+    } else if (count > 0) {
+        _bview_restyle_lines(self, lo_line, hi_line);
+    } else {
+        _bview_restyle_lines(self, self->last_sel_lo_line, self->last_sel_hi_line);
+    }
+    self->last_sel_hash = hash;
+    self->last_sel_count = count;
+    self->last_sel_lo_line = lo_line;
+    self->last_sel_hi_line = hi_line;
+}
+
+// Drop cached renders of lines start_line_index thru end_line_index and
+// damage them
+static void _bview_restyle_lines(bview_t* self, bint_t start_line_index, bint_t end_line_index) {
+    bview_cell_cache_t* entry;
+    bview_cell_cache_t* entry_tmp;
+    bint_t line_index;
+    HASH_ITER(hh, self->cell_cache, entry, entry_tmp) {
+        line_index = entry->bline->line_index;
+        if (line_index >= start_line_index && line_index <= end_line_index) {
+            HASH_DELETE(hh, self->cell_cache, entry);
+            free(entry->cells);
+            free(entry);
         }
-        rect_x += char_w;
     }
+    bview_damage_lines(self, start_line_index, end_line_index);
 }
 
 // Highlight matching bracket pair under mark
 static void _bview_highlight_bracket_pair(bview_t* self, mark_t* mark) {
     bline_t* line;
-    bint_t brkt;
     bint_t col;
     mark_t pair;
     int screen_x;
@@ -896,7 +1406,7 @@ static void _bview_highlight_bracket_pair(bview_t* self, mark_t* mark) {
         // Not a bracket
         return;
     }
-    if (mark_find_bracket_pair(mark, MLE_BRACKET_PAIR_MAX_SEARCH, &line, &col, &brkt) != MLBUF_OK) {
+    if (bracket_index_find_pair(self->editor, mark, &line, &col) != MLE_OK) {
         // No pair found
         return;
     }
@@ -907,6 +1417,7 @@ static void _bview_highlight_bracket_pair(bview_t* self, mark_t* mark) {
         return;
     }
     tb_change_cell(screen_x, screen_y, cell->ch, cell->fg, cell->bg | TB_REVERSE); // TODO configurable
+    _bview_damage_screen_row(self, screen_y);
 }
 
 // Find screen coordinates for a mark
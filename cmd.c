@@ -26,8 +26,8 @@ static int _cmd_save(editor_t* editor, bview_t* bview, int save_as);
 static void _cmd_cut_copy(cursor_t* cursor, int is_cut, int use_srules, int append);
 static void _cmd_toggle_sel_bound(cursor_t* cursor, int use_srules);
 static int _cmd_search_next(bview_t* bview, cursor_t* cursor, mark_t* search_mark, char* regex, int regex_len);
-static void _cmd_aproc_passthru_cb(async_proc_t* self, char* buf, size_t buf_len, int is_error, int is_eof, int is_timeout);
 static void _cmd_fsearch_prompt_cb(bview_t* bview, baction_t* action, void* udata);
+static fsindex_t* _cmd_fsearch_index(editor_t* editor);
 static void _cmd_isearch_prompt_cb(bview_t* bview, baction_t* action, void* udata);
 static int _cmd_browse_cb(cmd_context_t* ctx);
 static int _cmd_grep_cb(cmd_context_t* ctx);
@@ -38,6 +38,9 @@ static int _cmd_select_by_word_back(cursor_t* cursor);
 static int _cmd_select_by_word_forward(cursor_t* cursor);
 static int _cmd_indent(cmd_context_t* ctx, int outdent);
 static int _cmd_indent_line(bline_t* bline, int use_tabs, int outdent);
+static bint_t _cmd_trim_paste(char* data, bint_t data_len);
+static void _cmd_ensure_insertbuf(editor_t* editor, size_t size);
+static int _cmd_cursor_cmp(const void* a, const void* b);
 
 // Insert data
 int cmd_insert_data(cmd_context_t* ctx) {
@@ -50,22 +53,24 @@ int cmd_insert_data(cmd_context_t* ctx) {
 
     // Ensure space in insertbuf
     insert_size = MLE_MAX(6, ctx->bview->buffer->tab_width) * (ctx->pastebuf_len + 1);
-    if (ctx->editor->insertbuf_size < insert_size) {
-        ctx->editor->insertbuf = realloc(ctx->editor->insertbuf, insert_size);
-        ctx->editor->insertbuf_size = insert_size;
-    }
+    _cmd_ensure_insertbuf(ctx->editor, insert_size);
 
     // Fill insertbuf... i=-1: ctx->input, i>=0: ctx->pastebuf
     insertbuf_len = 0;
     insertbuf_cur = ctx->editor->insertbuf;
     for (i = -1; i == -1 || i < ctx->pastebuf_len; i++) {
         input = i == -1 ? &ctx->input : &ctx->pastebuf[i];
-        if (input->ch) {
+        if (input->ch >= 0x80) {
             len = utf8_unicode_to_char(insertbuf_cur, input->ch);
+        } else if (input->ch) {
+            *insertbuf_cur = (char)input->ch;
+            len = 1;
         } else if (input->key == TB_KEY_ENTER || input->key == TB_KEY_CTRL_J || input->key == TB_KEY_CTRL_M) {
-            len = sprintf(insertbuf_cur, "\n");
+            *insertbuf_cur = '\n';
+            len = 1;
         } else if (input->key >= 0x20 && input->key <= 0x7e) {
-            len = sprintf(insertbuf_cur, "%c", input->key);
+            *insertbuf_cur = (char)input->key;
+            len = 1;
         } else if (input->key == 0x09) {
             if (ctx->bview->tab_to_space) {
                 len = ctx->bview->buffer->tab_width - (ctx->cursor->mark->col % ctx->bview->buffer->tab_width);
@@ -86,19 +91,36 @@ int cmd_insert_data(cmd_context_t* ctx) {
     }
     ctx->editor->insertbuf[insertbuf_len] = '\0';
 
-    // Insert
-    if (insertbuf_len > 1 && ctx->editor->trim_paste && strchr(ctx->editor->insertbuf, '\n') != NULL) {
-        // Insert with trim
-        char* trimmed = NULL;
-        int trimmed_len = 0;
-        util_pcre_replace("(?m) +$", ctx->editor->insertbuf, "", &trimmed, &trimmed_len);
-        MLE_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_insert_before, trimmed, trimmed_len);
-        free(trimmed);
-    } else {
-        // Insert without trim
-        MLE_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_insert_before, ctx->editor->insertbuf, insertbuf_len);
+    // Trim trailing spaces if pasting lines
+    if (insertbuf_len > 1 && ctx->editor->trim_paste && memchr(ctx->editor->insertbuf, '\n', insertbuf_len) != NULL) {
+        insertbuf_len = _cmd_trim_paste(ctx->editor->insertbuf, insertbuf_len);
     }
 
+    // Insert
+    MLE_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_insert_before, ctx->editor->insertbuf, insertbuf_len);
+
+    return MLE_OK;
+}
+
+// Insert a bracketed paste. The input layer delivers the whole paste as one
+// input with its text in editor->paste, so it goes in with one insert per
+// cursor. In a prompt, only the first line is used.
+int cmd_insert_paste(cmd_context_t* ctx) {
+    bint_t len;
+    char* newline;
+    len = (bint_t)ctx->editor->paste_len;
+    if (len > 0 && MLE_BVIEW_IS_PROMPT(ctx->bview) && (newline = memchr(ctx->editor->paste, '\n', len)) != NULL) {
+        len = newline - ctx->editor->paste;
+    }
+    if (len < 1) return MLE_OK;
+    _cmd_ensure_insertbuf(ctx->editor, len + 1);
+    memcpy(ctx->editor->insertbuf, ctx->editor->paste, len);
+    if (len > 1 && ctx->editor->trim_paste && memchr(ctx->editor->insertbuf, '\n', len) != NULL) {
+        len = _cmd_trim_paste(ctx->editor->insertbuf, len);
+    }
+    if (len > 0) {
+        MLE_MULTI_CURSOR_MARK_FN(ctx->cursor, mark_insert_before, ctx->editor->insertbuf, len);
+    }
     return MLE_OK;
 }
 
@@ -430,6 +452,7 @@ int cmd_replace(cmd_context_t* ctx) {
                 } else {
                     highlight = srule_new_range(search_mark, search_mark_end, 0, TB_REVERSE);
                     buffer_add_srule(ctx->bview->buffer, highlight);
+                    editor_damage(ctx->editor, ctx->bview->buffer);
                     bview_rectify_viewport(ctx->bview);
                     bview_draw(ctx->bview);
                     editor_prompt(ctx->editor, "replace: OK to replace? (y=yes, n=no, a=all, C-c=stop)",
@@ -437,6 +460,7 @@ int cmd_replace(cmd_context_t* ctx) {
                     );
                     buffer_remove_srule(ctx->bview->buffer, highlight);
                     srule_destroy(highlight);
+                    editor_damage(ctx->editor, ctx->bview->buffer);
                     bview_draw(ctx->bview);
                 }
                 if (!yn) {
@@ -490,6 +514,19 @@ int cmd_redraw(cmd_context_t* ctx) {
         }
     }
     tb_present();
+    editor_damage(ctx->editor, NULL);
+    return MLE_OK;
+}
+
+// Show frame-time and input-latency stats in a menu
+int cmd_show_perf(cmd_context_t* ctx) {
+    bview_t* menu;
+    char* str;
+    size_t str_len;
+    perf_format(ctx->editor, &str, &str_len);
+    editor_menu(ctx->editor, NULL, str, (int)str_len, NULL, &menu);
+    mark_move_beginning(menu->active_cursor->mark);
+    free(str);
     return MLE_OK;
 }
 
@@ -526,6 +563,7 @@ int cmd_isearch(cmd_context_t* ctx) {
         buffer_remove_srule(ctx->bview->buffer, ctx->bview->isearch_rule);
         srule_destroy(ctx->bview->isearch_rule);
         ctx->bview->isearch_rule = NULL;
+        editor_damage(ctx->editor, ctx->bview->buffer);
     }
     return MLE_OK;
 }
@@ -607,15 +645,33 @@ int cmd_split_horizontal(cmd_context_t* ctx) {
     return MLE_OK;
 }
 
-// Fuzzy path search via fzf
+// Fuzzy path search in cwd
 int cmd_fsearch(cmd_context_t* ctx) {
-    async_proc_t* aproc;
+    bview_t* menu;
+    bview_t* orig;
+    fsindex_t* fsindex;
+    char* answer;
     char* path;
     int replace_view;
     replace_view = ctx->static_param && strcmp(ctx->static_param, "replace") == 0 ? 1 : 0;
     if (replace_view && _cmd_pre_close(ctx->editor, ctx->bview) == MLE_ERR) return MLE_OK;
-    aproc = async_proc_new(ctx->bview, 1, 0, _cmd_aproc_passthru_cb, "fzf -f '' 2>/dev/null");
-    editor_prompt_menu(ctx->editor, "fsearch: Fuzzy path?", NULL, 0, _cmd_fsearch_prompt_cb, aproc, &path);
+
+    // Open menu and list every path while the prompt is up. Like
+    // editor_prompt_menu, but results arrive from the index worker.
+    orig = ctx->editor->active;
+    editor_open_bview(ctx->editor, NULL, MLE_BVIEW_TYPE_EDIT, NULL, 0, 1, 0, &ctx->editor->rect_edit, NULL, &menu);
+    menu->is_menu = 1;
+    fsindex = _cmd_fsearch_index(ctx->editor);
+    fsindex_search(fsindex, "", menu);
+    editor_prompt(ctx->editor, "fsearch: Fuzzy path?", &(editor_prompt_params_t) { .kmap = ctx->editor->kmap_prompt_menu, .prompt_cb = _cmd_fsearch_prompt_cb }, &answer);
+    path = NULL;
+    if (answer) {
+        path = strndup(menu->active_cursor->mark->bline->data, menu->active_cursor->mark->bline->data_len);
+        free(answer);
+    }
+    editor_close_bview(ctx->editor, menu, NULL);
+    editor_set_active(ctx->editor, orig);
+
     if (replace_view) {
         bview_open(ctx->bview, path, path ? strlen(path) : 0);
         bview_resize(ctx->bview, ctx->bview->x, ctx->bview->y, ctx->bview->w, ctx->bview->h);
@@ -628,32 +684,30 @@ int cmd_fsearch(cmd_context_t* ctx) {
 
 // Grep for pattern in cwd
 int cmd_grep(cmd_context_t* ctx) {
-    async_proc_t* aproc;
-    char* path;
-    char* path_arg;
-    char* cmd;
-    editor_prompt(ctx->editor, "grep: Pattern?", NULL, &path);
-    if (!path) return MLE_OK;
-    path_arg = util_escape_shell_arg(path, strlen(path));
-    asprintf(&cmd, "grep --color=never -P -i -I -n -r %s . 2>/dev/null", path_arg);
-    aproc = async_proc_new(ctx->bview, 1, 0, _cmd_aproc_passthru_cb, cmd);
-    free(path);
-    free(path_arg);
-    free(cmd);
-    editor_menu(ctx->editor, _cmd_grep_cb, NULL, 0, aproc, NULL);
+    bview_t* menu;
+    grep_t* grep;
+    char* pattern;
+    editor_prompt(ctx->editor, "grep: Pattern?", NULL, &pattern);
+    if (!pattern) return MLE_OK;
+    grep = grep_new(ctx->editor, pattern, ".");
+    free(pattern);
+    if (!grep) return MLE_OK;
+    editor_menu(ctx->editor, _cmd_grep_cb, NULL, 0, NULL, &menu);
+    grep_set_invoker(grep, menu);
     return MLE_OK;
 }
 
-// Browse directory via tree
+// Browse directory
 int cmd_browse(cmd_context_t* ctx) {
     bview_t* menu;
-    async_proc_t* aproc;
-    char* cmd;
-    asprintf(&cmd, "tree --charset C -n -f -L 2 %s 2>/dev/null", ctx->static_param ? ctx->static_param : "");
-    aproc = async_proc_new(ctx->bview, 1, 0, _cmd_aproc_passthru_cb, cmd);
-    free(cmd);
-    editor_menu(ctx->editor, _cmd_browse_cb, "..\n", 3, aproc, &menu);
-    mark_move_beginning(menu->active_cursor->mark);
+    browse_t* browse;
+    char* data;
+    size_t data_len;
+    if (!(browse = browse_new(ctx->editor, ctx->static_param ? ctx->static_param : "."))) return MLE_OK;
+    browse_get_text(browse, &data, &data_len);
+    editor_menu(ctx->editor, _cmd_browse_cb, data, (int)data_len, NULL, &menu);
+    browse_set_invoker(browse, menu);
+    free(data);
     return MLE_OK;
 }
 
@@ -743,9 +797,7 @@ int cmd_apply_macro_by(cmd_context_t* ctx) {
     utf8_unicode_to_char(name, ch);
     HASH_FIND_STR(ctx->editor->macro_map, name, macro);
     if (!macro) MLE_RETURN_ERR(ctx->editor, "Macro not found with name '%s'", name);
-    ctx->editor->macro_apply = macro;
-    ctx->editor->macro_apply_input_index = 0;
-    return MLE_OK;
+    return editor_apply_macro(ctx->editor, macro, MLE_MACRO_REPEAT_COUNT, 1);
 }
 
 
@@ -759,9 +811,40 @@ int cmd_apply_macro(cmd_context_t* ctx) {
     HASH_FIND_STR(ctx->editor->macro_map, name, macro);
     free(name);
     if (!macro) MLE_RETURN_ERR(ctx->editor, "Macro not found%s", "");
-    ctx->editor->macro_apply = macro;
-    ctx->editor->macro_apply_input_index = 0;
-    return MLE_OK;
+    return editor_apply_macro(ctx->editor, macro, MLE_MACRO_REPEAT_COUNT, 1);
+}
+
+// Apply a macro repeatedly: on each line of the selection if there is one,
+// else a number of times or, if no number is given, until end of buffer
+int cmd_apply_macro_repeat(cmd_context_t* ctx) {
+    char* name;
+    char* count_str;
+    kmacro_t* macro;
+    mark_t* lo;
+    mark_t* hi;
+    uintmax_t count;
+    int mode;
+    if (ctx->editor->macro_apply) MLE_RETURN_ERR(ctx->editor, "Cannot nest macros%s", "");
+    editor_prompt(ctx->editor, "apply_macro_repeat: Name?", NULL, &name);
+    if (!name) return MLE_OK;
+    HASH_FIND_STR(ctx->editor->macro_map, name, macro);
+    free(name);
+    if (!macro) MLE_RETURN_ERR(ctx->editor, "Macro not found%s", "");
+    if (ctx->cursor->is_sel_bound_anchored) {
+        // Once per line of selection
+        bview_cursor_get_lo_hi(ctx->cursor, &lo, &hi);
+        count = (uintmax_t)(hi->bline->line_index - lo->bline->line_index + 1);
+        mark_move_to(ctx->cursor->mark, lo->bline->line_index, 0);
+        _cmd_toggle_sel_bound(ctx->cursor, 1);
+        mode = MLE_MACRO_REPEAT_LINES;
+    } else {
+        editor_prompt(ctx->editor, "apply_macro_repeat: Times? (blank=until end of buffer)", NULL, &count_str);
+        if (!count_str) return MLE_OK;
+        count = (uintmax_t)strtoull(count_str, NULL, 10);
+        mode = count > 0 ? MLE_MACRO_REPEAT_COUNT : MLE_MACRO_REPEAT_EOB;
+        free(count_str);
+    }
+    return editor_apply_macro(ctx->editor, macro, mode, count);
 }
 
 // No-op
@@ -833,16 +916,21 @@ int cmd_set_opt(cmd_context_t* ctx) {
         bview_set_syntax(ctx->bview, val);
         buffer_apply_styles(ctx->bview->buffer, ctx->bview->buffer->first_line, ctx->bview->buffer->line_count);
     }
+    editor_damage(ctx->editor, ctx->bview->buffer);
     return MLE_OK;
 }
 
-// Shell
+// Shell. With multiple cursors, cmd runs for each cursor concurrently (see
+// -j) and outputs are applied in document order once all are done.
 int cmd_shell(cmd_context_t* ctx) {
-    char* cmd;
-    char* input;
+    cursor_t* cursor;
+    cursor_t** cursors;
+    shell_job_t* jobs;
+    shell_job_t* job;
+    size_t cursors_len;
+    size_t i;
     bint_t input_len;
-    char* output;
-    size_t output_len;
+    char* cmd;
 
     // Get shell cmd
     if (ctx->static_param) {
@@ -852,37 +940,54 @@ int cmd_shell(cmd_context_t* ctx) {
         if (!cmd) return MLE_OK;
     }
 
-    // Loop for each cursor
-    MLE_MULTI_CURSOR_CODE(ctx->cursor,
-        // Get data to send to stdin
-        if (ctx->cursor->is_sel_bound_anchored) {
-            mark_get_between_mark(cursor->mark, cursor->sel_bound, &input, &input_len);
+    // Collect cursors in document order
+    cursors_len = 0;
+    DL_FOREACH(ctx->bview->cursors, cursor) {
+        if (!cursor->is_asleep) cursors_len += 1;
+    }
+    cursors = malloc(sizeof(cursor_t*) * MLE_MAX(1, cursors_len));
+    i = 0;
+    DL_FOREACH(ctx->bview->cursors, cursor) {
+        if (!cursor->is_asleep) cursors[i++] = cursor;
+    }
+    qsort(cursors, cursors_len, sizeof(cursor_t*), _cmd_cursor_cmp);
+
+    // Get data to send to stdin for each cursor
+    jobs = calloc(MLE_MAX(1, cursors_len), sizeof(shell_job_t));
+    for (i = 0; i < cursors_len; i++) {
+        cursor = cursors[i];
+        job = &jobs[i];
+        if (cursor->is_sel_bound_anchored) {
+            mark_get_between_mark(cursor->mark, cursor->sel_bound, &job->input, &input_len);
             // Add a newline
-            input = realloc(input, input_len + 2);
-            input[input_len] = '\n';
-            input[input_len+1] = '\0';
-            input_len += 1;
-        } else {
-            input = NULL;
-            input_len = 0;
+            job->input = realloc(job->input, input_len + 2);
+            job->input[input_len] = '\n';
+            job->input[input_len+1] = '\0';
+            job->input_len = (size_t)input_len + 1;
         }
+    }
 
-        // Run cmd
-        output = NULL;
-        output_len = 0;
-        if (util_shell_exec(ctx->editor, cmd, 1, input, input_len, NULL, &output, &output_len) == MLE_OK && output_len > 0) {
-            // Write output to buffer
+    // Run cmds, then write outputs to buffer unless cancelled. No timeout from
+    // the editor loop, where C-c cancels; otherwise MLE_SHELL_TIMEOUT_S applies.
+    if (util_shell_exec_multi(ctx->editor, cmd, 0, NULL, jobs, cursors_len, ctx->editor->shell_max_procs) == MLE_OK) {
+        for (i = 0; i < cursors_len; i++) {
+            cursor = cursors[i];
+            job = &jobs[i];
+            if (job->rv != MLE_OK || job->output_len < 1) continue;
             if (cursor->is_sel_bound_anchored) {
                 mark_delete_between_mark(cursor->mark, cursor->sel_bound);
             }
-            mark_insert_before(cursor->mark, output, output_len);
+            mark_insert_before(cursor->mark, job->output, (bint_t)job->output_len);
         }
+    }
 
-        // Free input and output
-        if (input) free(input);
-        if (output) free(output);
-    ); // Loop for next cursor
-
+    // Free inputs and outputs
+    for (i = 0; i < cursors_len; i++) {
+        if (jobs[i].input) free(jobs[i].input);
+        if (jobs[i].output) free(jobs[i].output);
+    }
+    free(jobs);
+    free(cursors);
     free(cmd);
     return MLE_OK;
 }
@@ -969,18 +1074,19 @@ static int _cmd_select_by(cursor_t* cursor, char* strat) {
 
 // Select by bracket
 static int _cmd_select_by_bracket(cursor_t* cursor) {
-    mark_t* orig;
-    orig = mark_clone(cursor->mark);
-    if (mark_move_bracket_top(cursor->mark, MLE_BRACKET_PAIR_MAX_SEARCH) != MLBUF_OK) {
+    mark_t top;
+    bline_t* pair_line;
+    bint_t pair_col;
+    memset(&top, 0, sizeof(mark_t));
+    if (bracket_index_find_top(cursor->bview->editor, cursor->mark, &top.bline, &top.col) != MLE_OK) {
         return MLE_ERR;
     }
-    _cmd_toggle_sel_bound(cursor, 0);
-    if (mark_move_bracket_pair(cursor->sel_bound, MLE_BRACKET_PAIR_MAX_SEARCH) != MLBUF_OK) {
-        _cmd_toggle_sel_bound(cursor, 0);
-        mark_join(cursor->mark, orig);
-        mark_destroy(orig);
+    if (bracket_index_find_pair(cursor->bview->editor, &top, &pair_line, &pair_col) != MLE_OK) {
         return MLE_ERR;
     }
+    mark_move_to(cursor->mark, top.bline->line_index, top.col);
+    _cmd_toggle_sel_bound(cursor, 0);
+    mark_move_to(cursor->sel_bound, pair_line->line_index, pair_col);
     mark_move_by(cursor->mark, 1);
     return MLE_OK;
 }
@@ -1149,6 +1255,7 @@ static void _cmd_toggle_sel_bound(cursor_t* cursor, int use_srules) {
         if (use_srules) {
             cursor->sel_rule = srule_new_range(cursor->mark, cursor->sel_bound, 0, TB_REVERSE);
             buffer_add_srule(cursor->bview->buffer, cursor->sel_rule);
+            editor_damage(cursor->bview->editor, cursor->bview->buffer);
         }
         cursor->is_sel_bound_anchored = 1;
     } else {
@@ -1156,6 +1263,7 @@ static void _cmd_toggle_sel_bound(cursor_t* cursor, int use_srules) {
             buffer_remove_srule(cursor->bview->buffer, cursor->sel_rule);
             srule_destroy(cursor->sel_rule);
             cursor->sel_rule = NULL;
+            editor_damage(cursor->bview->editor, cursor->bview->buffer);
         }
         mark_destroy(cursor->sel_bound);
         cursor->is_sel_bound_anchored = 0;
@@ -1191,27 +1299,6 @@ static int _cmd_search_next(bview_t* bview, cursor_t* cursor, mark_t* search_mar
     return rc;
 }
 
-// Aproc callback that writes buf to bview buffer
-static void _cmd_aproc_passthru_cb(async_proc_t* aproc, char* buf, size_t buf_len, int is_error, int is_eof, int is_timeout) {
-    mark_t* active_mark;
-    mark_t* ins_mark;
-    int is_cursor_at_zero;
-    if (!buf || buf_len < 1) return;
-
-    // Remeber if cursor is at 0
-    active_mark = aproc->invoker->active_cursor->mark;
-    is_cursor_at_zero = active_mark->bline->line_index == 0 && active_mark->col == 0 ? 1 : 0;
-
-    // Append data at end of menu buffer
-    ins_mark = buffer_add_mark(aproc->invoker->buffer, NULL, 0);
-    mark_move_end(ins_mark);
-    mark_insert_before(ins_mark, buf, buf_len);
-    mark_destroy(ins_mark);
-    bview_rectify_viewport(aproc->invoker);
-
-    if (is_cursor_at_zero) mark_move_beginning(active_mark);
-}
-
 // Incremental search prompt callback
 static void _cmd_isearch_prompt_cb(bview_t* bview_prompt, baction_t* action, void* udata) {
     bview_t* bview;
@@ -1219,6 +1306,7 @@ static void _cmd_isearch_prompt_cb(bview_t* bview_prompt, baction_t* action, voi
     int regex_len;
 
     bview = bview_prompt->editor->active_edit;
+    editor_damage(bview->editor, bview->buffer);
 
     if (bview->isearch_rule) {
         buffer_remove_srule(bview->buffer, bview->isearch_rule);
@@ -1244,98 +1332,117 @@ static void _cmd_isearch_prompt_cb(bview_t* bview_prompt, baction_t* action, voi
 
 // Fuzzy path search prompt callback
 static void _cmd_fsearch_prompt_cb(bview_t* bview_prompt, baction_t* action, void* udata) {
-    async_proc_t* aproc;
-    bview_t* menu;
-    char* shell_cmd;
-    char* shell_arg;
-
-    // Get menu and aproc
-    menu = bview_prompt->editor->active_edit;
-    aproc = menu->async_proc;
-    if (aproc && aproc->invoker == menu) {
-        // Mark current aproc is_done
-        aproc->is_done = 1;
+    char* query;
+
+    // Rank paths against prompt text. The menu keeps its lines until the
+    // new results replace them.
+    query = strndup(bview_prompt->buffer->first_line->data, bview_prompt->buffer->first_line->data_len);
+    fsindex_search(_cmd_fsearch_index(bview_prompt->editor), query, bview_prompt->editor->active_edit);
+    free(query);
+}
+
+// Return path index for cwd. The index is kept between searches and
+// refreshed from inotify events.
+static fsindex_t* _cmd_fsearch_index(editor_t* editor) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, PATH_MAX)) strcpy(cwd, ".");
+    if (editor->fsindex && strcmp(editor->fsindex->root, cwd) != 0) {
+        fsindex_destroy(editor->fsindex);
+        editor->fsindex = NULL;
     }
-
-    // Clear menu
-    buffer_set(menu->buffer, "", 0);
-
-    // Make new aproc
-    shell_arg = util_escape_shell_arg(bview_prompt->buffer->first_line->data, bview_prompt->buffer->first_line->data_len);
-    asprintf(&shell_cmd, "fzf -f %s 2>/dev/null", shell_arg);
-    menu->async_proc = async_proc_new(menu, 1, 0, _cmd_aproc_passthru_cb, shell_cmd);
-    free(shell_arg);
-    free(shell_cmd);
+    if (!editor->fsindex) {
+        editor->fsindex = fsindex_new(editor, cwd);
+    }
+    return editor->fsindex;
 }
 
 // Callback from cmd_grep
 static int _cmd_grep_cb(cmd_context_t* ctx) {
+    grep_result_t* result;
+    bview_t* bview;
+    char* path;
     bint_t linenum;
-    char* line;
-    char* colon;
-    line = strndup(ctx->bview->active_cursor->mark->bline->data, ctx->bview->active_cursor->mark->bline->data_len);
-    colon = strchr(line, ':');
-    if (colon == NULL) {
-        free(line);
-        return MLE_OK;
-    }
-    if (colon + 1 != '\0' && strchr(colon + 1, ':') != NULL) {
-        linenum = strtoll(colon + 1, NULL, 10);
-    } else {
-        linenum = 0;
-    }
+    bint_t col;
+    if (!ctx->bview->grep) return MLE_OK;
+    result = grep_get_result(ctx->bview->grep, (size_t)ctx->bview->active_cursor->mark->bline->line_index);
+    if (!result) return MLE_OK;
+    path = strdup(result->path);
+    linenum = result->linenum;
+    col = result->col;
     editor_close_bview(ctx->editor, ctx->bview, NULL);
-    editor_open_bview(ctx->editor, NULL, MLE_BVIEW_TYPE_EDIT, line, (int)(colon - line), 1, linenum, &ctx->editor->rect_edit, NULL, NULL);
-    free(line);
+    editor_open_bview(ctx->editor, NULL, MLE_BVIEW_TYPE_EDIT, path, (int)strlen(path), 1, linenum, &ctx->editor->rect_edit, NULL, &bview);
+    mark_move_col(bview->active_cursor->mark, col);
+    free(path);
     return MLE_OK;
 }
 
 // Callback from cmd_browse
 static int _cmd_browse_cb(cmd_context_t* ctx) {
-    char* line;
-    char* path;
-    char* cwd;
-    char* corrected_path;
+    browse_row_t* row;
     bview_t* new_bview;
-
-    // Get path from tree output
-    line = strndup(ctx->bview->active_cursor->mark->bline->data, ctx->bview->active_cursor->mark->bline->data_len);
-    if ((path = strstr(line, "- ")) != NULL) {
-        path += 2;
-    } else if (strcmp(line, "..") == 0) {
-        path = "..";
-    } else if (util_is_dir(line)) {
-        path = line;
-    } else {
-        MLE_SET_ERR(ctx->editor, "Cannot browse to: '%s'", line);
-        free(line);
-        return MLE_ERR;
+    char* path;
+    if (!ctx->bview->browse) return MLE_OK;
+    row = browse_get_row(ctx->bview->browse, (size_t)ctx->bview->active_cursor->mark->bline->line_index);
+    if (!row) return MLE_OK;
+
+    if (row->depth < 0) {
+        // Go up
+        asprintf(&path, "%s/..", row->path);
+        if (browse_set_root(ctx->bview->browse, path) == MLE_OK) {
+            chdir(ctx->bview->browse->root);
+        }
+        free(path);
+        return MLE_OK;
+    } else if (row->is_dir) {
+        // Expand or collapse in place
+        return browse_toggle(ctx->bview->browse, (size_t)ctx->bview->active_cursor->mark->bline->line_index);
     }
 
-    // Fix cwd if it changed
-    cwd = get_current_dir_name();
-    if (strcmp(cwd, ctx->bview->init_cwd) != 0) {
-        asprintf(&corrected_path, "%s/%s", ctx->bview->init_cwd, path);
-    } else {
-        corrected_path = strdup(path);
-    }
+    // Open file and close menu
+    path = strdup(row->path);
+    editor_open_bview(ctx->editor, NULL, MLE_BVIEW_TYPE_EDIT, path, strlen(path), 0, 0, &ctx->editor->rect_edit, NULL, &new_bview);
+    editor_close_bview(ctx->editor, ctx->bview, NULL);
+    editor_set_active(ctx->editor, new_bview);
+    free(path);
+    return MLE_OK;
+}
 
-    // Open file or browse dir
-    if (util_is_dir(corrected_path)) {
-        chdir(corrected_path);
-        ctx->bview = ctx->editor->active_edit;
-        cmd_browse(ctx);
-    } else {
-        editor_open_bview(ctx->editor, NULL, MLE_BVIEW_TYPE_EDIT, corrected_path, strlen(corrected_path), 0, 0, &ctx->editor->rect_edit, NULL, &new_bview);
+// Remove trailing spaces from every line of data in place. Return new length.
+static bint_t _cmd_trim_paste(char* data, bint_t data_len) {
+    bint_t i;
+    bint_t j;
+    bint_t spaces;
+    j = 0;
+    spaces = 0;
+    for (i = 0; i < data_len; i++) {
+        if (data[i] == ' ') {
+            spaces += 1;
+            continue;
+        } else if (data[i] != '\n' && spaces > 0) {
+            memset(data + j, ' ', spaces);
+            j += spaces;
+        }
+        spaces = 0;
+        data[j++] = data[i];
     }
+    return j;
+}
 
-    // Close menu
-    editor_close_bview(ctx->editor, ctx->bview, NULL);
-
-    // Set new_bview to active
-    editor_set_active(ctx->editor, new_bview);
+// Grow editor->insertbuf to at least size bytes
+static void _cmd_ensure_insertbuf(editor_t* editor, size_t size) {
+    if (editor->insertbuf_size >= size) return;
+    editor->insertbuf_size = MLE_MAX(size, editor->insertbuf_size * 2);
+    editor->insertbuf = realloc(editor->insertbuf, editor->insertbuf_size);
+}
 
-    free(corrected_path);
-    free(line);
-    return MLE_OK;
+// qsort comparator for cursors by position in buffer
+static int _cmd_cursor_cmp(const void* a, const void* b) {
+    mark_t* ma;
+    mark_t* mb;
+    ma = (*(cursor_t**)a)->mark;
+    mb = (*(cursor_t**)b)->mark;
+    if (ma->bline->line_index != mb->bline->line_index) {
+        return ma->bline->line_index < mb->bline->line_index ? -1 : 1;
+    }
+    return ma->col < mb->col ? -1 : (ma->col > mb->col ? 1 : 0);
 }
@@ -157,7 +157,7 @@ static int _cmd_vim_normal_get_input(editor_t* editor, kinput_t* ret_input) {
     cmd_context_t ctx;
     memset(&ctx, 0, sizeof(cmd_context_t));
     editor_get_input(editor, &ctx);
-    editor_display(editor);
+    if (!editor->is_display_disabled) editor_display(editor);
     *ret_input = ctx.input;
     return MLE_OK;
 }
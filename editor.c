@@ -1,13 +1,26 @@
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <ctype.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
 #include <termbox.h>
 #include "uthash.h"
 #include "utlist.h"
 #include "mle.h"
 #include "mlbuf.h"
 
-static kbinding_t* _editor_get_kbinding_node(kbinding_t* parent, kinput_t* input, loop_context_t* loop_ctx, int is_peek, int* ret_again);
+static kbinding_t* _editor_get_kbinding_node(kdispatch_t* dispatch, kinput_t* input, loop_context_t* loop_ctx, int is_peek, int* ret_again);
+static kdispatch_entry_t* _editor_kdispatch_find(kdispatch_t* dispatch, kinput_t* input);
+static kdispatch_entry_t* _editor_kdispatch_slot(kdispatch_t* dispatch, kinput_t* input);
+static void _editor_kdispatch_alloc(kdispatch_t* dispatch, size_t count);
+static size_t _editor_kinput_hash(kinput_t* input);
+static void _editor_compile_kmap(editor_t* editor, kmap_t* kmap);
+static void _editor_compile_kbinding(kbinding_t* node);
+static void _editor_merge_kmap_stack(editor_t* editor, bview_t* bview);
 static int _editor_close_bview_inner(editor_t* editor, bview_t* bview, int* optret_num_closed);
 static int _editor_prompt_input_submit(cmd_context_t* ctx);
 static int _editor_prompt_input_complete(cmd_context_t* ctx);
@@ -25,17 +38,47 @@ static int _editor_prompt_isearch_next(cmd_context_t* ctx);
 static int _editor_prompt_isearch_prev(cmd_context_t* ctx);
 static void _editor_startup(editor_t* editor);
 static void _editor_loop(editor_t* editor, loop_context_t* loop_ctx);
+static void _editor_exec_cmd(editor_t* editor, cmd_context_t* ctx, cmd_funcref_t* cmd_ref);
 static int _editor_maybe_toggle_macro(editor_t* editor, kinput_t* input);
-static void _editor_resize(editor_t* editor, int w, int h);
+static int _editor_macro_apply_next(editor_t* editor);
+static int _editor_run_macro_step(editor_t* editor, cmd_context_t* ctx);
+static void _editor_compile_macro(editor_t* editor, kmacro_t* macro);
 static void _editor_draw_cursors(editor_t* editor, bview_t* bview);
-static void _editor_get_user_input(editor_t* editor, cmd_context_t* ctx);
+static int _editor_should_defer_display(editor_t* editor, cmd_context_t* ctx);
+static void _editor_flush_appends(editor_t* editor);
+static void _editor_present(editor_t* editor);
+static int _editor_is_output_counted(editor_t* editor);
+#ifndef MLE_HEADLESS
+static void _editor_count_display_cells(editor_t* editor);
+static size_t _editor_get_bytes_written();
+#endif
+static int _editor_get_user_input(editor_t* editor, cmd_context_t* ctx);
+static int _editor_wait_for_input(editor_t* editor, cmd_context_t* ctx);
+static int _editor_init_epoll(editor_t* editor);
+static int _editor_next_timer_ms(editor_t* editor);
+static int _editor_run_timers(editor_t* editor);
+static void _editor_async_frame_cb(editor_t* editor, void* udata);
+static void _editor_resize_cb(editor_t* editor, void* udata);
+static int _editor_layout(editor_t* editor, int w, int h, int is_forced);
+static int _editor_reap_async_procs(editor_t* editor);
 static void _editor_record_macro_input(kmacro_t* macro, kinput_t* input);
-static cmd_funcref_t* _editor_get_command(editor_t* editor, cmd_context_t* ctx, kinput_t* opt_peek_input);
+static void _editor_record_macro_paste(kmacro_t* macro, char* data, size_t data_len);
+static void _editor_record_input(editor_t* editor, kmacro_t* macro, kinput_t* input);
+static void _editor_load_macro_paste(editor_t* editor, kmacro_t* macro, kinput_t* input);
+static void _editor_destroy_macro(kmacro_t* macro);
+static void _editor_event_to_input(editor_t* editor, tb_event_t* ev, kinput_t* ret_input);
+static int _editor_match_paste_start(editor_t* editor);
+static void _editor_read_paste(editor_t* editor);
+static int _editor_paste_event_to_bytes(tb_event_t* ev, char* out);
+static void _editor_append_paste(editor_t* editor, char* data, size_t data_len);
+static cmd_funcref_t* _editor_get_paste_command(editor_t* editor, cmd_context_t* ctx, int is_peek);
 static void _editor_ingest_paste(editor_t* editor, cmd_context_t* ctx);
 static cmd_func_t _editor_resolve_funcref(editor_t* editor, cmd_funcref_t* ref);
 static int _editor_key_to_input(char* key, kinput_t* ret_input);
 static void _editor_init_signal_handlers(editor_t* editor);
 static void _editor_graceful_exit(int signum);
+static void _editor_set_paste_mode(editor_t* editor, int is_on);
+static int _editor_open_tty(editor_t* editor);
 static void _editor_init_kmaps(editor_t* editor);
 static void _editor_init_kmap(editor_t* editor, kmap_t** ret_kmap, char* name, cmd_funcref_t default_funcref, int allow_fallthru, kbinding_def_t* defs);
 static void _editor_init_kmap_add_binding(editor_t* editor, kmap_t* kmap, char* cmd_name, char* key, char* static_param);
@@ -55,7 +98,8 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv);
 static void _editor_init_status(editor_t* editor);
 static void _editor_init_bviews(editor_t* editor, int argc, char** argv);
 static int _editor_init_or_deinit_commands(editor_t* editor, int is_deinit);
-static int _editor_drain_async_procs(editor_t* editor);
+static int _editor_init_script(editor_t* editor, char* path, kmacro_t** ret_macro);
+static int _editor_run_script_file(editor_t* editor, kmacro_t* script, char* path);
 
 // Init editor from args
 int editor_init(editor_t* editor, int argc, char** argv) {
@@ -73,7 +117,11 @@ int editor_init(editor_t* editor, int argc, char** argv) {
         editor->viewport_scope_y = -4;
         editor->startup_linenum = -1;
         editor->color_col = -1;
+        editor->max_frame_latency = MLE_DEFAULT_MAX_FRAME_LATENCY;
         editor->exit_code = EXIT_SUCCESS;
+        editor->is_damaged = 1;
+        editor->epollfd = -1;
+        editor->ttyfd = -1;
         editor_set_macro_toggle_key(editor, MLE_DEFAULT_MACRO_TOGGLE_KEY);
 
         // Init signal handlers
@@ -109,11 +157,31 @@ int editor_init(editor_t* editor, int argc, char** argv) {
         // Init status bar
         _editor_init_status(editor);
 
-        // Init bviews
-        _editor_init_bviews(editor, argc, argv);
+        // Init bviews (scripts open their own files)
+        if (!editor->script_path) {
+            _editor_init_bviews(editor, argc, argv);
+        }
 
         // Init commands
         _editor_init_or_deinit_commands(editor, 0);
+
+        // Run script and exit if requested
+        if (editor->script_path) {
+            if (editor_run_script(editor, argc, argv) != MLE_OK) {
+                editor->exit_code = EXIT_FAILURE;
+            }
+            rv = MLE_ERR;
+            break;
+        }
+
+        // Run benchmark and exit if requested
+        if (editor->bench_name) {
+            if (bench_run(editor, editor->bench_name) != MLE_OK) {
+                editor->exit_code = EXIT_FAILURE;
+            }
+            rv = MLE_ERR;
+            break;
+        }
     } while(0);
 
     editor->is_in_init = 0;
@@ -124,12 +192,68 @@ int editor_init(editor_t* editor, int argc, char** argv) {
 int editor_run(editor_t* editor) {
     loop_context_t loop_ctx;
     memset(&loop_ctx, 0, sizeof(loop_context_t));
-    _editor_resize(editor, -1, -1);
+    editor_resize(editor, -1, -1);
+    _editor_set_paste_mode(editor, 1);
     _editor_startup(editor);
     _editor_loop(editor, &loop_ctx);
+    _editor_set_paste_mode(editor, 0);
     return MLE_OK;
 }
 
+// Run script on each file in argv and save modified buffers. Files are
+// processed in parallel, one worker process per file, up to one per CPU.
+// Return MLE_ERR if any file failed.
+int editor_run_script(editor_t* editor, int argc, char** argv) {
+    kmacro_t* script;
+    pid_t pid;
+    int status;
+    int njobs;
+    int nrunning;
+    int rv;
+    int i;
+
+    if (_editor_init_script(editor, editor->script_path, &script) != MLE_OK) {
+        return MLE_ERR;
+    }
+    rv = MLE_OK;
+    if (optind >= argc) {
+        MLE_LOG_ERR("No files to run script on: %s\n", editor->script_path);
+        rv = MLE_ERR;
+    } else if (argc - optind == 1) {
+        // Single file; no need for a worker
+        rv = _editor_run_script_file(editor, script, argv[optind]);
+    } else {
+        // Keep njobs workers busy until all files are done
+        njobs = MLE_MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+        nrunning = 0;
+        i = optind;
+        while (i < argc || nrunning > 0) {
+            if (i < argc && nrunning < njobs) {
+                fflush(NULL);
+                if ((pid = fork()) == 0) {
+                    exit(_editor_run_script_file(editor, script, argv[i]) == MLE_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+                } else if (pid < 0) {
+                    MLE_LOG_ERR("Failed to fork worker for %s\n", argv[i]);
+                    rv = MLE_ERR;
+                    argc = i; // Wait for running workers, start no more
+                    continue;
+                }
+                nrunning += 1;
+                i += 1;
+            } else if (wait(&status) >= 0) {
+                nrunning -= 1;
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+                    rv = MLE_ERR;
+                }
+            } else if (errno != EINTR) {
+                break;
+            }
+        }
+    }
+    _editor_destroy_macro(script);
+    return rv;
+}
+
 // Deinit editor
 int editor_deinit(editor_t* editor) {
     bview_t* bview;
@@ -141,6 +265,8 @@ int editor_deinit(editor_t* editor) {
     kmacro_t* macro_tmp;
     cmd_funcref_t* funcref;
     cmd_funcref_t* funcref_tmp;
+    if (editor->perf_path) perf_dump(editor, editor->perf_path);
+    trace_destroy(editor);
     _editor_init_or_deinit_commands(editor, 1);
     if (editor->status) bview_destroy(editor->status);
     CDL_FOREACH_SAFE2(editor->all_bviews, bview, bview_tmp1, bview_tmp2, all_prev, all_next) {
@@ -150,29 +276,33 @@ int editor_deinit(editor_t* editor) {
     HASH_ITER(hh, editor->kmap_map, kmap, kmap_tmp) {
         HASH_DEL(editor->kmap_map, kmap);
         _editor_destroy_kmap(kmap, kmap->bindings->children);
+        if (kmap->bindings->dispatch.entries) free(kmap->bindings->dispatch.entries);
         free(kmap->bindings);
         free(kmap->name);
         free(kmap);
     }
     HASH_ITER(hh, editor->macro_map, macro, macro_tmp) {
         HASH_DEL(editor->macro_map, macro);
-        if (macro->inputs) free(macro->inputs);
-        if (macro->name) free(macro->name);
-        free(macro);
+        _editor_destroy_macro(macro);
     }
     HASH_ITER(hh, editor->func_map, funcref, funcref_tmp) {
         HASH_DEL(editor->func_map, funcref);
         if (funcref->name) free(funcref->name);
         free(funcref);
     }
-    if (editor->macro_record) {
-        if (editor->macro_record->inputs) free(editor->macro_record->inputs);
-        free(editor->macro_record);
-    }
+    if (editor->macro_record) _editor_destroy_macro(editor->macro_record);
     _editor_destroy_syntax_map(editor->syntax_map);
     if (editor->kmap_init_name) free(editor->kmap_init_name);
     if (editor->insertbuf) free(editor->insertbuf);
-    if (editor->tty) fclose(editor->tty);
+    if (editor->paste) free(editor->paste);
+    if (editor->display_shadow) free(editor->display_shadow);
+    if (editor->async_readbuf) free(editor->async_readbuf);
+    if (editor->fsindex) fsindex_destroy(editor->fsindex);
+    browse_clear_cache(editor);
+    proc_destroy_all(editor);
+    while (editor->timers) editor_remove_timer(editor, editor->timers);
+    if (editor->ttyfd >= 0) close(editor->ttyfd);
+    if (editor->epollfd >= 0) close(editor->epollfd);
     return MLE_OK;
 }
 
@@ -234,6 +364,7 @@ int editor_menu(editor_t* editor, cmd_func_t callback, char* opt_buf_data, int o
     bview_push_kmap(menu, editor->kmap_menu);
     if (opt_buf_data) {
         mark_insert_before(menu->active_cursor->mark, opt_buf_data, opt_buf_data_len);
+        mark_move_beginning(menu->active_cursor->mark);
     }
     if (opt_aproc) {
         async_proc_set_invoker(opt_aproc, menu);
@@ -276,6 +407,10 @@ int editor_open_bview(editor_t* editor, bview_t* parent, int type, char* opt_pat
     bview = bview_new(editor, opt_path, opt_path_len, opt_buffer);
     bview->type = type;
     CDL_PREPEND2(editor->all_bviews, bview, all_prev, all_next);
+    if (MLE_BVIEW_IS_EDIT(bview)) {
+        editor->edit_bview_count += 1;
+        editor->is_edit_bview_num_dirty = 1;
+    }
     if (!parent) {
         DL_APPEND2(editor->top_bviews, bview, top_prev, top_next);
     } else {
@@ -314,13 +449,14 @@ int editor_close_bview(editor_t* editor, bview_t* bview, int* optret_num_closed)
     int rc;
     if (optret_num_closed) *optret_num_closed = 0;
     if ((rc = _editor_close_bview_inner(editor, bview, optret_num_closed)) == MLE_OK) {
-        _editor_resize(editor, editor->w, editor->h);
+        editor_resize(editor, editor->w, editor->h);
     }
     return rc;
 }
 
 // Set the active bview
 int editor_set_active(editor_t* editor, bview_t* bview) {
+    bview_t* root;
     if (!editor_bview_exists(editor, bview)) {
         MLE_RETURN_ERR(editor, "No bview %p in editor->all_bviews", bview);
     } else if (editor->prompt) {
@@ -329,7 +465,12 @@ int editor_set_active(editor_t* editor, bview_t* bview) {
     editor->active = bview;
     if (MLE_BVIEW_IS_EDIT(bview)) {
         editor->active_edit = bview;
-        editor->active_edit_root = bview_get_split_root(bview);
+        root = bview_get_split_root(bview);
+        if (root != editor->active_edit_root) {
+            // Different split tree on screen; repaint everything
+            editor_damage(editor, NULL);
+        }
+        editor->active_edit_root = root;
     }
     bview_rectify_viewport(bview);
     return MLE_OK;
@@ -390,25 +531,57 @@ int editor_register_cmd(editor_t* editor, char* name, cmd_func_t opt_func, cmd_f
 // Get input from either macro or user
 int editor_get_input(editor_t* editor, cmd_context_t* ctx) {
     ctx->is_user_input = 0;
-    if (editor->macro_apply
-        && editor->macro_apply_input_index < editor->macro_apply->inputs_len
-    ) {
+    if (editor->macro_apply && _editor_macro_apply_next(editor)) {
         // Get input from macro
         ctx->input = editor->macro_apply->inputs[editor->macro_apply_input_index];
         editor->macro_apply_input_index += 1;
+        _editor_load_macro_paste(editor, editor->macro_apply, &ctx->input);
+    } else if (editor->script_path) {
+        // Script is done and there is no user to ask
+        return MLE_ERR;
     } else {
-        // Clear macro
-        if (editor->macro_apply) {
-            editor->macro_apply = NULL;
-            editor->macro_apply_input_index = 0;
-        }
         // Get user input
-        _editor_get_user_input(editor, ctx);
+        if (_editor_get_user_input(editor, ctx) != MLE_OK) {
+            return MLE_ERR;
+        }
         ctx->is_user_input = 1;
     }
     if (editor->is_recording_macro && editor->macro_record) {
         // Record macro input
-        _editor_record_macro_input(editor->macro_record, &ctx->input);
+        _editor_record_input(editor, editor->macro_record, &ctx->input);
+    }
+    return MLE_OK;
+}
+
+// Apply macro. In mode MLE_MACRO_REPEAT_COUNT, apply it count times. In mode
+// MLE_MACRO_REPEAT_EOB, repeat until the cursor stops moving down or reaches
+// the last line. In mode MLE_MACRO_REPEAT_LINES, apply it at the start of
+// each of count lines from the cursor down, following those lines as the
+// macro inserts or deletes lines. Display is suspended until done when
+// repeating; a single application displays as it goes.
+int editor_apply_macro(editor_t* editor, kmacro_t* macro, int mode, uintmax_t count) {
+    mark_t* mark;
+    if (editor->macro_apply) MLE_RETURN_ERR(editor, "Cannot nest macros%s", "");
+    if (macro->inputs_len < 1 || (mode != MLE_MACRO_REPEAT_EOB && count < 1)) {
+        return MLE_OK;
+    }
+    mark = editor->active->active_cursor->mark;
+    if (mode == MLE_MACRO_REPEAT_LINES) mark_move_bol(mark);
+    _editor_compile_macro(editor, macro);
+    editor->macro_apply = macro;
+    editor->macro_apply_input_index = 0;
+    editor->macro_apply_step = 0;
+    editor->macro_apply_mode = mode;
+    editor->macro_apply_count = mode == MLE_MACRO_REPEAT_EOB ? 0 : count - 1;
+    editor->macro_apply_line = mark->bline->line_index;
+    editor->macro_apply_next_line = NULL;
+    if (mode == MLE_MACRO_REPEAT_LINES && count > 1 && mark->bline->next) {
+        editor->macro_apply_next_line = buffer_add_mark(mark->bline->buffer, mark->bline->next, 0);
+    }
+    editor->macro_apply_is_batched = mode != MLE_MACRO_REPEAT_COUNT || count > 1 ? 1 : 0;
+    if (editor->macro_apply_is_batched) {
+        editor->macro_apply_was_display_disabled = editor->is_display_disabled;
+        editor->is_display_disabled = 1;
     }
     return MLE_OK;
 }
@@ -416,17 +589,217 @@ int editor_get_input(editor_t* editor, cmd_context_t* ctx) {
 // Display the editor
 int editor_display(editor_t* editor) {
     bview_t* bview;
-    tb_clear();
+    uint64_t start_us;
+    uint64_t present_us;
+    start_us = perf_now_us();
+    _editor_flush_appends(editor);
+    if (editor->is_damaged) {
+        // Full repaint
+        tb_clear();
+        CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+            bview_damage(bview);
+        }
+        bview_damage(editor->status);
+        editor->is_damaged = 0;
+    }
     bview_draw(editor->active_edit_root);
     bview_draw(editor->status);
-    if (editor->prompt) bview_draw(editor->prompt);
+    if (editor->prompt) {
+        bview_draw(editor->prompt);
+    } else {
+        tb_printf(editor->rect_prompt, 0, 0, 0, 0, "%*c", editor->rect_prompt.w, ' ');
+    }
     DL_FOREACH2(editor->top_bviews, bview, top_next) {
         _editor_draw_cursors(editor, bview);
     }
-    tb_present();
+    present_us = perf_now_us();
+    _editor_present(editor);
+    perf_record(editor, MLE_PERF_PRESENT, present_us);
+    if (editor->trace.is_replay) trace_presented(editor, perf_now_us());
+    perf_record(editor, MLE_PERF_DISPLAY, start_us);
+    if (editor->perf_input_us) {
+        // Time from first unhandled input until it was on screen
+        perf_record(editor, MLE_PERF_INPUT, editor->perf_input_us);
+        editor->perf_input_us = 0;
+    }
+    gettimeofday(&editor->last_display_time, NULL);
+    return MLE_OK;
+}
+
+// Mark bviews for repaint on next display. If opt_buffer is set, only bviews
+// displaying that buffer are damaged, otherwise the whole screen is.
+int editor_damage(editor_t* editor, buffer_t* opt_buffer) {
+    bview_t* bview;
+    if (!opt_buffer) {
+        editor->is_damaged = 1;
+        return MLE_OK;
+    }
+    CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+        if (bview->buffer == opt_buffer) bview_damage(bview);
+    }
     return MLE_OK;
 }
 
+// Resize the editor. If w or h is negative, use the terminal size.
+int editor_resize(editor_t* editor, int w, int h) {
+    return _editor_layout(editor, w, h, 1);
+}
+
+// Resize to w x h once terminal resizes stop arriving for
+// MLE_RESIZE_DEBOUNCE_MS. Dragging a pane border sends a storm of these; only
+// the last size gets laid out and drawn.
+int editor_queue_resize(editor_t* editor, int w, int h) {
+    editor->resize_w = w;
+    editor->resize_h = h;
+    if (editor->epollfd < 0) {
+        // No event loop to fire the timer; resize now
+        _editor_resize_cb(editor, NULL);
+        return MLE_OK;
+    }
+    if (editor->resize_timer) editor_remove_timer(editor, editor->resize_timer);
+    editor_add_timer(editor, MLE_RESIZE_DEBOUNCE_MS, _editor_resize_cb, NULL, &editor->resize_timer);
+    return MLE_OK;
+}
+
+// Call callback from the editor loop after delay_ms
+int editor_add_timer(editor_t* editor, long delay_ms, editor_timer_cb_t callback, void* udata, editor_timer_t** optret_timer) {
+    editor_timer_t* timer;
+    editor_timer_t* next;
+    timer = calloc(1, sizeof(editor_timer_t));
+    timer->when_us = perf_now_us() + (uint64_t)MLE_MAX(0, delay_ms) * 1000;
+    timer->callback = callback;
+    timer->udata = udata;
+
+    // Keep timers sorted by deadline
+    DL_FOREACH(editor->timers, next) {
+        if (next->when_us > timer->when_us) break;
+    }
+    if (next) {
+        DL_PREPEND_ELEM(editor->timers, next, timer);
+    } else {
+        DL_APPEND(editor->timers, timer);
+    }
+    if (optret_timer) *optret_timer = timer;
+    return MLE_OK;
+}
+
+// Cancel a pending timer
+int editor_remove_timer(editor_t* editor, editor_timer_t* timer) {
+    DL_DELETE(editor->timers, timer);
+    free(timer);
+    return MLE_OK;
+}
+
+// Wake the editor loop when fd is readable. If opt_aproc is set, its callback
+// is fed whatever is read from fd.
+int editor_watch_fd(editor_t* editor, int fd, async_proc_t* opt_aproc) {
+    struct epoll_event event;
+    if (_editor_init_epoll(editor) != MLE_OK) return MLE_ERR;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = EPOLLIN;
+    event.data.ptr = opt_aproc;
+    if (epoll_ctl(editor->epollfd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        return MLE_ERR;
+    }
+    return MLE_OK;
+}
+
+// Stop watching fd
+int editor_unwatch_fd(editor_t* editor, int fd) {
+    if (editor->epollfd < 0) return MLE_ERR;
+    if (epoll_ctl(editor->epollfd, EPOLL_CTL_DEL, fd, NULL) != 0) {
+        return MLE_ERR;
+    }
+    return MLE_OK;
+}
+
+// Get next input event, first from events put back by editor_push_event or
+// _editor_match_paste_start, then from editor_read_event
+int editor_peek_event(editor_t* editor, tb_event_t* ev, int timeout_ms) {
+    if (editor->event_pushback_len > 0) {
+        *ev = editor->event_pushback[0];
+        editor->event_pushback_len -= 1;
+        memmove(editor->event_pushback, editor->event_pushback + 1, sizeof(tb_event_t) * editor->event_pushback_len);
+        return ev->type;
+    }
+    return editor_read_event(editor, ev, timeout_ms);
+}
+
+// Get next input event from termbox, or from the trace being replayed. Wait
+// up to timeout_ms, or forever if negative. Events from termbox are recorded
+// if recording a trace.
+int editor_read_event(editor_t* editor, tb_event_t* ev, int timeout_ms) {
+    int rc;
+    if (editor->trace.is_replay) {
+        return trace_replay_next(editor, ev, timeout_ms);
+    }
+    rc = timeout_ms < 0 ? tb_poll_event(ev) : tb_peek_event(ev, timeout_ms);
+    if (rc > 0) trace_record(editor, ev);
+    return rc;
+}
+
+// Return command for input
+cmd_funcref_t* editor_get_command(editor_t* editor, cmd_context_t* ctx, kinput_t* opt_peek_input) {
+    loop_context_t* loop_ctx;
+    kinput_t* input;
+    kdispatch_t* dispatch;
+    kbinding_t* binding;
+    bview_t* bview;
+    int is_top;
+    int is_peek;
+    int again;
+
+    // Init some vars
+    loop_ctx = ctx->loop_ctx;
+    is_peek = opt_peek_input ? 1 : 0;
+    input = opt_peek_input ? opt_peek_input : &ctx->input;
+    bview = editor->active;
+    is_top = (loop_ctx->binding_node == NULL ? 1 : 0);
+    if (MLE_KINPUT_IS_PASTE(input)) {
+        return _editor_get_paste_command(editor, ctx, is_peek);
+    }
+    if (is_top) {
+        // Start on the merged kmap stack of the active bview
+        if (bview->kmap_dispatch_gen != editor->kmap_gen) {
+            _editor_merge_kmap_stack(editor, bview);
+        }
+        dispatch = &bview->kmap_dispatch;
+    } else {
+        // Continue on node from previous input
+        dispatch = &loop_ctx->binding_node->dispatch;
+    }
+    loop_ctx->need_more_input = 0;
+    loop_ctx->binding_node = NULL;
+
+    // Look for key binding
+    again = 0;
+    binding = _editor_get_kbinding_node(dispatch, input, loop_ctx, is_peek, &again);
+    if (binding) {
+        if (again || (!binding->funcref && binding->children)) {
+            // Need more input on this node
+            if (!is_peek) {
+                loop_ctx->need_more_input = 1;
+                loop_ctx->binding_node = binding;
+            }
+            return NULL;
+        } else if (binding->funcref) {
+            // Found leaf!
+            if (!is_peek) {
+                ctx->static_param = binding->static_param;
+            }
+            return binding->funcref;
+        }
+        // This shouldn't happen... TODO err
+        return NULL;
+    } else if (is_top) {
+        // Binding not found at top level, fallback to default if any
+        return dispatch->default_funcref;
+    }
+
+    // Binding not found
+    return NULL;
+}
+
 // Close a bview
 static int _editor_close_bview_inner(editor_t* editor, bview_t* bview, int *optret_num_closed) {
     if (!editor_bview_exists(editor, bview)) {
@@ -451,6 +824,10 @@ static int _editor_close_bview_inner(editor_t* editor, bview_t* bview, int *optr
         DL_DELETE2(editor->top_bviews, bview, top_prev, top_next);
     }
     CDL_DELETE2(editor->all_bviews, bview, all_prev, all_next);
+    if (MLE_BVIEW_IS_EDIT(bview)) {
+        editor->edit_bview_count -= 1;
+        editor->is_edit_bview_num_dirty = 1;
+    }
     bview_destroy(bview);
     if (optret_num_closed) *optret_num_closed += 1;
     return MLE_OK;
@@ -580,6 +957,8 @@ static int _editor_menu_submit(cmd_context_t* ctx) {
 // Invoked when user hits C-c in a menu
 static int _editor_menu_cancel(cmd_context_t* ctx) {
     if (ctx->bview->async_proc) async_proc_destroy(ctx->bview->async_proc);
+    if (ctx->bview->grep) grep_destroy(ctx->bview->grep);
+    if (ctx->bview->browse) browse_destroy(ctx->bview->browse);
     return MLE_OK;
 }
 
@@ -667,10 +1046,11 @@ static void _editor_startup(editor_t* editor) {
 static void _editor_loop(editor_t* editor, loop_context_t* loop_ctx) {
     cmd_funcref_t* cmd_ref;
     cmd_context_t cmd_ctx;
-    cmd_func_t cmd_fn;
+    uint64_t perf_us;
 
     // Increment loop_depth
     editor->loop_depth += 1;
+    editor->perf_loop_seq += 1;
 
     // Init cmd_context
     memset(&cmd_ctx, 0, sizeof(cmd_context_t));
@@ -682,40 +1062,35 @@ static void _editor_loop(editor_t* editor, loop_context_t* loop_ctx) {
         // Set loop_ctx
         editor->loop_ctx = loop_ctx;
 
-        // Display editor
-        if (!editor->is_display_disabled) {
-            editor_display(editor);
+        // Run compiled macro step if applying a macro
+        if (editor->macro_apply && _editor_run_macro_step(editor, &cmd_ctx)) {
+            continue;
         }
 
-        // Check for async input
-        if (editor->async_procs && _editor_drain_async_procs(editor)) {
-            continue;
+        // Display editor unless more input is already queued
+        if (!editor->is_display_disabled && !_editor_should_defer_display(editor, &cmd_ctx)) {
+            editor_display(editor);
         }
 
         // Get input
-        editor_get_input(editor, &cmd_ctx);
+        if (editor_get_input(editor, &cmd_ctx) != MLE_OK) {
+            loop_ctx->should_exit = 1;
+            break;
+        }
+        if (!editor->perf_input_us) editor->perf_input_us = perf_now_us();
 
         // Toggle macro?
         if (_editor_maybe_toggle_macro(editor, &cmd_ctx.input)) {
             continue;
         }
 
-        if ((cmd_ref = _editor_get_command(editor, &cmd_ctx, NULL)) != NULL) {
-            // Found command in kmap trie, now resolve
-            if ((cmd_fn = _editor_resolve_funcref(editor, cmd_ref)) != NULL) {
-                // Resolved, now execute
-                if (cmd_ctx.is_user_input && cmd_fn == cmd_insert_data) {
-                    _editor_ingest_paste(editor, &cmd_ctx);
-                }
-                cmd_ctx.cursor = editor->active ? editor->active->active_cursor : NULL;
-                cmd_ctx.bview = cmd_ctx.cursor ? cmd_ctx.cursor->bview : NULL;
-                cmd_ctx.udata = &cmd_ref->udata;
-                cmd_fn(&cmd_ctx);
-                loop_ctx->binding_node = NULL;
-                loop_ctx->wildcard_params_len = 0;
-                loop_ctx->numeric_params_len = 0;
-                loop_ctx->last_cmd = cmd_ref;
-            }
+        perf_us = perf_now_us();
+        cmd_ref = editor_get_command(editor, &cmd_ctx, NULL);
+        perf_record(editor, MLE_PERF_GET_COMMAND, perf_us);
+
+        if (cmd_ref) {
+            // Found command in kmap trie, now resolve and execute
+            _editor_exec_cmd(editor, &cmd_ctx, cmd_ref);
         } else if (loop_ctx->need_more_input) {
             // Need more input to find
         } else {
@@ -731,6 +1106,36 @@ static void _editor_loop(editor_t* editor, loop_context_t* loop_ctx) {
     editor->loop_depth -= 1;
 }
 
+// Resolve and execute cmd_ref, then reset loop_ctx for the next command
+static void _editor_exec_cmd(editor_t* editor, cmd_context_t* ctx, cmd_funcref_t* cmd_ref) {
+    loop_context_t* loop_ctx;
+    cmd_func_t cmd_fn;
+    uint64_t perf_us;
+    int perf_loop_seq;
+
+    loop_ctx = ctx->loop_ctx;
+    if ((cmd_fn = _editor_resolve_funcref(editor, cmd_ref)) == NULL) {
+        return;
+    }
+    if (ctx->is_user_input && cmd_fn == cmd_insert_data) {
+        _editor_ingest_paste(editor, ctx);
+    }
+    ctx->cursor = editor->active ? editor->active->active_cursor : NULL;
+    ctx->bview = ctx->cursor ? ctx->cursor->bview : NULL;
+    ctx->udata = &cmd_ref->udata;
+    perf_us = perf_now_us();
+    perf_loop_seq = editor->perf_loop_seq;
+    cmd_fn(ctx);
+    if (perf_loop_seq == editor->perf_loop_seq) {
+        // Skip commands that waited on a nested loop (prompts)
+        perf_record(editor, MLE_PERF_CMD, perf_us);
+    }
+    loop_ctx->binding_node = NULL;
+    loop_ctx->wildcard_params_len = 0;
+    loop_ctx->numeric_params_len = 0;
+    loop_ctx->last_cmd = cmd_ref;
+}
+
 // If input == editor->macro_toggle_key, toggle macro mode and return 1. Else
 // return 0.
 static int _editor_maybe_toggle_macro(editor_t* editor, kinput_t* input) {
@@ -758,13 +1163,491 @@ static int _editor_maybe_toggle_macro(editor_t* editor, kinput_t* input) {
     return 1;
 }
 
-// Resize the editor
-static void _editor_resize(editor_t* editor, int w, int h) {
+// Start the next repetition of macro_apply once its inputs are used up.
+// Return 1 if there is macro input left, else finish macro_apply, restoring
+// display, and return 0.
+static int _editor_macro_apply_next(editor_t* editor) {
+    mark_t* mark;
+    mark_t* next;
+    int again;
+    if (editor->macro_apply_input_index < editor->macro_apply->inputs_len) {
+        return 1;
+    }
+    mark = editor->active->active_cursor->mark;
+    if (editor->macro_apply_mode == MLE_MACRO_REPEAT_EOB) {
+        again = mark->bline->line_index > editor->macro_apply_line && mark->bline->next ? 1 : 0;
+    } else if (editor->macro_apply_mode == MLE_MACRO_REPEAT_LINES) {
+        // The next line is tracked by a mark, so it stays put relative to
+        // the text when the macro adds or removes lines
+        next = editor->macro_apply_next_line;
+        again = editor->macro_apply_count > 0 && next && next->bline->buffer == mark->bline->buffer ? 1 : 0;
+        if (again) {
+            mark_move_to(mark, next->bline->line_index, 0);
+            if (editor->macro_apply_count > 1 && mark->bline->next) {
+                mark_move_to(next, mark->bline->line_index + 1, 0);
+            } else {
+                mark_destroy(next);
+                editor->macro_apply_next_line = NULL;
+            }
+        }
+    } else {
+        again = editor->macro_apply_count > 0 ? 1 : 0;
+    }
+    if (again) {
+        if (editor->macro_apply_count > 0) editor->macro_apply_count -= 1;
+        editor->macro_apply_input_index = 0;
+        editor->macro_apply_step = 0;
+        editor->macro_apply_line = mark->bline->line_index;
+        return 1;
+    }
+    if (editor->macro_apply_next_line) {
+        mark_destroy(editor->macro_apply_next_line);
+        editor->macro_apply_next_line = NULL;
+    }
+    editor->macro_apply = NULL;
+    editor->macro_apply_input_index = 0;
+    if (editor->macro_apply_is_batched) {
+        editor->is_display_disabled = editor->macro_apply_was_display_disabled;
+        if (!editor->is_display_disabled) {
+            // Redraw once now that macro is done
+            editor_display(editor);
+        }
+    }
+    return 0;
+}
+
+// Run the compiled step of macro_apply that starts at the current input,
+// skipping input and keymap lookups. Return 1 if a step ran. Return 0 to feed
+// macro inputs through editor_get_input instead, e.g., mid key sequence or
+// while a prompt opened by the macro has a different kmap.
+static int _editor_run_macro_step(editor_t* editor, cmd_context_t* ctx) {
+    loop_context_t* loop_ctx;
+    kmacro_t* macro;
+    kmacro_step_t* step;
+    bview_t* bview;
+    size_t index;
+    size_t lo;
+    size_t hi;
+    size_t mid;
+    size_t i;
+
+    loop_ctx = ctx->loop_ctx;
+    if (loop_ctx->binding_node || ctx->has_pastebuf_leftover) return 0;
+    if (!_editor_macro_apply_next(editor)) return 0;
+    macro = editor->macro_apply;
+    index = editor->macro_apply_input_index;
+    bview = editor->active;
+    if (!bview->kmap_tail) return 0;
+
+    // Recompile at the start of a repetition if kmaps changed
+    if (index == 0 && (macro->steps_kmap != bview->kmap_tail->kmap || macro->steps_kmap_gen != editor->kmap_gen)) {
+        _editor_compile_macro(editor, macro);
+    }
+    if (macro->steps_kmap != bview->kmap_tail->kmap || macro->steps_kmap_gen != editor->kmap_gen) {
+        return 0;
+    }
+
+    // Find step starting at index. Usually it's the next one; after a
+    // prompt consumed inputs, binary search for it.
+    i = editor->macro_apply_step;
+    if (i >= macro->steps_len || macro->steps[i].input_start != index) {
+        lo = 0;
+        hi = macro->steps_len;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (macro->steps[mid].input_start < index) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        i = lo;
+        if (i >= macro->steps_len || macro->steps[i].input_start != index) return 0;
+    }
+    step = &macro->steps[i];
+
+    // Consume step inputs
+    _editor_load_macro_paste(editor, macro, &step->input);
+    if (editor->is_recording_macro && editor->macro_record) {
+        for (index = step->input_start; index < step->input_end; index++) {
+            _editor_record_input(editor, editor->macro_record, &macro->inputs[index]);
+        }
+    }
+    editor->macro_apply_input_index = step->input_end;
+    editor->macro_apply_step = i + 1;
+
+    // Execute
+    ctx->input = step->input;
+    ctx->is_user_input = 0;
+    ctx->static_param = step->static_param;
+    memcpy(loop_ctx->numeric_params, step->numeric_params, sizeof(step->numeric_params));
+    loop_ctx->numeric_params_len = step->numeric_params_len;
+    memcpy(loop_ctx->wildcard_params, step->wildcard_params, sizeof(step->wildcard_params));
+    loop_ctx->wildcard_params_len = step->wildcard_params_len;
+    _editor_exec_cmd(editor, ctx, step->funcref);
+    return 1;
+}
+
+// Resolve macro inputs into steps against the active bview's kmaps
+static void _editor_compile_macro(editor_t* editor, kmacro_t* macro) {
+    loop_context_t loop_ctx;
+    cmd_context_t ctx;
+    cmd_funcref_t* funcref;
+    kmacro_step_t* step;
+    size_t start;
+    size_t i;
+
+    memset(&loop_ctx, 0, sizeof(loop_context_t));
+    memset(&ctx, 0, sizeof(cmd_context_t));
+    ctx.editor = editor;
+    ctx.loop_ctx = &loop_ctx;
+    macro->steps_len = 0;
+    start = 0;
+    for (i = 0; i < macro->inputs_len; i++) {
+        if (memcmp(&macro->inputs[i], &editor->macro_toggle_key, sizeof(kinput_t)) == 0) {
+            break; // Leave toggling macro mode to editor_get_input
+        }
+        ctx.input = macro->inputs[i];
+        funcref = editor_get_command(editor, &ctx, NULL);
+        if (!funcref && loop_ctx.need_more_input) {
+            continue;
+        } else if (funcref) {
+            if (macro->steps_len + 1 > macro->steps_cap) {
+                macro->steps_cap = macro->steps_cap ? macro->steps_cap * 2 : 8;
+                macro->steps = realloc(macro->steps, sizeof(kmacro_step_t) * macro->steps_cap);
+            }
+            step = &macro->steps[macro->steps_len++];
+            step->funcref = funcref;
+            step->static_param = ctx.static_param;
+            step->input = ctx.input;
+            step->input_start = start;
+            step->input_end = i + 1;
+            memcpy(step->numeric_params, loop_ctx.numeric_params, sizeof(loop_ctx.numeric_params));
+            step->numeric_params_len = loop_ctx.numeric_params_len;
+            memcpy(step->wildcard_params, loop_ctx.wildcard_params, sizeof(loop_ctx.wildcard_params));
+            step->wildcard_params_len = loop_ctx.wildcard_params_len;
+        }
+        // Else not found; editor_get_input drops it too
+        loop_ctx.binding_node = NULL;
+        loop_ctx.wildcard_params_len = 0;
+        loop_ctx.numeric_params_len = 0;
+        start = i + 1;
+    }
+    macro->steps_kmap = editor->active->kmap_tail->kmap;
+    macro->steps_kmap_gen = editor->kmap_gen;
+}
+
+// Draw bviews cursors recursively
+static void _editor_draw_cursors(editor_t* editor, bview_t* bview) {
+    if (MLE_BVIEW_IS_EDIT(bview) && bview_get_split_root(bview) != editor->active_edit_root) {
+        return;
+    }
+    bview_draw_cursor(bview, bview == editor->active ? 1 : 0);
+    if (bview->split_child) {
+        _editor_draw_cursors(editor, bview->split_child);
+    }
+}
+
+// Return 1 if input is already pending (queued user input or macro replay)
+// and the last frame is younger than max_frame_latency, else return 0. Queued
+// user input is stashed in ctx->pastebuf_leftover so that a burst of keys is
+// handled in one go and drawn in a single frame.
+static int _editor_should_defer_display(editor_t* editor, cmd_context_t* ctx) {
+    int rc;
+    tb_event_t ev;
+    struct timeval now;
+
+    // Run timers that came due while queued input kept the loop busy, e.g.,
+    // a debounced resize
+    _editor_run_timers(editor);
+
+    // Check frame latency. This caps every deferral, including a pending
+    // resize, so a steady stream of input can't starve the display.
+    if (editor->max_frame_latency > 0) {
+        gettimeofday(&now, NULL);
+        if (util_timeval_diff_ms(&now, &editor->last_display_time) >= editor->max_frame_latency) {
+            if (editor->resize_timer) {
+                // Lay out at the latest size now rather than draw a stale one
+                editor_remove_timer(editor, editor->resize_timer);
+                _editor_resize_cb(editor, NULL);
+            }
+            return 0;
+        }
+    }
+
+    // Draw once at the final size when a resize is pending
+    if (editor->resize_timer) {
+        return 1;
+    }
+
+    if (editor->max_frame_latency <= 0) {
+        return 0;
+    }
+
+    // Check for pending input
+    if (ctx->has_pastebuf_leftover) {
+        return 1;
+    } else if (editor->macro_apply && editor->macro_apply_input_index < editor->macro_apply->inputs_len) {
+        return 1;
+    }
+
+    // Peek event
+    rc = editor_peek_event(editor, &ev, 0);
+    if (rc == -1 || rc == 0) {
+        return 0; // Error or nothing queued
+    } else if (rc == TB_EVENT_RESIZE) {
+        editor_queue_resize(editor, ev.w, ev.h);
+        return editor->resize_timer ? 1 : 0;
+    }
+    ctx->has_pastebuf_leftover = 1;
+    _editor_event_to_input(editor, &ev, &ctx->pastebuf_leftover);
+    return 1;
+}
+
+// Insert output queued on menus since the last frame
+static void _editor_flush_appends(editor_t* editor) {
+    bview_t* bview;
+    CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+        if (bview->append_len > 0) bview_flush_appends(bview);
+    }
+}
+
+// Present the back buffer. If display output is being measured, tally the
+// cells and bytes that tb_present actually wrote.
+static void _editor_present(editor_t* editor) {
+#ifndef MLE_HEADLESS
+    size_t bytes_before;
+#endif
+    if (!_editor_is_output_counted(editor)) {
+        tb_present();
+        return;
+    }
+#ifdef MLE_HEADLESS
+    tb_present();
+    headless_get_output(&editor->display_cells_out, &editor->display_bytes_out);
+#else
+    _editor_count_display_cells(editor);
+    bytes_before = _editor_get_bytes_written();
+    tb_present();
+    editor->display_bytes_out += _editor_get_bytes_written() - bytes_before;
+#endif
+}
+
+// Return 1 if display output is reported somewhere, i.e., a perf dump (-T),
+// a bench (-B), or a trace (-r, -p, -P)
+static int _editor_is_output_counted(editor_t* editor) {
+    return editor->perf_path
+        || editor->bench_name
+        || editor->trace.is_replay
+        || editor->trace.record_fp
+        ? 1 : 0;
+}
+
+#ifndef MLE_HEADLESS
+// Count cells tb_present is about to write by diffing the back buffer
+// against a copy of the last presented frame
+static void _editor_count_display_cells(editor_t* editor) {
+    struct tb_cell* cells;
+    size_t len;
+    size_t i;
+
+    len = (size_t)tb_width() * (size_t)tb_height();
+    cells = tb_cell_buffer();
+    if (editor->display_shadow_len != len) {
+        // Everything is new after a resize
+        editor->display_shadow = realloc(editor->display_shadow, sizeof(struct tb_cell) * MLE_MAX(1, len));
+        editor->display_shadow_len = len;
+        memset(editor->display_shadow, 0, sizeof(struct tb_cell) * len);
+    }
+    for (i = 0; i < len; i++) {
+        if (memcmp(&cells[i], &editor->display_shadow[i], sizeof(struct tb_cell)) == 0) continue;
+        editor->display_cells_out += 1;
+        editor->display_shadow[i] = cells[i];
+    }
+}
+
+// Return number of bytes this process has written so far, per /proc/self/io.
+// Nothing else writes while tb_present runs, so the difference across it is
+// what termbox sent to the tty. Return 0 if unavailable.
+static size_t _editor_get_bytes_written() {
+    FILE* fp;
+    char line[128];
+    unsigned long long wchar;
+    wchar = 0;
+    if (!(fp = fopen("/proc/self/io", "r"))) return 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "wchar: %llu", &wchar) == 1) break;
+    }
+    fclose(fp);
+    return (size_t)wchar;
+}
+#endif
+
+// Get user input. Return MLE_ERR if there is no more input, i.e., a replayed
+// trace is done.
+static int _editor_get_user_input(editor_t* editor, cmd_context_t* ctx) {
+    int rc;
+
+    // Reset pastebuf
+    ctx->pastebuf_len = 0;
+
+    // Wait for input, redrawing whenever async procs, timers, or a resize
+    // change something in the meantime
+    while ((rc = _editor_wait_for_input(editor, ctx)) == 0) {
+        if (!editor->is_display_disabled && !editor->resize_timer) editor_display(editor);
+    }
+    if (rc < 0) return MLE_ERR;
+
+    // Let the command see async output that arrived since the last frame
+    _editor_flush_appends(editor);
+
+    // Use pastebuf_leftover
+    ctx->input = ctx->pastebuf_leftover;
+    ctx->has_pastebuf_leftover = 0;
+    return MLE_OK;
+}
+
+// Wait for user input while servicing async procs and timers. Return 1 if
+// input is ready in pastebuf_leftover, 0 if something else happened that
+// warrants a redisplay, or -1 if there is no more input. Blocks in
+// epoll_pwait until the tty is readable, an async proc writes, the next timer
+// is due, or a signal arrives, so an idle editor never wakes up.
+static int _editor_wait_for_input(editor_t* editor, cmd_context_t* ctx) {
+    struct epoll_event events[MLE_EPOLL_MAX_EVENTS];
+    tb_event_t ev;
+    sigset_t winch_mask;
+    sigset_t orig_mask;
+    int nevents;
+    int nhandled;
+    int rc;
+    int i;
+
+    if (ctx->has_pastebuf_leftover) return 1;
+    _editor_init_epoll(editor);
+    sigemptyset(&winch_mask);
+    sigaddset(&winch_mask, SIGWINCH);
+
+    while (1) {
+        if (editor->epollfd >= 0) {
+            // Close out finished async procs
+            if (_editor_reap_async_procs(editor) > 0) return 0;
+
+            // Animate async indicator while procs are running
+            if (editor->async_procs && !editor->async_frame_timer) {
+                editor_add_timer(editor, MLE_ASYNC_FRAME_MS, _editor_async_frame_cb, NULL, &editor->async_frame_timer);
+            }
+
+            // Hold SIGWINCH from here until epoll_pwait so a resize that
+            // lands after the peek still interrupts the sleep
+            pthread_sigmask(SIG_BLOCK, &winch_mask, &orig_mask);
+        }
+
+        // Take events termbox already has buffered. Without epoll, block here.
+        rc = editor_peek_event(editor, &ev, editor->epollfd >= 0 ? 0 : -1);
+        if (editor->epollfd >= 0 && (rc > 0 || editor->trace.is_replay)) {
+            pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+        }
+        if (rc == -1 && editor->trace.is_replay) {
+            return -1; // Replay done
+        } else if (rc == TB_EVENT_RESIZE) {
+            editor_queue_resize(editor, ev.w, ev.h);
+            if (!editor->resize_timer) return 0; // Resized now
+            continue;
+        } else if (rc > 0) {
+            ctx->has_pastebuf_leftover = 1;
+            _editor_event_to_input(editor, &ev, &ctx->pastebuf_leftover);
+            return 1;
+        } else if (editor->epollfd < 0) {
+            continue; // Error
+        }
+
+        // Sleep with SIGWINCH unblocked. On EINTR termbox reports the resize
+        // on the next peek.
+        nevents = epoll_pwait(editor->epollfd, events, MLE_EPOLL_MAX_EVENTS, _editor_next_timer_ms(editor), &orig_mask);
+        pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+        nhandled = 0;
+        for (i = 0; i < nevents; i++) {
+            if (events[i].data.ptr) {
+                async_proc_read((async_proc_t*)events[i].data.ptr);
+                nhandled += 1;
+            }
+            // Else tty is readable; peek on next iteration
+        }
+        nhandled += _editor_run_timers(editor);
+        if (nhandled > 0) return 0;
+    }
+}
+
+// Create epoll instance and watch tty. termbox reads the tty itself; we only
+// wait on our own fd for it to become readable.
+static int _editor_init_epoll(editor_t* editor) {
+    if (editor->epollfd >= 0) return MLE_OK;
+    if ((editor->epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        return MLE_ERR;
+    }
+    if (editor->trace.is_replay) {
+        // Input comes from the trace; leave tty unread
+    } else if (_editor_open_tty(editor) == MLE_OK) {
+        editor_watch_fd(editor, editor->ttyfd, NULL);
+    }
+    return MLE_OK;
+}
+
+// Return ms until next timer or replayed input is due, or -1 if there are
+// none
+static int _editor_next_timer_ms(editor_t* editor) {
+    uint64_t now_us;
+    int timer_ms;
+    int replay_ms;
+    timer_ms = -1;
+    if (editor->timers) {
+        now_us = perf_now_us();
+        timer_ms = editor->timers->when_us <= now_us ? 0 : (int)MLE_MIN((editor->timers->when_us - now_us + 999) / 1000, (uint64_t)INT_MAX);
+    }
+    replay_ms = editor->trace.is_replay ? trace_replay_due_ms(editor) : -1;
+    if (replay_ms >= 0 && (timer_ms < 0 || replay_ms < timer_ms)) {
+        return replay_ms;
+    }
+    return timer_ms;
+}
+
+// Invoke and free due timers. Return number of timers invoked.
+static int _editor_run_timers(editor_t* editor) {
+    editor_timer_t* timer;
+    uint64_t now_us;
+    int nrun;
+    nrun = 0;
+    now_us = perf_now_us();
+    while ((timer = editor->timers) != NULL && timer->when_us <= now_us) {
+        DL_DELETE(editor->timers, timer);
+        timer->callback(editor, timer->udata);
+        free(timer);
+        nrun += 1;
+    }
+    return nrun;
+}
+
+// Timer callback for async indicator. Waking the loop is enough to redraw it.
+static void _editor_async_frame_cb(editor_t* editor, void* udata) {
+    editor->async_frame_timer = NULL;
+}
+
+// Timer callback for a queued resize. termbox clears the screen on resize, so
+// everything is redrawn, but only bviews whose rect changed are laid out.
+static void _editor_resize_cb(editor_t* editor, void* udata) {
+    editor->resize_timer = NULL;
+    _editor_layout(editor, editor->resize_w, editor->resize_h, 0);
+}
+
+// Set editor rects for a w x h screen and resize top bviews to fit. Unless
+// is_forced, bviews already at their rect are left alone.
+static int _editor_layout(editor_t* editor, int w, int h, int is_forced) {
     bview_t* bview;
     bview_rect_t* bounds;
 
     editor->w = w >= 0 ? w : tb_width();
     editor->h = h >= 0 ? h : tb_height();
+    editor_damage(editor, NULL);
 
     editor->rect_edit.x = 0;
     editor->rect_edit.y = 0;
@@ -790,50 +1673,31 @@ static void _editor_resize(editor_t* editor, int w, int h) {
             if (bview->split_parent) continue;
             bounds = &editor->rect_edit;
         }
+        if (!is_forced
+            && bview->x == bounds->x && bview->y == bounds->y
+            && bview->w == bounds->w && bview->h == bounds->h
+        ) {
+            continue; // Same rect; keep layout
+        }
         bview_resize(bview, bounds->x, bounds->y, bounds->w, bounds->h);
     }
+    return MLE_OK;
 }
 
-// Draw bviews cursors recursively
-static void _editor_draw_cursors(editor_t* editor, bview_t* bview) {
-    if (MLE_BVIEW_IS_EDIT(bview) && bview_get_split_root(bview) != editor->active_edit_root) {
-        return;
-    }
-    bview_draw_cursor(bview, bview == editor->active ? 1 : 0);
-    if (bview->split_child) {
-        _editor_draw_cursors(editor, bview->split_child);
-    }
-}
-
-// Get user input
-static void _editor_get_user_input(editor_t* editor, cmd_context_t* ctx) {
-    int rc;
-    tb_event_t ev;
-
-    // Reset pastebuf
-    ctx->pastebuf_len = 0;
-
-    // Use pastebuf_leftover is present
-    if (ctx->has_pastebuf_leftover) {
-        ctx->input = ctx->pastebuf_leftover;
-        ctx->has_pastebuf_leftover = 0;
-        return;
-    }
-
-    // Poll for event
-    while (1) {
-        rc = tb_poll_event(&ev);
-        if (rc == -1) {
-            continue; // Error
-        } else if (rc == TB_EVENT_RESIZE) {
-            // Resize
-            _editor_resize(editor, ev.w, ev.h);
-            editor_display(editor);
-            continue;
-        }
-        ctx->input = (kinput_t){ ev.mod, ev.ch, ev.key };
-        break;
+// Close and free async procs that hit eof or error or were marked done.
+// Return number of procs closed.
+static int _editor_reap_async_procs(editor_t* editor) {
+    async_proc_t* aproc;
+    async_proc_t* aproc_tmp;
+    int nreaped;
+    nreaped = 0;
+    DL_FOREACH_SAFE(editor->async_procs, aproc, aproc_tmp) {
+        if (!aproc->is_done) continue;
+        aproc->callback(aproc, NULL, 0, 0, 0, 1);
+        async_proc_destroy(aproc); // Calls DL_DELETE
+        nreaped += 1;
     }
+    return nreaped;
 }
 
 // Ingest available input until non-cmd_insert_data
@@ -851,25 +1715,24 @@ static void _editor_ingest_paste(editor_t* editor, cmd_context_t* ctx) {
     while (1) {
         // Expand pastebuf if needed
         if (ctx->pastebuf_len + 1 > ctx->pastebuf_size) {
-            ctx->pastebuf_size += MLE_PASTEBUF_INCR;
+            ctx->pastebuf_size = ctx->pastebuf_size ? ctx->pastebuf_size * 2 : MLE_PASTEBUF_INCR;
             ctx->pastebuf = realloc(ctx->pastebuf, sizeof(kinput_t) * ctx->pastebuf_size);
         }
 
         // Peek event
-        rc = tb_peek_event(&ev, 0);
+        rc = editor_peek_event(editor, &ev, 0);
         if (rc == -1) {
             break; // Error
         } else if (rc == 0) {
             break; // Timeout
         } else if (rc == TB_EVENT_RESIZE) {
-            // Resize
-            _editor_resize(editor, ev.w, ev.h);
-            editor_display(editor);
-            break;
+            // Resize once the storm settles; keep ingesting
+            editor_queue_resize(editor, ev.w, ev.h);
+            continue;
         }
-        input = (kinput_t){ ev.mod, ev.ch, ev.key };
+        _editor_event_to_input(editor, &ev, &input);
         // TODO check for macro key
-        funcref = _editor_get_command(editor, ctx, &input);
+        funcref = editor_get_command(editor, ctx, &input);
         if (funcref && funcref->func == cmd_insert_data) {
             // Insert data; keep ingesting
             ctx->pastebuf[ctx->pastebuf_len++] = input;
@@ -896,145 +1759,441 @@ static void _editor_record_macro_input(kmacro_t* macro, kinput_t* input) {
     macro->inputs_len += 1;
 }
 
-// Return command for input
-static cmd_funcref_t* _editor_get_command(editor_t* editor, cmd_context_t* ctx, kinput_t* opt_peek_input) {
-    loop_context_t* loop_ctx;
-    kinput_t* input;
-    kbinding_t* node;
-    kbinding_t* binding;
-    kmap_node_t* kmap_node;
-    int is_top;
-    int is_peek;
-    int again;
+// Append a paste's text to macro and record a paste input that refers to it
+static void _editor_record_macro_paste(kmacro_t* macro, char* data, size_t data_len) {
+    kinput_t input;
+    macro->pastes = realloc(macro->pastes, sizeof(char*) * (macro->pastes_len + 1));
+    macro->paste_lens = realloc(macro->paste_lens, sizeof(size_t) * (macro->pastes_len + 1));
+    macro->pastes[macro->pastes_len] = malloc(MLE_MAX(1, data_len));
+    if (data_len > 0) memcpy(macro->pastes[macro->pastes_len], data, data_len);
+    macro->paste_lens[macro->pastes_len] = data_len;
+    input = MLE_KINPUT_PASTE;
+    input.ch = (uint32_t)macro->pastes_len;
+    macro->pastes_len += 1;
+    _editor_record_macro_input(macro, &input);
+}
+
+// Record input in macro. A paste input takes its text from editor->paste.
+static void _editor_record_input(editor_t* editor, kmacro_t* macro, kinput_t* input) {
+    if (MLE_KINPUT_IS_PASTE(input)) {
+        _editor_record_macro_paste(macro, editor->paste, editor->paste_len);
+    } else {
+        _editor_record_macro_input(macro, input);
+    }
+}
 
-    // Init some vars
-    loop_ctx = ctx->loop_ctx;
-    is_peek = opt_peek_input ? 1 : 0;
-    input = opt_peek_input ? opt_peek_input : &ctx->input;
-    kmap_node = editor->active->kmap_tail;
-    node = loop_ctx->binding_node;
-    is_top = (node == NULL ? 1 : 0);
-    loop_ctx->need_more_input = 0;
-    loop_ctx->binding_node = NULL;
+// If input is a paste recorded in macro, put its text in editor->paste
+static void _editor_load_macro_paste(editor_t* editor, kmacro_t* macro, kinput_t* input) {
+    if (!MLE_KINPUT_IS_PASTE(input)) return;
+    editor->paste_len = 0;
+    if (input->ch < macro->pastes_len) {
+        _editor_append_paste(editor, macro->pastes[input->ch], macro->paste_lens[input->ch]);
+    }
+}
 
-    // Look for key binding
-    while (kmap_node) {
-        if (is_top) node = kmap_node->kmap->bindings;
-        again = 0;
-        binding = _editor_get_kbinding_node(node, input, loop_ctx, is_peek, &again);
-        if (binding) {
-            if (again) {
-                // Need more input on current node
-                if (!is_peek) {
-                    loop_ctx->need_more_input = 1;
-                    loop_ctx->binding_node = binding;
-                }
-                return NULL;
-            } else if (binding->funcref) {
-                // Found leaf!
-                if (!is_peek) {
-                    ctx->static_param = binding->static_param;
-                }
-                return binding->funcref;
-            } else if (binding->children) {
-                // Need more input on next node
-                if (!is_peek) {
-                    loop_ctx->need_more_input = 1;
-                    loop_ctx->binding_node = binding;
-                }
-                return NULL;
-            } else {
-                // This shouldn't happen... TODO err
-                return NULL;
-            }
-        } else if (node == kmap_node->kmap->bindings) {
-            // Binding not found at top level
-            if (kmap_node->kmap->default_funcref) {
-                // Fallback to default
-                return kmap_node->kmap->default_funcref;
-            }
-            if (kmap_node->kmap->allow_fallthru) {
-                // Fallback to previous kmap on stack
-                kmap_node = kmap_node->prev;
-                is_top = 1;
-            } else {
-                // Fallback not allowed
-                return NULL;
-            }
-        } else {
-            // Binding not found
-            return NULL;
+// Free macro
+static void _editor_destroy_macro(kmacro_t* macro) {
+    size_t i;
+    for (i = 0; i < macro->pastes_len; i++) free(macro->pastes[i]);
+    if (macro->pastes) free(macro->pastes);
+    if (macro->paste_lens) free(macro->paste_lens);
+    if (macro->inputs) free(macro->inputs);
+    if (macro->steps) free(macro->steps);
+    if (macro->name) free(macro->name);
+    free(macro);
+}
+
+// Convert key event to input. A bracketed paste, which the terminal wraps in
+// ESC[200~ and ESC[201~, is read in full into editor->paste and returned as
+// one MLE_KINPUT_PASTE, so pasted text never runs as key commands. With
+// TB_INPUT_ALT, termbox reports ESC[ as M-[.
+static void _editor_event_to_input(editor_t* editor, tb_event_t* ev, kinput_t* ret_input) {
+    *ret_input = (kinput_t){ ev->mod, ev->ch, ev->key };
+    if (ev->mod == TB_MOD_ALT && ev->ch == '[' && _editor_match_paste_start(editor)) {
+        _editor_read_paste(editor);
+        *ret_input = MLE_KINPUT_PASTE;
+    }
+}
+
+// Return 1 if the events after M-[ finish a paste start sequence. Otherwise
+// push the events read back for editor_peek_event and return 0.
+// Queue ev to be returned by editor_peek_event after any already queued.
+// Return MLE_ERR if the queue is full.
+int editor_push_event(editor_t* editor, tb_event_t* ev) {
+    if (editor->event_pushback_len >= MLE_EVENT_PUSHBACK_SIZE) return MLE_ERR;
+    editor->event_pushback[editor->event_pushback_len++] = *ev;
+    return MLE_OK;
+}
+
+static int _editor_match_paste_start(editor_t* editor) {
+    char* start_seq;
+    tb_event_t evs[4];
+    int len;
+    int rc;
+
+    start_seq = "200~";
+    len = 0;
+    while (len < 4) {
+        rc = editor_peek_event(editor, &evs[len], MLE_PASTE_START_TIMEOUT_MS);
+        if (rc == -1 || rc == 0) break;
+        len += 1;
+        if (rc != TB_EVENT_KEY || evs[len - 1].mod != 0 || evs[len - 1].ch != (uint32_t)start_seq[len - 1]) break;
+        if (start_seq[len] == '\0') return 1;
+    }
+
+    // Not a paste; put events back in front of any still queued
+    memmove(editor->event_pushback + len, editor->event_pushback, sizeof(tb_event_t) * editor->event_pushback_len);
+    memcpy(editor->event_pushback, evs, sizeof(tb_event_t) * len);
+    editor->event_pushback_len += len;
+    return 0;
+}
+
+// Read a bracketed paste into editor->paste, stopping at the end sequence or
+// if the terminal goes quiet for MLE_PASTE_TIMEOUT_MS
+static void _editor_read_paste(editor_t* editor) {
+    char* end_seq;
+    char bytes[8];
+    int end_len;
+    tb_event_t ev;
+    int rc;
+
+    end_seq = "[201~";
+    end_len = 0;
+    editor->paste_len = 0;
+    while (1) {
+        rc = editor_peek_event(editor, &ev, MLE_PASTE_TIMEOUT_MS);
+        if (rc == -1 || rc == 0) {
+            break; // Error or timeout; keep what we have
+        } else if (rc == TB_EVENT_RESIZE) {
+            editor_queue_resize(editor, ev.w, ev.h);
+            continue;
+        } else if (rc != TB_EVENT_KEY) {
+            continue;
+        }
+
+        // Match end sequence
+        if (end_len > 0 && ev.mod == 0 && ev.ch == (uint32_t)end_seq[end_len]) {
+            end_len += 1;
+            if (end_seq[end_len] == '\0') break;
+            continue;
+        } else if (end_len > 0) {
+            // Partial match was data
+            _editor_append_paste(editor, "\x1b", 1);
+            _editor_append_paste(editor, end_seq, end_len);
+            end_len = 0;
         }
+        if (ev.mod == TB_MOD_ALT && ev.ch == '[') {
+            end_len = 1;
+            continue;
+        }
+
+        _editor_append_paste(editor, bytes, _editor_paste_event_to_bytes(&ev, bytes));
     }
 
-    // No more kmaps
-    return NULL;
+    // Flush partial match if we stopped early
+    if (end_len > 0 && end_seq[end_len] != '\0') {
+        _editor_append_paste(editor, "\x1b", 1);
+        _editor_append_paste(editor, end_seq, end_len);
+    }
+}
+
+// Write the raw bytes of a pasted key event to out. Return number of bytes
+// written (at most 7).
+static int _editor_paste_event_to_bytes(tb_event_t* ev, char* out) {
+    int len;
+    len = 0;
+    if (ev->mod & TB_MOD_ALT) {
+        out[len++] = '\x1b';
+    }
+    if (ev->ch >= 0x80) {
+        len += utf8_unicode_to_char(out + len, ev->ch);
+    } else if (ev->ch) {
+        out[len++] = (char)ev->ch;
+    } else if (ev->key == TB_KEY_ENTER) {
+        out[len++] = '\n';
+    } else if (ev->key > 0 && ev->key <= 0x7f) {
+        out[len++] = (char)ev->key;
+    }
+    return len;
+}
+
+// Append data to editor->paste
+static void _editor_append_paste(editor_t* editor, char* data, size_t data_len) {
+    if (editor->paste_len + data_len > editor->paste_size) {
+        editor->paste_size = MLE_MAX(editor->paste_len + data_len, MLE_MAX(MLE_PASTEBUF_INCR, editor->paste_size * 2));
+        editor->paste = realloc(editor->paste, editor->paste_size);
+    }
+    if (data_len > 0) memcpy(editor->paste + editor->paste_len, data, data_len);
+    editor->paste_len += data_len;
 }
 
-// Find binding by input in trie, taking into account numeric and wildcards patterns
-static kbinding_t* _editor_get_kbinding_node(kbinding_t* node, kinput_t* input, loop_context_t* loop_ctx, int is_peek, int* ret_again) {
+// Return command for a paste input. A paste binding on the active kmap stack
+// wins. Otherwise the paste is inserted as text in kmaps where unbound keys
+// insert text, and dropped in others, e.g., vim_normal or a yes/no prompt.
+static cmd_funcref_t* _editor_get_paste_command(editor_t* editor, cmd_context_t* ctx, int is_peek) {
+    kinput_t paste;
     kbinding_t* binding;
-    kinput_t input_tmp;
-    memset(&input_tmp, 0, sizeof(kinput_t));
+    cmd_funcref_t* funcref;
+    bview_t* bview;
 
+    bview = editor->active;
     if (!is_peek) {
-        // Look for numeric .. TODO can be more efficient about this
-        if (input->ch >= '0' && input->ch <= '9') {
-            if (!loop_ctx->numeric_node) {
-                input_tmp = MLE_KINPUT_NUMERIC;
-                HASH_FIND(hh, node->children, &input_tmp, sizeof(kinput_t), binding);
-                loop_ctx->numeric_node = binding;
-            }
-            if (loop_ctx->numeric_node) {
-                if (loop_ctx->numeric_len < MLE_LOOP_CTX_MAX_NUMERIC_LEN) {
-                    loop_ctx->numeric[loop_ctx->numeric_len] = (char)input->ch;
-                    loop_ctx->numeric_len += 1;
-                    *ret_again = 1;
-                    return node; // Need more input on this node
-                }
-                return NULL; // Ran out of `numeric` buffer .. TODO err
+        // A paste ends any pending key sequence
+        ctx->loop_ctx->need_more_input = 0;
+        ctx->loop_ctx->binding_node = NULL;
+    }
+    if (bview->kmap_dispatch_gen != editor->kmap_gen) {
+        _editor_merge_kmap_stack(editor, bview);
+    }
+    paste = MLE_KINPUT_PASTE;
+    binding = _editor_kdispatch_find(&bview->kmap_dispatch, &paste)->literal;
+    if (binding && binding->funcref) {
+        if (!is_peek) ctx->static_param = binding->static_param;
+        return binding->funcref;
+    }
+    funcref = bview->kmap_dispatch.default_funcref;
+    if (!funcref || _editor_resolve_funcref(editor, funcref) != cmd_insert_data) {
+        return NULL;
+    }
+    HASH_FIND_STR(editor->func_map, "cmd_insert_paste", funcref);
+    if (funcref && !is_peek) ctx->static_param = NULL;
+    return funcref;
+}
+
+// Find binding by input in dispatch table, taking into account numeric and
+// wildcards patterns
+static kbinding_t* _editor_get_kbinding_node(kdispatch_t* dispatch, kinput_t* input, loop_context_t* loop_ctx, int is_peek, int* ret_again) {
+    kdispatch_entry_t* entry;
+
+    if (is_peek) {
+        // Patterns are ignored when peeking
+        return _editor_kdispatch_find(dispatch, input)->literal;
+    }
+
+    if (loop_ctx->numeric_node) {
+        if (MLE_KINPUT_IS_DIGIT(input)) {
+            // Continue numeric
+            if (loop_ctx->numeric_len < MLE_LOOP_CTX_MAX_NUMERIC_LEN) {
+                loop_ctx->numeric[loop_ctx->numeric_len] = (char)input->ch;
+                loop_ctx->numeric_len += 1;
+                *ret_again = 1;
+                return loop_ctx->numeric_node; // Need more input on this node
             }
+            loop_ctx->numeric_len = 0;
+            loop_ctx->numeric_node = NULL;
+            return NULL; // Ran out of `numeric` buffer .. TODO err
         }
 
         // Parse/reset numeric buffer
-        if (loop_ctx->numeric_len > 0) {
-            if (loop_ctx->numeric_params_len < MLE_LOOP_CTX_MAX_NUMERIC_PARAMS) {
-                loop_ctx->numeric[loop_ctx->numeric_len] = '\0';
-                loop_ctx->numeric_params[loop_ctx->numeric_params_len] = strtoul(loop_ctx->numeric, NULL, 10);
-                loop_ctx->numeric_params_len += 1;
-                loop_ctx->numeric_len = 0;
-                node = loop_ctx->numeric_node; // Resume on numeric's children
-                loop_ctx->numeric_node = NULL;
-            } else {
-                loop_ctx->numeric_len = 0;
-                loop_ctx->numeric_node = NULL;
-                return NULL; // Ran out of `numeric_params` space .. TODO err
-            }
+        if (loop_ctx->numeric_params_len < MLE_LOOP_CTX_MAX_NUMERIC_PARAMS) {
+            loop_ctx->numeric[loop_ctx->numeric_len] = '\0';
+            loop_ctx->numeric_params[loop_ctx->numeric_params_len] = strtoul(loop_ctx->numeric, NULL, 10);
+            loop_ctx->numeric_params_len += 1;
+            loop_ctx->numeric_len = 0;
+            dispatch = &loop_ctx->numeric_node->dispatch; // Resume on numeric's children
+            loop_ctx->numeric_node = NULL;
+        } else {
+            loop_ctx->numeric_len = 0;
+            loop_ctx->numeric_node = NULL;
+            return NULL; // Ran out of `numeric_params` space .. TODO err
         }
     }
 
     // Look for input
-    HASH_FIND(hh, node->children, input, sizeof(kinput_t), binding);
-    if (binding) {
-        return binding;
-    }
-
-    if (!is_peek) {
-        // Look for wildcard
-        input_tmp = MLE_KINPUT_WILDCARD;
-        HASH_FIND(hh, node->children, &input_tmp, sizeof(kinput_t), binding);
-        if (binding) {
+    entry = _editor_kdispatch_find(dispatch, input);
+    switch (entry->kind) {
+        case MLE_KDISPATCH_LITERAL:
+            return entry->binding;
+        case MLE_KDISPATCH_NUMERIC:
+            // Start numeric
+            loop_ctx->numeric_node = entry->binding;
+            loop_ctx->numeric[0] = (char)input->ch;
+            loop_ctx->numeric_len = 1;
+            *ret_again = 1;
+            return entry->binding; // Need more input on this node
+        case MLE_KDISPATCH_WILDCARD:
             if (loop_ctx->wildcard_params_len < MLE_LOOP_CTX_MAX_WILDCARD_PARAMS) {
                 loop_ctx->wildcard_params[loop_ctx->wildcard_params_len] = input->ch;
                 loop_ctx->wildcard_params_len += 1;
             } else {
                 return NULL; // Ran out of `wildcard_params` space .. TODO err
             }
-            return binding;
+            return entry->binding;
+    }
+    return NULL;
+}
+
+// Return dispatch entry for input. If input is not in the table, return the
+// entry for unmatched digits or other inputs.
+static kdispatch_entry_t* _editor_kdispatch_find(kdispatch_t* dispatch, kinput_t* input) {
+    kdispatch_entry_t* entry;
+    size_t i;
+    if (dispatch->entries) {
+        i = _editor_kinput_hash(input) & dispatch->mask;
+        while ((entry = &dispatch->entries[i])->kind != MLE_KDISPATCH_NONE) {
+            if (MLE_KINPUT_EQ(&entry->input, input)) return entry;
+            i = (i + 1) & dispatch->mask;
+        }
+    }
+    return MLE_KINPUT_IS_DIGIT(input) ? &dispatch->miss_digit : &dispatch->miss_other;
+}
+
+// Return slot for input, allocated via _editor_kdispatch_alloc. If input is
+// not in the table yet, the slot's kind is MLE_KDISPATCH_NONE.
+static kdispatch_entry_t* _editor_kdispatch_slot(kdispatch_t* dispatch, kinput_t* input) {
+    kdispatch_entry_t* entry;
+    size_t i;
+    i = _editor_kinput_hash(input) & dispatch->mask;
+    while ((entry = &dispatch->entries[i])->kind != MLE_KDISPATCH_NONE) {
+        if (MLE_KINPUT_EQ(&entry->input, input)) break;
+        i = (i + 1) & dispatch->mask;
+    }
+    return entry;
+}
+
+// Clear dispatch and allocate room for count entries at <50% load
+static void _editor_kdispatch_alloc(kdispatch_t* dispatch, size_t count) {
+    size_t size;
+    if (dispatch->entries) free(dispatch->entries);
+    memset(dispatch, 0, sizeof(kdispatch_t));
+    for (size = 8; size < count * 2; size *= 2);
+    dispatch->entries = calloc(size, sizeof(kdispatch_entry_t));
+    dispatch->mask = size - 1;
+}
+
+// Hash a kinput
+static size_t _editor_kinput_hash(kinput_t* input) {
+    uint32_t h;
+    h = input->ch * 0x9e3779b1u;
+    h ^= ((uint32_t)input->key << 8 | input->mod) * 0x85ebca6bu;
+    return (size_t)(h ^ (h >> 15));
+}
+
+// Compile a kmap into dispatch tables and invalidate merged kmap stacks
+static void _editor_compile_kmap(editor_t* editor, kmap_t* kmap) {
+    _editor_compile_kbinding(kmap->bindings);
+    kmap->bindings->dispatch.default_funcref = kmap->default_funcref;
+    editor->kmap_gen += 1;
+}
+
+// Compile children of a binding into its dispatch table, recursively
+static void _editor_compile_kbinding(kbinding_t* node) {
+    kbinding_t* child;
+    kbinding_t* child_tmp;
+    kbinding_t* numeric;
+    kbinding_t* wildcard;
+    kdispatch_t* dispatch;
+    kdispatch_entry_t* entry;
+    kinput_t numeric_input = MLE_KINPUT_NUMERIC;
+    kinput_t wildcard_input = MLE_KINPUT_WILDCARD;
+
+    // Find patterns
+    numeric = NULL;
+    wildcard = NULL;
+    HASH_ITER(hh, node->children, child, child_tmp) {
+        if (MLE_KINPUT_EQ(&child->input, &numeric_input)) {
+            numeric = child;
+        } else if (MLE_KINPUT_EQ(&child->input, &wildcard_input)) {
+            wildcard = child;
+        }
+        if (child->children) _editor_compile_kbinding(child);
+    }
+
+    // Add literal inputs. Numeric takes precedence over literal digits.
+    dispatch = &node->dispatch;
+    _editor_kdispatch_alloc(dispatch, HASH_COUNT(node->children));
+    HASH_ITER(hh, node->children, child, child_tmp) {
+        if (child == numeric || child == wildcard) continue;
+        entry = _editor_kdispatch_slot(dispatch, &child->input);
+        entry->input = child->input;
+        entry->literal = child;
+        if (numeric && MLE_KINPUT_IS_DIGIT(&child->input)) {
+            entry->kind = MLE_KDISPATCH_NUMERIC;
+            entry->binding = numeric;
+        } else {
+            entry->kind = MLE_KDISPATCH_LITERAL;
+            entry->binding = child;
         }
     }
 
-    return NULL;
+    // Set fallbacks for inputs not in table
+    if (numeric) {
+        dispatch->miss_digit.kind = MLE_KDISPATCH_NUMERIC;
+        dispatch->miss_digit.binding = numeric;
+    } else if (wildcard) {
+        dispatch->miss_digit.kind = MLE_KDISPATCH_WILDCARD;
+        dispatch->miss_digit.binding = wildcard;
+    }
+    if (wildcard) {
+        dispatch->miss_other.kind = MLE_KDISPATCH_WILDCARD;
+        dispatch->miss_other.binding = wildcard;
+    }
+}
+
+// Merge the kmap stack of bview into a single dispatch table. Walking the
+// stack from the top, the first kmap that matches an input wins, down to the
+// first kmap that has a default or does not allow fallthru.
+static void _editor_merge_kmap_stack(editor_t* editor, bview_t* bview) {
+    kdispatch_t* merged;
+    kdispatch_t* dispatch;
+    kdispatch_entry_t* entry;
+    kdispatch_entry_t* found;
+    kdispatch_entry_t* slot;
+    kmap_node_t* last;
+    kmap_node_t* kmap_node;
+    kmap_node_t* kmap_node2;
+    size_t count;
+    size_t i;
+
+    // Find bottom of stack and size of merged table
+    count = 0;
+    last = NULL;
+    for (kmap_node = bview->kmap_tail; kmap_node; kmap_node = kmap_node->prev) {
+        count += HASH_COUNT(kmap_node->kmap->bindings->children);
+        last = kmap_node;
+        if (kmap_node->kmap->default_funcref
+            || !kmap_node->kmap->allow_fallthru
+            || kmap_node == bview->kmap_stack
+        ) {
+            break;
+        }
+    }
+
+    merged = &bview->kmap_dispatch;
+    _editor_kdispatch_alloc(merged, count);
+    bview->kmap_dispatch_gen = editor->kmap_gen;
+    if (!last) return;
+    merged->default_funcref = last->kmap->default_funcref;
+
+    // Resolve every input bound in any kmap against the whole stack
+    for (kmap_node = bview->kmap_tail; ; kmap_node = kmap_node->prev) {
+        dispatch = &kmap_node->kmap->bindings->dispatch;
+        for (i = 0; dispatch->entries && i <= dispatch->mask; i++) {
+            entry = &dispatch->entries[i];
+            if (entry->kind == MLE_KDISPATCH_NONE) continue;
+            slot = _editor_kdispatch_slot(merged, &entry->input);
+            if (slot->kind != MLE_KDISPATCH_NONE) continue; // Already resolved
+            for (kmap_node2 = bview->kmap_tail; ; kmap_node2 = kmap_node2->prev) {
+                found = _editor_kdispatch_find(&kmap_node2->kmap->bindings->dispatch, &entry->input);
+                if (slot->kind == MLE_KDISPATCH_NONE && found->kind != MLE_KDISPATCH_NONE) {
+                    slot->input = entry->input;
+                    slot->kind = found->kind;
+                    slot->binding = found->binding;
+                }
+                if (!slot->literal) slot->literal = found->literal;
+                if (kmap_node2 == last) break;
+            }
+        }
+        if (kmap_node == last) break;
+    }
+
+    // Resolve fallbacks for inputs not bound in any kmap
+    for (kmap_node = bview->kmap_tail; ; kmap_node = kmap_node->prev) {
+        dispatch = &kmap_node->kmap->bindings->dispatch;
+        if (merged->miss_digit.kind == MLE_KDISPATCH_NONE) merged->miss_digit = dispatch->miss_digit;
+        if (merged->miss_other.kind == MLE_KDISPATCH_NONE) merged->miss_other = dispatch->miss_other;
+        if (kmap_node == last) break;
+    }
 }
 
 // Resolve a funcref to a func
@@ -1095,6 +2254,10 @@ static void _editor_init_signal_handlers(editor_t* editor) {
     sigaction(SIGINT, &action, NULL);
     sigaction(SIGQUIT, &action, NULL);
     sigaction(SIGHUP, &action, NULL);
+
+    // Get EPIPE instead of dying when a shell cmd stops reading its input
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
 }
 
 // Gracefully exit
@@ -1103,6 +2266,7 @@ static void _editor_graceful_exit(int signum) {
     char path[64];
     int bview_num;
     bview_num = 0;
+    _editor_set_paste_mode(&_editor, 0);
     tb_shutdown();
     CDL_FOREACH2(_editor.all_bviews, bview, all_next) {
         if (bview->buffer->is_unsaved) {
@@ -1115,9 +2279,30 @@ static void _editor_graceful_exit(int signum) {
     exit(1);
 }
 
+// Turn terminal bracketed paste mode on or off. This goes to the tty termbox
+// draws on, which is not necessarily stdout.
+static void _editor_set_paste_mode(editor_t* editor, int is_on) {
+    if (editor->trace.is_replay || _editor_open_tty(editor) != MLE_OK) return;
+    if (is_on) {
+        write(editor->ttyfd, MLE_PASTE_MODE_ON, strlen(MLE_PASTE_MODE_ON));
+    } else {
+        write(editor->ttyfd, MLE_PASTE_MODE_OFF, strlen(MLE_PASTE_MODE_OFF));
+    }
+}
+
+// Open /dev/tty, the terminal termbox uses, if not open yet
+static int _editor_open_tty(editor_t* editor) {
+    if (editor->ttyfd >= 0) return MLE_OK;
+    if ((editor->ttyfd = open("/dev/tty", O_RDWR | O_CLOEXEC)) < 0) {
+        return MLE_ERR;
+    }
+    return MLE_OK;
+}
+
 // Init built-in kmaps
 static void _editor_init_kmaps(editor_t* editor) {
     _editor_init_kmap(editor, &editor->kmap_normal, "mle_normal", MLE_FUNCREF(cmd_insert_data), 0, (kbinding_def_t[]){
+        MLE_KBINDING_DEF(cmd_insert_paste, "paste"),
         MLE_KBINDING_DEF(cmd_delete_before, "backspace"),
         MLE_KBINDING_DEF(cmd_delete_before, "backspace2"),
         MLE_KBINDING_DEF(cmd_delete_after, "delete"),
@@ -1150,6 +2335,7 @@ static void _editor_init_kmaps(editor_t* editor) {
         MLE_KBINDING_DEF(cmd_copy, "M-k"),
         MLE_KBINDING_DEF(cmd_uncut, "C-u"),
         MLE_KBINDING_DEF(cmd_redraw, "C-l"),
+        MLE_KBINDING_DEF(cmd_show_perf, "F2"),
         MLE_KBINDING_DEF_EX(cmd_copy_by, "C-c d", "bracket", NULL),
         MLE_KBINDING_DEF_EX(cmd_copy_by, "C-c w", "word", NULL),
         MLE_KBINDING_DEF_EX(cmd_copy_by, "C-c s", "word_back", NULL),
@@ -1171,6 +2357,7 @@ static void _editor_init_kmaps(editor_t* editor) {
         MLE_KBINDING_DEF(cmd_drop_cursor_column, "C-/ '"),
         MLE_KBINDING_DEF(cmd_apply_macro, "M-j"),
         MLE_KBINDING_DEF(cmd_apply_macro_by, "M-m **"),
+        MLE_KBINDING_DEF(cmd_apply_macro_repeat, "M-J"),
         MLE_KBINDING_DEF(cmd_next, "M-n"),
         MLE_KBINDING_DEF(cmd_prev, "M-p"),
         MLE_KBINDING_DEF(cmd_split_vertical, "M-v"),
@@ -1278,6 +2465,7 @@ static void _editor_init_kmap(editor_t* editor, kmap_t** ret_kmap, char* name, c
         _editor_init_kmap_add_binding(editor, kmap, defs->funcref.name, defs->key_patt, defs->static_param);
         defs++;
     }
+    _editor_compile_kmap(editor, kmap);
 
     HASH_ADD_KEYPTR(hh, editor->kmap_map, kmap->name, strlen(kmap->name), kmap);
     *ret_kmap = kmap;
@@ -1361,6 +2549,7 @@ static int _editor_init_kmap_add_binding_by_str(editor_t* editor, kmap_t* kmap,
     args[1] = strtok(NULL, ","); if (!args[1]) return MLE_ERR;
     args[2] = strtok(NULL, ",");
     _editor_init_kmap_add_binding(editor, kmap, args[0], args[1], args[2]);
+    _editor_compile_kmap(editor, kmap);
     return MLE_OK;
 }
 
@@ -1376,6 +2565,7 @@ static void _editor_destroy_kmap(kmap_t* kmap, kbinding_t* trie) {
         }
         HASH_DELETE(hh, trie, binding);
         if (binding->static_param) free(binding->static_param);
+        if (binding->dispatch.entries) free(binding->dispatch.entries);
         free(binding);
     }
     if (is_top) {
@@ -1510,6 +2700,7 @@ static void _editor_init_syntax_add_rule(syntax_t* syntax, srule_def_t def) {
     node = calloc(1, sizeof(srule_node_t));
     if (def.re_end) {
         node->srule = srule_new_multi(def.re, strlen(def.re), def.re_end, strlen(def.re_end), def.fg, def.bg);
+        syntax->has_multi_rules = 1;
     } else {
         node->srule = srule_new_single(def.re, strlen(def.re), 0, def.fg, def.bg);
     }
@@ -1615,26 +2806,33 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
     cur_kmap = NULL;
     cur_syntax = NULL;
     optind = 0;
-    while (rv == MLE_OK && (c = getopt(argc, argv, "ha:bc:K:k:l:M:m:n:S:s:t:vx:y:z:")) != -1) {
+    while (rv == MLE_OK && (c = getopt(argc, argv, "ha:B:bc:f:j:K:k:l:M:m:n:P:p:r:S:s:T:t:vx:y:z:")) != -1) {
         switch (c) {
             case 'h':
                 printf("mle version %s\n\n", MLE_VERSION);
                 printf("Usage: mle [options] [file:line]...\n\n");
                 printf("    -h           Show this message\n");
                 printf("    -a <1|0>     Enable/disable tab_to_space (default: %d)\n", MLE_DEFAULT_TAB_TO_SPACE);
+                printf("    -B <bench>   Run micro-benchmark and exit (render, render_utf8, display, kmap, aproc)\n");
                 printf("    -b           Highlight bracket pairs\n");
                 printf("    -c <column>  Color column\n");
+                printf("    -f <ms>      Max frame latency while input is queued, 0=draw every input (default: %d)\n", MLE_DEFAULT_MAX_FRAME_LATENCY);
+                printf("    -j <num>     Max shell cmds run at once for multiple cursors, 0=num cpus (default: 0)\n");
                 printf("    -K <kdef>    Set current kmap definition (use with -k)\n");
                 printf("    -k <kbind>   Add key binding to current kmap definition (use with -K)\n");
                 printf("    -l <ltype>   Set linenum type (default: 0)\n");
                 printf("    -M <macro>   Add a macro\n");
                 printf("    -m <key>     Set macro toggle key (default: %s)\n", MLE_DEFAULT_MACRO_TOGGLE_KEY);
                 printf("    -n <kmap>    Set init kmap (default: mle_normal)\n");
+                printf("    -P <path>    Replay input trace as fast as possible, then exit (use -T for latency)\n");
+                printf("    -p <path>    Replay input trace at recorded pace, then exit (use -T for latency)\n");
+                printf("    -r <path>    Record input trace to path\n");
                 printf("    -S <syndef>  Set current syntax definition (use with -s)\n");
                 printf("    -s <synrule> Add syntax rule to current syntax definition (use with -S)\n");
+                printf("    -T <path>    Write frame-time and input-latency stats to path on exit\n");
                 printf("    -t <size>    Set tab size (default: %d)\n", MLE_DEFAULT_TAB_WIDTH);
                 printf("    -v           Print version and exit\n");
-                printf("    -x <script>  Execute user script\n");
+                printf("    -x <script>  Run script on each file, save, and exit (no tty needed)\n");
                 printf("    -y <syntax>  Set override syntax for files opened at start up\n");
                 printf("    -z <1|0>     Enable/disable trim_paste (default: %d)\n\n", MLE_DEFAULT_TRIM_PASTE);
                 printf("    file         At start up, open file\n");
@@ -1650,12 +2848,21 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
             case 'a':
                 editor->tab_to_space = atoi(optarg) ? 1 : 0;
                 break;
+            case 'B':
+                editor->bench_name = optarg;
+                break;
             case 'b':
                 editor->highlight_bracket_pairs = 1;
                 break;
             case 'c':
                 editor->color_col = atoi(optarg);
                 break;
+            case 'f':
+                editor->max_frame_latency = MLE_MAX(0, atoi(optarg));
+                break;
+            case 'j':
+                editor->shell_max_procs = MLE_MAX(0, atoi(optarg));
+                break;
             case 'K':
                 if (_editor_init_kmap_by_str(editor, &cur_kmap, optarg) != MLE_OK) {
                     MLE_LOG_ERR("Could not init kmap by str: %s\n", optarg);
@@ -1691,6 +2898,13 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
             case 'n':
                 editor->kmap_init_name = strdup(optarg);
                 break;
+            case 'P':
+            case 'p':
+                rv = trace_replay_open(editor, optarg, c == 'p' ? 1 : 0);
+                break;
+            case 'r':
+                rv = trace_record_open(editor, optarg);
+                break;
             case 'S':
                 if (_editor_init_syntax_by_str(editor, &cur_syntax, optarg) != MLE_OK) {
                     MLE_LOG_ERR("Could not init syntax by str: %s\n", optarg);
@@ -1705,6 +2919,9 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
                     rv = MLE_ERR;
                 }
                 break;
+            case 'T':
+                editor->perf_path = optarg;
+                break;
             case 't':
                 editor->tab_width = atoi(optarg);
                 break;
@@ -1712,6 +2929,9 @@ static int _editor_init_from_args(editor_t* editor, int argc, char** argv) {
                 printf("mle version %s\n", MLE_VERSION);
                 rv = MLE_ERR;
                 break;
+            case 'x':
+                editor->script_path = optarg;
+                break;
             case 'y':
                 editor->syntax_override = optarg;
                 break;
@@ -1765,91 +2985,139 @@ static void _editor_init_bviews(editor_t* editor, int argc, char** argv) {
     }
 }
 
-// Manage async procs, giving priority to user input. Return 1 if drain should
-// be called again, else return 0.
-static int _editor_drain_async_procs(editor_t* editor) {
-    int maxfd;
-    fd_set readfds;
-    struct timeval timeout;
-    struct timeval now;
-    async_proc_t* aproc;
-    async_proc_t* aproc_tmp;
-    char buf[1024 + 1];
-    size_t nbytes;
-    int rc;
-    int is_done;
-
-    // Open tty if not already open
-    if (!editor->tty) {
-        if (!(editor->tty = fopen("/dev/tty", "r"))) {
-            // TODO error
-            return 0;
+// Init/deinit commands
+static int _editor_init_or_deinit_commands(editor_t* editor, int is_deinit) {
+    cmd_funcref_t* funcref;
+    cmd_funcref_t* tmp;
+    HASH_ITER(hh, editor->func_map, funcref, tmp) {
+        if (funcref->func_init) {
+            funcref->func_init(editor, funcref, is_deinit);
         }
-        editor->ttyfd = fileno(editor->tty);
-    }
-
-    // Set timeout to 1s
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
-
-    // Add tty to readfds
-    FD_ZERO(&readfds);
-    FD_SET(editor->ttyfd, &readfds);
-
-    // Add async procs to readfds
-    maxfd = editor->ttyfd;
-    DL_FOREACH(editor->async_procs, aproc) {
-        FD_SET(aproc->pipefd, &readfds);
-        if (aproc->pipefd > maxfd) maxfd = aproc->pipefd;
     }
+    return MLE_OK;
+}
 
-    // Perform select
-    rc = select(maxfd + 1, &readfds, NULL, NULL, &timeout);
-    gettimeofday(&now, NULL);
+// Parse script at path into a macro. Each line holds whitespace-separated
+// keys as in kbindings (e.g., C-r, enter, M-J), "quoted text" to type, or
+// @name to splice in the inputs of macro name. Lines starting with # are
+// comments.
+static int _editor_init_script(editor_t* editor, char* path, kmacro_t** ret_macro) {
+    FILE* fp;
+    kmacro_t* macro;
+    kmacro_t* sub;
+    kinput_t input;
+    char* line;
+    size_t line_size;
+    char* cur;
+    char* token;
+    uint32_t ch;
+    size_t i;
+    int linenum;
+    int rv;
 
-    if (rc < 0) {
-        return 0; // TODO Display errors
-    } else if (rc == 0) {
-        return 1; // Nothing to ready, call again
+    if (!util_is_file(path, "rb", &fp)) {
+        MLE_LOG_ERR("Could not open script: %s\n", path);
+        return MLE_ERR;
     }
-
-    if (FD_ISSET(editor->ttyfd, &readfds)) {
-        // Immediately give priority to user input
-        return 0;
-    } else {
-        // Read async procs
-        DL_FOREACH_SAFE(editor->async_procs, aproc, aproc_tmp) {
-            // Read and invoke callback
-            is_done = 0;
-            if (FD_ISSET(aproc->pipefd, &readfds)) {
-                nbytes = fread(&buf, sizeof(char), 1024, aproc->pipe);
-                if (nbytes > 0) {
-                    buf[nbytes] = '\0';
-                    aproc->callback(aproc, buf, nbytes, ferror(aproc->pipe), feof(aproc->pipe), 0);
+    macro = calloc(1, sizeof(kmacro_t));
+    macro->name = strdup(path);
+    line = NULL;
+    line_size = 0;
+    linenum = 0;
+    rv = MLE_OK;
+    while (rv == MLE_OK && getline(&line, &line_size, fp) != -1) {
+        linenum += 1;
+        cur = line;
+        while (*cur && isspace((unsigned char)*cur)) cur++;
+        if (*cur == '#') continue;
+        while (rv == MLE_OK && *cur) {
+            if (*cur == '"') {
+                // Type quoted text
+                cur++;
+                while (*cur && *cur != '"' && *cur != '\n') {
+                    if (*cur == '\\' && cur[1] && cur[1] != '\n') cur++;
+                    ch = 0;
+                    cur += MLE_MAX(1, utf8_char_to_unicode(&ch, cur, NULL));
+                    _editor_record_macro_input(macro, &(kinput_t){ 0, ch, 0 });
+                }
+                if (*cur == '"') {
+                    cur++;
+                } else {
+                    // Don't step past the end of the line
+                    MLE_LOG_ERR("%s:%d: Unterminated quote\n", path, linenum);
+                    rv = MLE_ERR;
+                }
+            } else {
+                token = cur;
+                while (*cur && !isspace((unsigned char)*cur)) cur++;
+                if (*cur) *cur++ = '\0';
+                if (*token == '@' && *(token + 1)) {
+                    // Splice in macro
+                    HASH_FIND_STR(editor->macro_map, token + 1, sub);
+                    if (!sub) {
+                        MLE_LOG_ERR("%s:%d: Macro not found: %s\n", path, linenum, token + 1);
+                        rv = MLE_ERR;
+                    } else {
+                        for (i = 0; i < sub->inputs_len; i++) {
+                            if (MLE_KINPUT_IS_PASTE(&sub->inputs[i]) && sub->inputs[i].ch < sub->pastes_len) {
+                                _editor_record_macro_paste(macro, sub->pastes[sub->inputs[i].ch], sub->paste_lens[sub->inputs[i].ch]);
+                            } else {
+                                _editor_record_macro_input(macro, &sub->inputs[i]);
+                            }
+                        }
+                    }
+                } else if (_editor_key_to_input(token, &input) == MLE_OK) {
+                    _editor_record_macro_input(macro, &input);
+                } else {
+                    MLE_LOG_ERR("%s:%d: Bad key: %s\n", path, linenum, token);
+                    rv = MLE_ERR;
                 }
-                is_done = ferror(aproc->pipe) || feof(aproc->pipe);
-            }
-
-            // Close and free if eof, error, or timeout
-            // TODO Alert user when timeout occurs
-            if (is_done || aproc->is_done || util_timeval_is_gt(&aproc->timeout, &now)) {
-                aproc->callback(aproc, NULL, 0, 0, 0, 1);
-                async_proc_destroy(aproc); // Calls DL_DELETE
             }
+            while (*cur && isspace((unsigned char)*cur)) cur++;
         }
     }
-
-    return 1;
+    if (line) free(line);
+    fclose(fp);
+    if (rv != MLE_OK) {
+        _editor_destroy_macro(macro);
+        return MLE_ERR;
+    }
+    *ret_macro = macro;
+    return MLE_OK;
 }
 
-// Init/deinit commands
-static int _editor_init_or_deinit_commands(editor_t* editor, int is_deinit) {
-    cmd_funcref_t* funcref;
-    cmd_funcref_t* tmp;
-    HASH_ITER(hh, editor->func_map, funcref, tmp) {
-        if (funcref->func_init) {
-            funcref->func_init(editor, funcref, is_deinit);
+// Open path, apply script to it with display disabled, and save modified
+// buffers
+static int _editor_run_script_file(editor_t* editor, kmacro_t* script, char* path) {
+    loop_context_t loop_ctx;
+    bview_t* bview;
+    int rv;
+
+    editor->is_display_disabled = 1;
+    editor_resize(editor, MLE_HEADLESS_DEFAULT_W, MLE_HEADLESS_DEFAULT_H);
+    if (editor_open_bview(editor, NULL, MLE_BVIEW_TYPE_EDIT, path, strlen(path), 1, 0, &editor->rect_edit, NULL, NULL) != MLE_OK) {
+        MLE_LOG_ERR("%s: Could not open\n", path);
+        return MLE_ERR;
+    }
+
+    // Run script
+    memset(&loop_ctx, 0, sizeof(loop_context_t));
+    editor->errstr[0] = '\0';
+    if (editor_apply_macro(editor, script, MLE_MACRO_REPEAT_COUNT, 1) == MLE_OK) {
+        _editor_loop(editor, &loop_ctx);
+    }
+    if (editor->errstr[0] != '\0') {
+        MLE_LOG_ERR("%s: %s\n", path, editor->errstr);
+    }
+
+    // Save modified buffers
+    rv = MLE_OK;
+    CDL_FOREACH2(editor->all_bviews, bview, all_next) {
+        if (!MLE_BVIEW_IS_EDIT(bview) || !bview->buffer->is_unsaved || !bview->buffer->path) continue;
+        if (buffer_save(bview->buffer) != MLBUF_OK) {
+            MLE_LOG_ERR("%s: Could not save\n", bview->buffer->path);
+            rv = MLE_ERR;
         }
     }
-    return MLE_OK;
+    return rv;
 }
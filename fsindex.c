@@ -0,0 +1,709 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "uthash.h"
+#include "mle.h"
+
+static void _fsindex_build(fsindex_t* self);
+static void _fsindex_clear(fsindex_t* self);
+static void _fsindex_refresh(fsindex_t* self);
+static void _fsindex_query(fsindex_t* self, char* query, size_t** ret_matches, size_t* ret_matches_len);
+static void* _fsindex_worker_run(void* arg);
+static void _fsindex_serve(fsindex_t* self);
+static void _fsindex_stream(fsindex_t* self);
+static void _fsindex_publish(fsindex_t* self, unsigned long seq, size_t* matches, size_t matches_len);
+static void _fsindex_timer_cb(editor_t* editor, void* udata);
+static void _fsindex_walk(fsindex_t* self, char* dir);
+static void _fsindex_watch(fsindex_t* self, char* dir);
+static void _fsindex_unwatch(fsindex_t* self, char* dir);
+static void _fsindex_add_path(fsindex_t* self, char* path);
+static void _fsindex_remove_paths(fsindex_t* self, char** files, size_t files_len, char** dirs, size_t dirs_len);
+static void _fsindex_compact(fsindex_t* self);
+static void* _fsindex_task_run(void* arg);
+static int _fsindex_score(char* path, size_t path_len, char* term, size_t term_len, int is_case_sensitive);
+static int _fsindex_match_cmp(const void* a, const void* b);
+static int _fsindex_str_cmp(const void* a, const void* b);
+
+// Index files under root, skipping dot files and dirs, and watch every dir
+// with inotify so changes apply without a rewalk. The walk, refreshes, and
+// queries run on a worker thread; only result text crosses to the editor.
+fsindex_t* fsindex_new(editor_t* editor, char* root) {
+    fsindex_t* self;
+    self = calloc(1, sizeof(fsindex_t));
+    self->editor = editor;
+    self->root = strdup(root);
+    self->inotify_fd = -1;
+    self->req_query = strdup("");
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    if (util_thread_create(&self->thread, _fsindex_worker_run, self) == 0) {
+        self->is_started = 1;
+    } else {
+        _fsindex_build(self); // Could not start thread; index inline
+    }
+    return self;
+}
+
+// Rank indexed paths against query and show them in invoker, best first, one
+// per line. Invoker keeps its lines until the results replace them; results
+// for an earlier query that haven't been shown yet are dropped. The empty
+// query lists paths in index order, streamed as the walk finds them.
+int fsindex_search(fsindex_t* self, char* query, bview_t* invoker) {
+    fsindex_set_invoker(self, invoker);
+    pthread_mutex_lock(&self->lock);
+    free(self->req_query);
+    self->req_query = strdup(query);
+    self->req_seq += 1;
+    self->text_len = 0;
+    self->text_lines = 0;
+    self->is_text_reset = 0;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    if (!self->is_started) _fsindex_serve(self); // No worker; answer inline
+    if (!self->timer) {
+        editor_add_timer(self->editor, MLE_FSEARCH_POLL_MS, _fsindex_timer_cb, self, &self->timer);
+    }
+    return MLE_OK;
+}
+
+// Set bview that results are appended to, or NULL to detach
+int fsindex_set_invoker(fsindex_t* self, bview_t* invoker) {
+    pthread_mutex_lock(&self->lock);
+    if (self->invoker && self->invoker->fsindex == self) {
+        self->invoker->fsindex = NULL;
+    }
+    self->invoker = invoker;
+    if (invoker) invoker->fsindex = self;
+    pthread_mutex_unlock(&self->lock);
+    return MLE_OK;
+}
+
+// Stop worker and free an fsindex_t
+int fsindex_destroy(fsindex_t* self) {
+    pthread_mutex_lock(&self->lock);
+    __atomic_store_n(&self->is_cancelled, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    if (self->is_started) pthread_join(self->thread, NULL);
+    if (self->timer) editor_remove_timer(self->editor, self->timer);
+    fsindex_set_invoker(self, NULL);
+    _fsindex_clear(self);
+    if (self->matches) free(self->matches);
+    if (self->query) free(self->query);
+    if (self->text) free(self->text);
+    free(self->req_query);
+    free(self->root);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+    return MLE_OK;
+}
+
+// Worker thread loop. Walk root, then answer queries until destroyed.
+static void* _fsindex_worker_run(void* arg) {
+    fsindex_t* self;
+    self = (fsindex_t*)arg;
+    _fsindex_build(self);
+    while (1) {
+        pthread_mutex_lock(&self->lock);
+        while (!self->is_cancelled && self->done_seq == self->req_seq) {
+            pthread_cond_wait(&self->cond, &self->lock);
+        }
+        pthread_mutex_unlock(&self->lock);
+        if (__atomic_load_n(&self->is_cancelled, __ATOMIC_RELAXED)) break;
+        _fsindex_serve(self);
+    }
+    return NULL;
+}
+
+// Bring the index up to date and answer the latest query
+static void _fsindex_serve(fsindex_t* self) {
+    unsigned long seq;
+    char* query;
+    size_t* matches;
+    size_t matches_len;
+
+    pthread_mutex_lock(&self->lock);
+    seq = self->req_seq;
+    query = strdup(self->req_query);
+    pthread_mutex_unlock(&self->lock);
+
+    _fsindex_refresh(self);
+    if (!*query && self->stream_seq == seq) {
+        _fsindex_stream(self); // Streamed while walking; send the rest
+    } else {
+        _fsindex_query(self, query, &matches, &matches_len);
+        _fsindex_publish(self, seq, matches, matches_len);
+    }
+
+    pthread_mutex_lock(&self->lock);
+    self->done_seq = seq;
+    pthread_mutex_unlock(&self->lock);
+    free(query);
+}
+
+// Apply queued inotify events to the index. If the event queue overflowed, or
+// some dir could not be watched and the index is older than
+// MLE_FSEARCH_STALE_MS, rebuild from scratch.
+static void _fsindex_refresh(fsindex_t* self) {
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event* event;
+    fsindex_watch_t* watch;
+    ssize_t nbytes;
+    char* off;
+    char* path;
+    char** files;
+    char** dirs;
+    char** adds;
+    int* adds_is_dir;
+    size_t files_len;
+    size_t dirs_len;
+    size_t adds_len;
+    size_t size;
+    size_t i;
+    int is_rebuild;
+    struct stat st;
+
+    if (self->is_unwatched && perf_now_us() - self->built_us >= (uint64_t)MLE_FSEARCH_STALE_MS * 1000) {
+        _fsindex_build(self);
+        return;
+    }
+
+    // Drain events. Every event removes its path (creates too, so a replaced
+    // file is not listed twice); creates and moves-in are re-added after.
+    files = dirs = adds = NULL;
+    adds_is_dir = NULL;
+    files_len = dirs_len = adds_len = size = 0;
+    is_rebuild = 0;
+    while (!is_rebuild && (nbytes = read(self->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (off = buf; off < buf + nbytes; off += sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event*)off;
+            if (event->mask & IN_Q_OVERFLOW) {
+                is_rebuild = 1;
+                break;
+            }
+            HASH_FIND_INT(self->watches, &event->wd, watch);
+            if (!watch) continue;
+            if (event->mask & IN_IGNORED) {
+                HASH_DEL(self->watches, watch);
+                free(watch->dir);
+                free(watch);
+                continue;
+            }
+            if (event->len < 1 || event->name[0] == '\0' || event->name[0] == '.') continue;
+            if (*watch->dir) {
+                asprintf(&path, "%s/%s", watch->dir, event->name);
+            } else {
+                path = strdup(event->name);
+            }
+            if (files_len + dirs_len + adds_len + 3 > size) {
+                size = size ? size * 2 : 64;
+                files = realloc(files, sizeof(char*) * size);
+                dirs = realloc(dirs, sizeof(char*) * size);
+                adds = realloc(adds, sizeof(char*) * size);
+                adds_is_dir = realloc(adds_is_dir, sizeof(int) * size);
+            }
+            if (event->mask & IN_ISDIR) {
+                dirs[dirs_len++] = strdup(path);
+                // A moved dir keeps its watches; drop them so events from
+                // outside root (or under a stale name) aren't indexed. A
+                // move within root re-watches the dir when it's re-added.
+                if (event->mask & IN_MOVED_FROM) _fsindex_unwatch(self, path);
+            } else {
+                files[files_len++] = strdup(path);
+            }
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                adds_is_dir[adds_len] = event->mask & IN_ISDIR ? 1 : 0;
+                adds[adds_len++] = strdup(path);
+            }
+            free(path);
+        }
+    }
+
+    if (is_rebuild) {
+        _fsindex_build(self);
+    } else if (files_len > 0 || dirs_len > 0) {
+        // Remove in one pass, then add what still exists
+        _fsindex_remove_paths(self, files, files_len, dirs, dirs_len);
+        for (i = 0; i < adds_len; i++) {
+            asprintf(&path, "%s/%s", self->root, adds[i]);
+            if (lstat(path, &st) == 0) {
+                if (adds_is_dir[i] && S_ISDIR(st.st_mode)) {
+                    _fsindex_walk(self, adds[i]);
+                } else if (!adds_is_dir[i]) {
+                    _fsindex_add_path(self, adds[i]);
+                }
+            }
+            free(path);
+        }
+        if (self->paths_removed > self->paths_len / 2) _fsindex_compact(self);
+        self->gen += 1;
+    }
+
+    for (i = 0; i < files_len; i++) free(files[i]);
+    for (i = 0; i < dirs_len; i++) free(dirs[i]);
+    for (i = 0; i < adds_len; i++) free(adds[i]);
+    if (files) free(files);
+    if (dirs) free(dirs);
+    if (adds) free(adds);
+    if (adds_is_dir) free(adds_is_dir);
+}
+
+// Fuzzy match query against indexed paths. Query is split on spaces into
+// terms that must all match, and is case-sensitive only if it has uppercase.
+// If query extends the last query, only the last matches are scored. Scoring
+// is split across threads. Set ret_matches to path indices, best first; it is
+// owned by self and valid until the next query.
+static void _fsindex_query(fsindex_t* self, char* query, size_t** ret_matches, size_t* ret_matches_len) {
+    fsindex_task_t tasks[MLE_FSEARCH_MAX_THREADS];
+    pthread_t threads[MLE_FSEARCH_MAX_THREADS];
+    fsindex_match_t* matches;
+    size_t matches_len;
+    size_t* cands;
+    size_t cands_len;
+    char* query_dup;
+    char* term;
+    char* saveptr;
+    char** terms;
+    int terms_len;
+    int is_case_sensitive;
+    int nthreads;
+    size_t per_thread;
+    size_t i;
+    int t;
+
+    // Pick candidates: narrow last matches if query extends last query
+    if (self->query
+        && self->matches_gen == self->gen
+        && strncmp(query, self->query, strlen(self->query)) == 0
+    ) {
+        cands = self->matches;
+        cands_len = self->matches_len;
+    } else {
+        cands = malloc(sizeof(size_t) * MLE_MAX(1, self->paths_len));
+        cands_len = 0;
+        for (i = 0; i < self->paths_len; i++) {
+            if (self->paths[i]) cands[cands_len++] = i;
+        }
+    }
+
+    // Split query into terms
+    query_dup = strdup(query);
+    terms = malloc(sizeof(char*) * (strlen(query) / 2 + 1));
+    terms_len = 0;
+    is_case_sensitive = 0;
+    for (term = strtok_r(query_dup, " ", &saveptr); term; term = strtok_r(NULL, " ", &saveptr)) {
+        terms[terms_len++] = term;
+    }
+    for (i = 0; query[i]; i++) {
+        if (isupper((unsigned char)query[i])) is_case_sensitive = 1;
+    }
+
+    // Score in parallel
+    nthreads = MLE_MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    nthreads = MLE_MIN(nthreads, MLE_FSEARCH_MAX_THREADS);
+    nthreads = (int)MLE_MIN((size_t)nthreads, cands_len / MLE_FSEARCH_TASK_MIN + 1);
+    per_thread = (cands_len + nthreads - 1) / nthreads;
+    for (t = 0; t < nthreads; t++) {
+        tasks[t].fsindex = self;
+        tasks[t].cands = cands + MLE_MIN(cands_len, per_thread * t);
+        tasks[t].cands_len = MLE_MIN(cands_len, per_thread * (t + 1)) - MLE_MIN(cands_len, per_thread * t);
+        tasks[t].terms = terms;
+        tasks[t].terms_len = terms_len;
+        tasks[t].is_case_sensitive = is_case_sensitive;
+        tasks[t].matches = NULL;
+        tasks[t].matches_len = 0;
+        if (t > 0 && util_thread_create(&threads[t], _fsindex_task_run, &tasks[t]) != 0) {
+            threads[t] = 0;
+            _fsindex_task_run(&tasks[t]); // Could not start thread; run inline
+        }
+    }
+    _fsindex_task_run(&tasks[0]);
+    for (t = 1; t < nthreads; t++) {
+        if (threads[t]) pthread_join(threads[t], NULL);
+    }
+
+    // Merge and rank. Empty query keeps index order.
+    matches_len = 0;
+    for (t = 0; t < nthreads; t++) matches_len += tasks[t].matches_len;
+    matches = malloc(sizeof(fsindex_match_t) * MLE_MAX(1, matches_len));
+    matches_len = 0;
+    for (t = 0; t < nthreads; t++) {
+        memcpy(matches + matches_len, tasks[t].matches, sizeof(fsindex_match_t) * tasks[t].matches_len);
+        matches_len += tasks[t].matches_len;
+        free(tasks[t].matches);
+    }
+    if (terms_len > 0) {
+        qsort(matches, matches_len, sizeof(fsindex_match_t), _fsindex_match_cmp);
+    }
+
+    // Remember for narrowing
+    if (cands != self->matches) free(cands);
+    self->matches = realloc(self->matches, sizeof(size_t) * MLE_MAX(1, matches_len));
+    for (i = 0; i < matches_len; i++) self->matches[i] = matches[i].index;
+    self->matches_len = matches_len;
+    self->matches_gen = self->gen;
+    if (self->query) free(self->query);
+    self->query = strdup(query);
+
+    free(matches);
+    free(terms);
+    free(query_dup);
+    *ret_matches = self->matches;
+    *ret_matches_len = self->matches_len;
+}
+
+// Queue paths walked so far for the invoker if the latest query is empty and
+// still unanswered, so a long first walk shows results as it goes
+static void _fsindex_stream(fsindex_t* self) {
+    char* path;
+    size_t path_len;
+    pthread_mutex_lock(&self->lock);
+    if (self->req_query[0] != '\0' || self->done_seq == self->req_seq) {
+        pthread_mutex_unlock(&self->lock);
+        return;
+    }
+    if (self->stream_seq != self->req_seq) {
+        self->stream_seq = self->req_seq;
+        self->stream_off = 0;
+        self->text_len = 0;
+        self->text_lines = 0;
+        self->is_text_reset = 1;
+    }
+    for (; self->stream_off < self->paths_len && self->text_lines < MLE_FSEARCH_MAX_RESULTS; self->stream_off++) {
+        if (!(path = self->paths[self->stream_off])) continue;
+        path_len = strlen(path);
+        if (self->text_len + path_len + 1 > self->text_size) {
+            self->text_size = MLE_MAX(self->text_size * 2, self->text_len + path_len + 1);
+            self->text = realloc(self->text, self->text_size);
+        }
+        memcpy(self->text + self->text_len, path, path_len);
+        self->text_len += path_len;
+        self->text[self->text_len++] = '\n';
+        self->text_lines += 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+// Queue matched paths for the invoker unless a newer query came in
+static void _fsindex_publish(fsindex_t* self, unsigned long seq, size_t* matches, size_t matches_len) {
+    char* data;
+    char* path;
+    size_t data_len;
+    size_t path_len;
+    size_t i;
+
+    // Join outside the lock
+    matches_len = MLE_MIN(matches_len, MLE_FSEARCH_MAX_RESULTS);
+    data_len = 0;
+    for (i = 0; i < matches_len; i++) data_len += strlen(self->paths[matches[i]]) + 1;
+    data = malloc(MLE_MAX(1, data_len));
+    data_len = 0;
+    for (i = 0; i < matches_len; i++) {
+        path = self->paths[matches[i]];
+        path_len = strlen(path);
+        memcpy(data + data_len, path, path_len);
+        data_len += path_len;
+        data[data_len++] = '\n';
+    }
+
+    pthread_mutex_lock(&self->lock);
+    if (seq == self->req_seq) {
+        if (self->text) free(self->text);
+        self->text = data;
+        self->text_len = data_len;
+        self->text_size = MLE_MAX(1, data_len);
+        self->text_lines = matches_len;
+        self->is_text_reset = 1;
+        data = NULL;
+    }
+    pthread_mutex_unlock(&self->lock);
+    if (data) free(data);
+}
+
+// Timer callback that shows queued lines in invoker
+static void _fsindex_timer_cb(editor_t* editor, void* udata) {
+    fsindex_t* self;
+    int is_idle;
+    self = (fsindex_t*)udata;
+    self->timer = NULL; // Freed by caller
+    pthread_mutex_lock(&self->lock);
+    if (self->invoker && self->is_text_reset) {
+        buffer_set(self->invoker->buffer, "", 0);
+        bview_discard_appends(self->invoker);
+        self->is_text_reset = 0;
+    }
+    if (self->invoker && self->text_len > 0) {
+        bview_append(self->invoker, self->text, self->text_len);
+        self->text_len = 0;
+    }
+    is_idle = self->done_seq == self->req_seq ? 1 : 0;
+    pthread_mutex_unlock(&self->lock);
+    if (!is_idle) {
+        editor_add_timer(editor, MLE_FSEARCH_POLL_MS, _fsindex_timer_cb, self, &self->timer);
+    }
+}
+
+// Drop everything and walk root again
+static void _fsindex_build(fsindex_t* self) {
+    _fsindex_clear(self);
+    self->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    self->is_unwatched = self->inotify_fd < 0 ? 1 : 0;
+    _fsindex_walk(self, "");
+    self->built_us = perf_now_us();
+    self->gen += 1;
+}
+
+// Free paths and watches and close inotify fd
+static void _fsindex_clear(fsindex_t* self) {
+    fsindex_watch_t* watch;
+    fsindex_watch_t* watch_tmp;
+    size_t i;
+    for (i = 0; i < self->paths_len; i++) {
+        if (self->paths[i]) free(self->paths[i]);
+    }
+    if (self->paths) free(self->paths);
+    self->paths = NULL;
+    self->paths_len = 0;
+    self->paths_size = 0;
+    self->paths_removed = 0;
+    self->stream_seq = 0; // Restart any stream
+    HASH_ITER(hh, self->watches, watch, watch_tmp) {
+        HASH_DEL(self->watches, watch);
+        free(watch->dir);
+        free(watch);
+    }
+    if (self->inotify_fd >= 0) close(self->inotify_fd);
+    self->inotify_fd = -1;
+}
+
+// Add files under dir (relative to root, "" for root) and watch dirs
+static void _fsindex_walk(fsindex_t* self, char* dir) {
+    DIR* dirp;
+    struct dirent* ent;
+    struct stat st;
+    char* full;
+    char* path;
+    int is_dir;
+
+    asprintf(&full, "%s%s%s", self->root, *dir ? "/" : "", dir);
+    dirp = opendir(full);
+    free(full);
+    if (!dirp) return;
+    _fsindex_watch(self, dir);
+    while ((ent = readdir(dirp)) != NULL) {
+        if (__atomic_load_n(&self->is_cancelled, __ATOMIC_RELAXED)) break;
+        if (ent->d_name[0] == '.') continue;
+        if (*dir) {
+            asprintf(&path, "%s/%s", dir, ent->d_name);
+        } else {
+            path = strdup(ent->d_name);
+        }
+        if (ent->d_type == DT_UNKNOWN) {
+            asprintf(&full, "%s/%s", self->root, path);
+            is_dir = lstat(full, &st) == 0 && S_ISDIR(st.st_mode) ? 1 : 0;
+            free(full);
+        } else {
+            is_dir = ent->d_type == DT_DIR ? 1 : 0;
+        }
+        if (is_dir) {
+            _fsindex_walk(self, path);
+        } else {
+            _fsindex_add_path(self, path);
+        }
+        free(path);
+    }
+    closedir(dirp);
+}
+
+// Watch dir for changes
+static void _fsindex_watch(fsindex_t* self, char* dir) {
+    fsindex_watch_t* watch;
+    char* full;
+    int wd;
+    if (self->is_unwatched) return;
+    asprintf(&full, "%s%s%s", self->root, *dir ? "/" : "", dir);
+    wd = inotify_add_watch(self->inotify_fd, full, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW);
+    free(full);
+    if (wd < 0) {
+        self->is_unwatched = 1; // E.g., out of watches
+        return;
+    }
+    HASH_FIND_INT(self->watches, &wd, watch);
+    if (watch) {
+        free(watch->dir); // Same dir seen again, e.g., via rename
+    } else {
+        watch = calloc(1, sizeof(fsindex_watch_t));
+        watch->wd = wd;
+        HASH_ADD_INT(self->watches, wd, watch);
+    }
+    watch->dir = strdup(dir);
+}
+
+// Stop watching dir and every dir under it
+static void _fsindex_unwatch(fsindex_t* self, char* dir) {
+    fsindex_watch_t* watch;
+    fsindex_watch_t* watch_tmp;
+    size_t dir_len;
+    dir_len = strlen(dir);
+    HASH_ITER(hh, self->watches, watch, watch_tmp) {
+        if (strncmp(watch->dir, dir, dir_len) != 0) continue;
+        if (watch->dir[dir_len] != '\0' && watch->dir[dir_len] != '/') continue;
+        inotify_rm_watch(self->inotify_fd, watch->wd);
+        HASH_DEL(self->watches, watch);
+        free(watch->dir);
+        free(watch);
+    }
+}
+
+// Append path
+static void _fsindex_add_path(fsindex_t* self, char* path) {
+    if (self->paths_len + 1 > self->paths_size) {
+        self->paths_size = self->paths_size ? self->paths_size * 2 : 1024;
+        self->paths = realloc(self->paths, sizeof(char*) * self->paths_size);
+    }
+    self->paths[self->paths_len++] = strdup(path);
+    if (self->paths_len % MLE_FSEARCH_STREAM_EVERY == 0) _fsindex_stream(self);
+}
+
+// Remove files and everything under dirs in one pass over paths
+static void _fsindex_remove_paths(fsindex_t* self, char** files, size_t files_len, char** dirs, size_t dirs_len) {
+    size_t i;
+    size_t j;
+    size_t dir_len;
+    char* path;
+    int is_removed;
+    qsort(files, files_len, sizeof(char*), _fsindex_str_cmp);
+    for (i = 0; i < self->paths_len; i++) {
+        if (!(path = self->paths[i])) continue;
+        is_removed = files_len > 0 && bsearch(&path, files, files_len, sizeof(char*), _fsindex_str_cmp) ? 1 : 0;
+        for (j = 0; !is_removed && j < dirs_len; j++) {
+            dir_len = strlen(dirs[j]);
+            if (strncmp(path, dirs[j], dir_len) == 0 && path[dir_len] == '/') is_removed = 1;
+        }
+        if (is_removed) {
+            free(path);
+            self->paths[i] = NULL;
+            self->paths_removed += 1;
+            self->stream_seq = 0; // Restart any stream
+        }
+    }
+}
+
+// Drop removed paths from the array
+static void _fsindex_compact(fsindex_t* self) {
+    size_t i;
+    size_t j;
+    for (i = 0, j = 0; i < self->paths_len; i++) {
+        if (self->paths[i]) self->paths[j++] = self->paths[i];
+    }
+    self->paths_len = j;
+    self->paths_removed = 0;
+}
+
+// Score a slice of candidates (thread entry point)
+static void* _fsindex_task_run(void* arg) {
+    fsindex_task_t* task;
+    char* path;
+    size_t path_len;
+    size_t i;
+    int score;
+    int term_score;
+    int t;
+    task = (fsindex_task_t*)arg;
+    task->matches = malloc(sizeof(fsindex_match_t) * MLE_MAX(1, task->cands_len));
+    for (i = 0; i < task->cands_len; i++) {
+        if (!(path = task->fsindex->paths[task->cands[i]])) continue;
+        path_len = strlen(path);
+        score = 0;
+        for (t = 0; t < task->terms_len; t++) {
+            term_score = _fsindex_score(path, path_len, task->terms[t], strlen(task->terms[t]), task->is_case_sensitive);
+            if (term_score == INT_MIN) break;
+            score += term_score;
+        }
+        if (t < task->terms_len) continue;
+        task->matches[task->matches_len].index = task->cands[i];
+        task->matches[task->matches_len].path_len = path_len;
+        task->matches[task->matches_len].score = score;
+        task->matches_len += 1;
+    }
+    return NULL;
+}
+
+// Return fuzzy score of term in path, or INT_MIN if term is not a
+// subsequence of path. Finds the leftmost match end, then the shortest window
+// ending there, and rewards matches at word starts, in the basename, and in
+// runs; gaps cost a point each.
+static int _fsindex_score(char* path, size_t path_len, char* term, size_t term_len, int is_case_sensitive) {
+    #define MLE_FSINDEX_EQ(a, b) (is_case_sensitive ? (a) == (b) : tolower((unsigned char)(a)) == tolower((unsigned char)(b)))
+    size_t pi;
+    size_t ti;
+    size_t start;
+    size_t end;
+    size_t basename;
+    char* slash;
+    int score;
+    int is_run;
+
+    // Find leftmost end of match
+    for (pi = 0, ti = 0; pi < path_len && ti < term_len; pi++) {
+        if (MLE_FSINDEX_EQ(path[pi], term[ti])) ti += 1;
+    }
+    if (ti < term_len) return INT_MIN;
+    end = pi;
+
+    // Walk back to shortest window ending there
+    for (pi = end, ti = term_len; pi > 0 && ti > 0; ) {
+        pi -= 1;
+        if (MLE_FSINDEX_EQ(path[pi], term[ti - 1])) ti -= 1;
+    }
+    start = pi;
+
+    // Score window
+    slash = strrchr(path, '/');
+    basename = slash ? (size_t)(slash - path) + 1 : 0;
+    score = 0;
+    is_run = 0;
+    for (pi = start, ti = 0; pi < end && ti < term_len; pi++) {
+        if (MLE_FSINDEX_EQ(path[pi], term[ti])) {
+            score += 16;
+            if (pi == 0 || strchr("/_-. ", path[pi - 1])) {
+                score += 8; // Word start
+            } else if (islower((unsigned char)path[pi - 1]) && isupper((unsigned char)path[pi])) {
+                score += 7; // camelCase hump
+            }
+            if (is_run) score += 4;
+            if (pi >= basename) score += 2;
+            is_run = 1;
+            ti += 1;
+        } else {
+            score -= 1;
+            is_run = 0;
+        }
+    }
+    return score;
+    #undef MLE_FSINDEX_EQ
+}
+
+// qsort comparator for matches: best score, then shortest path, then index
+static int _fsindex_match_cmp(const void* a, const void* b) {
+    fsindex_match_t* ma;
+    fsindex_match_t* mb;
+    ma = (fsindex_match_t*)a;
+    mb = (fsindex_match_t*)b;
+    if (ma->score != mb->score) return ma->score > mb->score ? -1 : 1;
+    if (ma->path_len != mb->path_len) return ma->path_len < mb->path_len ? -1 : 1;
+    return ma->index < mb->index ? -1 : (ma->index > mb->index ? 1 : 0);
+}
+
+// qsort/bsearch comparator for char* arrays
+static int _fsindex_str_cmp(const void* a, const void* b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
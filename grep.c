@@ -0,0 +1,534 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utlist.h"
+#include "mle.h"
+
+static void* _grep_worker_run(void* arg);
+static int _grep_worker_pop(grep_worker_t* worker, grep_item_t* ret_item);
+static int _grep_worker_steal(grep_worker_t* worker, grep_item_t* ret_item);
+static void _grep_push(grep_worker_t* worker, grep_item_t* items, size_t items_len);
+static void _grep_item_done(grep_t* self);
+static void _grep_dir(grep_worker_t* worker, grep_item_t* item);
+static void _grep_file(grep_worker_t* worker, grep_item_t* item);
+static grep_ignore_t* _grep_read_ignore(grep_t* self, char* dir, grep_ignore_t* parent);
+static int _grep_is_ignored(grep_ignore_t* ignore, char* path, int is_dir);
+static void _grep_add_result(grep_worker_t* worker, char* path, bint_t linenum, bint_t col, char* line, size_t line_len);
+static void _grep_publish(grep_worker_t* worker);
+static void _grep_timer_cb(editor_t* editor, void* udata);
+static char* _grep_join(char* dir, char* name);
+
+// Start grepping files under root for pattern (PCRE, caseless) on a pool of
+// threads. Each thread walks dirs and greps files from its own deque and
+// steals from others when empty. Matching lines are queued for the invoker
+// and appended every MLE_GREP_POLL_MS. Return NULL if pattern is invalid.
+grep_t* grep_new(editor_t* editor, char* pattern, char* root) {
+    grep_t* self;
+    grep_item_t item;
+    const char* error;
+    int erroffset;
+    int i;
+
+    self = calloc(1, sizeof(grep_t));
+    self->editor = editor;
+    self->cre = pcre_compile((const char*)pattern, PCRE_CASELESS | PCRE_MULTILINE, &error, &erroffset, NULL);
+    if (!self->cre) {
+        MLE_SET_ERR(editor, "grep: %s at offset %d", error, erroffset);
+        free(self);
+        return NULL;
+    }
+    #ifdef PCRE_STUDY_JIT_COMPILE
+    self->cre_extra = pcre_study(self->cre, PCRE_STUDY_JIT_COMPILE, &error);
+    #else
+    self->cre_extra = pcre_study(self->cre, 0, &error);
+    #endif
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cond, NULL);
+
+    // Make workers and seed first with root
+    self->workers_len = MLE_MAX(1, MLE_MIN((int)sysconf(_SC_NPROCESSORS_ONLN), MLE_GREP_MAX_THREADS));
+    self->workers = calloc(self->workers_len, sizeof(grep_worker_t));
+    for (i = 0; i < self->workers_len; i++) {
+        self->workers[i].grep = self;
+        pthread_mutex_init(&self->workers[i].lock, NULL);
+    }
+    item.path = strdup(root);
+    item.is_dir = 1;
+    item.ignore = NULL;
+    _grep_push(&self->workers[0], &item, 1);
+
+    // Start threads with signals blocked so they stay on the editor thread
+    for (i = 0; i < self->workers_len; i++) {
+        if (util_thread_create(&self->workers[i].thread, _grep_worker_run, &self->workers[i]) == 0) {
+            self->workers[i].is_started = 1;
+        }
+    }
+    if (!self->workers[0].is_started) {
+        _grep_worker_run(&self->workers[0]); // Could not start thread; grep inline
+    }
+    editor_add_timer(editor, MLE_GREP_POLL_MS, _grep_timer_cb, self, &self->timer);
+    return self;
+}
+
+// Set bview that results are appended to
+int grep_set_invoker(grep_t* self, bview_t* invoker) {
+    pthread_mutex_lock(&self->lock);
+    self->invoker = invoker;
+    invoker->grep = self;
+    pthread_mutex_unlock(&self->lock);
+    return MLE_OK;
+}
+
+// Return result shown on line index of invoker, or NULL if none
+grep_result_t* grep_get_result(grep_t* self, size_t index) {
+    grep_result_t* result;
+    pthread_mutex_lock(&self->lock);
+    result = index < self->results_len ? self->results[index] : NULL;
+    pthread_mutex_unlock(&self->lock);
+    return result;
+}
+
+// Stop workers and free a grep_t
+int grep_destroy(grep_t* self) {
+    grep_worker_t* worker;
+    grep_ignore_t* ignore;
+    grep_ignore_t* ignore_tmp;
+    size_t i;
+    int w;
+
+    // Stop workers
+    pthread_mutex_lock(&self->lock);
+    __atomic_store_n(&self->is_cancelled, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    for (w = 0; w < self->workers_len; w++) {
+        worker = &self->workers[w];
+        if (worker->is_started) pthread_join(worker->thread, NULL);
+        for (i = worker->items_head; i < worker->items_len; i++) {
+            free(worker->items[i].path);
+        }
+        if (worker->items) free(worker->items);
+        for (i = 0; i < worker->batch_results_len; i++) {
+            free(worker->batch_results[i]->path); // Cancelled mid-file
+            free(worker->batch_results[i]);
+        }
+        if (worker->batch_results) free(worker->batch_results);
+        if (worker->batch_text) free(worker->batch_text);
+        pthread_mutex_destroy(&worker->lock);
+    }
+    free(self->workers);
+
+    if (self->timer) editor_remove_timer(self->editor, self->timer);
+    if (self->invoker && self->invoker->grep == self) {
+        self->invoker->grep = NULL;
+    }
+    LL_FOREACH_SAFE2(self->ignores, ignore, ignore_tmp, all_next) {
+        free(ignore->dir);
+        free(ignore->pattern);
+        free(ignore);
+    }
+    for (i = 0; i < self->results_len; i++) {
+        free(self->results[i]->path);
+        free(self->results[i]);
+    }
+    if (self->results) free(self->results);
+    if (self->text) free(self->text);
+    #ifdef PCRE_STUDY_JIT_COMPILE
+    if (self->cre_extra) pcre_free_study(self->cre_extra);
+    #else
+    if (self->cre_extra) pcre_free(self->cre_extra);
+    #endif
+    pcre_free(self->cre);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+    return MLE_OK;
+}
+
+// Worker thread loop. Take items until every pushed item is done.
+static void* _grep_worker_run(void* arg) {
+    grep_worker_t* worker;
+    grep_t* self;
+    grep_item_t item;
+    unsigned long work_gen;
+    int is_over;
+
+    worker = (grep_worker_t*)arg;
+    self = worker->grep;
+    while (!__atomic_load_n(&self->is_cancelled, __ATOMIC_RELAXED)) {
+        work_gen = __atomic_load_n(&self->work_gen, __ATOMIC_ACQUIRE);
+        if (_grep_worker_pop(worker, &item) || _grep_worker_steal(worker, &item)) {
+            if (item.is_dir) {
+                _grep_dir(worker, &item);
+            } else {
+                _grep_file(worker, &item);
+            }
+            free(item.path);
+            _grep_item_done(self);
+            continue;
+        }
+
+        // Nothing to take; wait for a push or the end
+        pthread_mutex_lock(&self->lock);
+        while (!self->is_done && !self->is_cancelled && self->work_gen == work_gen) {
+            pthread_cond_wait(&self->cond, &self->lock);
+        }
+        is_over = self->is_done || self->is_cancelled;
+        pthread_mutex_unlock(&self->lock);
+        if (is_over) break;
+    }
+    return NULL;
+}
+
+// Pop newest item from own deque. Return 1 if popped.
+static int _grep_worker_pop(grep_worker_t* worker, grep_item_t* ret_item) {
+    int rc;
+    pthread_mutex_lock(&worker->lock);
+    rc = 0;
+    if (worker->items_len > worker->items_head) {
+        *ret_item = worker->items[--worker->items_len];
+        rc = 1;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return rc;
+}
+
+// Take oldest item from another worker's deque. Return 1 if taken.
+static int _grep_worker_steal(grep_worker_t* worker, grep_item_t* ret_item) {
+    grep_t* self;
+    grep_worker_t* victim;
+    int rc;
+    int i;
+    self = worker->grep;
+    rc = 0;
+    for (i = 1; !rc && i < self->workers_len; i++) {
+        victim = &self->workers[((worker - self->workers) + i) % self->workers_len];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->items_len > victim->items_head) {
+            *ret_item = victim->items[victim->items_head++];
+            rc = 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return rc;
+}
+
+// Push items onto worker's deque and wake idle workers
+static void _grep_push(grep_worker_t* worker, grep_item_t* items, size_t items_len) {
+    grep_t* self;
+    size_t live;
+    self = worker->grep;
+    if (items_len < 1) return;
+    __atomic_add_fetch(&self->pending, items_len, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&worker->lock);
+    if (worker->items_len + items_len > worker->items_size) {
+        // Slide live items to front, then grow if still short
+        live = worker->items_len - worker->items_head;
+        if (live > 0) memmove(worker->items, worker->items + worker->items_head, sizeof(grep_item_t) * live);
+        worker->items_head = 0;
+        worker->items_len = live;
+        if (live + items_len > worker->items_size) {
+            worker->items_size = MLE_MAX(worker->items_size * 2, live + items_len);
+            worker->items = realloc(worker->items, sizeof(grep_item_t) * worker->items_size);
+        }
+    }
+    memcpy(worker->items + worker->items_len, items, sizeof(grep_item_t) * items_len);
+    worker->items_len += items_len;
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_mutex_lock(&self->lock);
+    __atomic_add_fetch(&self->work_gen, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+}
+
+// Mark an item done. The last one ends the grep.
+static void _grep_item_done(grep_t* self) {
+    if (__atomic_sub_fetch(&self->pending, 1, __ATOMIC_ACQ_REL) > 0) return;
+    pthread_mutex_lock(&self->lock);
+    self->is_done = 1;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+}
+
+// Push entries of a dir, skipping VCS dirs, symlinks, and ignored paths
+static void _grep_dir(grep_worker_t* worker, grep_item_t* item) {
+    grep_t* self;
+    DIR* dirp;
+    struct dirent* ent;
+    struct stat st;
+    grep_item_t* children;
+    size_t children_len;
+    size_t children_size;
+    grep_ignore_t* ignore;
+    char* path;
+    int is_dir;
+
+    self = worker->grep;
+    if (!(dirp = opendir(item->path))) return;
+    ignore = _grep_read_ignore(self, item->path, item->ignore);
+    children = NULL;
+    children_len = 0;
+    children_size = 0;
+    while ((ent = readdir(dirp)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0
+            || strcmp(ent->d_name, "..") == 0
+            || strcmp(ent->d_name, ".git") == 0
+            || strcmp(ent->d_name, ".hg") == 0
+            || strcmp(ent->d_name, ".svn") == 0
+        ) {
+            continue;
+        }
+        path = _grep_join(item->path, ent->d_name);
+        if (ent->d_type == DT_UNKNOWN) {
+            if (lstat(path, &st) != 0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
+                free(path);
+                continue;
+            }
+            is_dir = S_ISDIR(st.st_mode) ? 1 : 0;
+        } else if (ent->d_type == DT_DIR || ent->d_type == DT_REG) {
+            is_dir = ent->d_type == DT_DIR ? 1 : 0;
+        } else {
+            free(path); // Like grep -r, do not follow symlinks
+            continue;
+        }
+        if (_grep_is_ignored(ignore, path, is_dir)) {
+            free(path);
+            continue;
+        }
+        if (children_len + 1 > children_size) {
+            children_size = children_size ? children_size * 2 : 64;
+            children = realloc(children, sizeof(grep_item_t) * children_size);
+        }
+        children[children_len].path = path;
+        children[children_len].is_dir = is_dir;
+        children[children_len].ignore = ignore;
+        children_len += 1;
+    }
+    closedir(dirp);
+    _grep_push(worker, children, children_len);
+    if (children) free(children);
+}
+
+// Grep a file via mmap. Skip files with a NUL in the first
+// MLE_GREP_BINARY_PEEK bytes, like grep -I.
+static void _grep_file(grep_worker_t* worker, grep_item_t* item) {
+    grep_t* self;
+    struct stat st;
+    char* data;
+    char* line;
+    char* line_end;
+    char* scan;
+    size_t size;
+    bint_t linenum;
+    bint_t col;
+    int ovector[3];
+    int fd;
+    int rc;
+    char* c;
+
+    self = worker->grep;
+    if ((fd = open(item->path, O_RDONLY | O_CLOEXEC | O_NOCTTY)) < 0) return;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 1 || st.st_size > INT_MAX) {
+        close(fd);
+        return;
+    }
+    size = (size_t)st.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return;
+    madvise(data, size, MADV_SEQUENTIAL);
+    if (memchr(data, '\0', MLE_MIN(size, MLE_GREP_BINARY_PEEK))) {
+        munmap(data, size);
+        return;
+    }
+
+    // Find next match in whole file, then confirm it within its line so that
+    // matches spanning lines do not count
+    linenum = 1;
+    scan = data;
+    while (scan < data + size && !__atomic_load_n(&self->is_cancelled, __ATOMIC_RELAXED)) {
+        rc = pcre_exec(self->cre, self->cre_extra, data, (int)size, (int)(scan - data), 0, ovector, 3);
+        if (rc < 0) break;
+        if ((size_t)ovector[0] >= size && data[size - 1] == '\n') break; // Empty match past last line
+        line = data + ovector[0];
+        while (line > scan && *(line - 1) != '\n') line -= 1;
+        for (c = scan; (c = memchr(c, '\n', line - c)) != NULL; c++) linenum += 1;
+        line_end = memchr(line, '\n', (data + size) - line);
+        if (!line_end) line_end = data + size;
+        if (ovector[1] > line_end - data) {
+            rc = pcre_exec(self->cre, self->cre_extra, line, (int)(line_end - line), 0, 0, ovector, 3);
+            ovector[0] += (int)(line - data);
+        }
+        if (rc >= 0) {
+            for (col = 0, c = line; c < data + ovector[0]; c++) {
+                if ((*c & 0xc0) != 0x80) col += 1; // Count utf8 lead bytes
+            }
+            _grep_add_result(worker, item->path, linenum, col, line, line_end - line);
+        }
+        scan = line_end + 1;
+        linenum += 1;
+    }
+    munmap(data, size);
+    _grep_publish(worker);
+}
+
+// Read .gitignore and .ignore in dir. Return patterns in effect for dir.
+// Negated patterns are not supported and are skipped.
+static grep_ignore_t* _grep_read_ignore(grep_t* self, char* dir, grep_ignore_t* parent) {
+    static char* names[] = { ".gitignore", ".ignore", NULL };
+    grep_ignore_t* ignore;
+    FILE* fp;
+    char line[PATH_MAX + 1];
+    char* path;
+    char* pattern;
+    size_t len;
+    int i;
+
+    for (i = 0; names[i]; i++) {
+        path = _grep_join(dir, names[i]);
+        fp = fopen(path, "r");
+        free(path);
+        if (!fp) continue;
+        while (fgets(line, sizeof(line), fp)) {
+            len = strcspn(line, "\r\n");
+            while (len > 0 && line[len - 1] == ' ') len -= 1;
+            line[len] = '\0';
+            if (len < 1 || line[0] == '#' || line[0] == '!') continue;
+            ignore = calloc(1, sizeof(grep_ignore_t));
+            if (line[len - 1] == '/') {
+                ignore->is_dir_only = 1;
+                line[--len] = '\0';
+            }
+            pattern = line;
+            if (*pattern == '/') {
+                pattern += 1;
+                ignore->is_anchored = 1;
+            } else if (strchr(pattern, '/')) {
+                ignore->is_anchored = 1;
+            }
+            ignore->dir = strdup(dir);
+            ignore->pattern = strdup(pattern);
+            ignore->parent = parent;
+            parent = ignore;
+            pthread_mutex_lock(&self->lock);
+            LL_PREPEND2(self->ignores, ignore, all_next);
+            pthread_mutex_unlock(&self->lock);
+        }
+        fclose(fp);
+    }
+    return parent;
+}
+
+// Return 1 if path matches an ignore pattern
+static int _grep_is_ignored(grep_ignore_t* ignore, char* path, int is_dir) {
+    char* basename;
+    char* relpath;
+    size_t dir_len;
+    basename = strrchr(path, '/');
+    basename = basename ? basename + 1 : path;
+    for (; ignore; ignore = ignore->parent) {
+        if (ignore->is_dir_only && !is_dir) continue;
+        if (ignore->is_anchored) {
+            dir_len = strcmp(ignore->dir, ".") == 0 ? 0 : strlen(ignore->dir);
+            relpath = path + dir_len;
+            if (*relpath == '/') relpath += 1;
+            if (fnmatch(ignore->pattern, relpath, FNM_PATHNAME) == 0) return 1;
+        } else if (fnmatch(ignore->pattern, basename, 0) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Queue a result and its menu line in worker's batch
+static void _grep_add_result(grep_worker_t* worker, char* path, bint_t linenum, bint_t col, char* line, size_t line_len) {
+    grep_result_t* result;
+    size_t need;
+    size_t i;
+    char* c;
+
+    // Format "path:linenum:line"
+    if (line_len > 0 && line[line_len - 1] == '\r') line_len -= 1;
+    line_len = MLE_MIN(line_len, MLE_GREP_LINE_MAX);
+    need = strlen(path) + line_len + 32;
+    if (worker->batch_text_len + need > worker->batch_text_size) {
+        worker->batch_text_size = MLE_MAX(worker->batch_text_size * 2, worker->batch_text_len + need);
+        worker->batch_text = realloc(worker->batch_text, worker->batch_text_size);
+    }
+    c = worker->batch_text + worker->batch_text_len;
+    c += sprintf(c, "%s:%" PRIdMAX ":", path, (intmax_t)linenum);
+    for (i = 0; i < line_len; i++) {
+        *c++ = line[i] == '\0' ? ' ' : line[i];
+    }
+    *c++ = '\n';
+    worker->batch_text_len = c - worker->batch_text;
+
+    result = malloc(sizeof(grep_result_t));
+    result->path = strdup(path);
+    result->linenum = linenum;
+    result->col = col;
+    if (worker->batch_results_len + 1 > worker->batch_results_size) {
+        worker->batch_results_size = worker->batch_results_size ? worker->batch_results_size * 2 : 64;
+        worker->batch_results = realloc(worker->batch_results, sizeof(grep_result_t*) * worker->batch_results_size);
+    }
+    worker->batch_results[worker->batch_results_len++] = result;
+}
+
+// Move worker's batch to grep. Results and menu lines are moved together so
+// that line n of the invoker stays results[n].
+static void _grep_publish(grep_worker_t* worker) {
+    grep_t* self;
+    self = worker->grep;
+    if (worker->batch_results_len < 1) return;
+    pthread_mutex_lock(&self->lock);
+    if (self->results_len + worker->batch_results_len > self->results_size) {
+        self->results_size = MLE_MAX(self->results_size * 2, self->results_len + worker->batch_results_len);
+        self->results = realloc(self->results, sizeof(grep_result_t*) * self->results_size);
+    }
+    memcpy(self->results + self->results_len, worker->batch_results, sizeof(grep_result_t*) * worker->batch_results_len);
+    self->results_len += worker->batch_results_len;
+    if (self->text_len + worker->batch_text_len > self->text_size) {
+        self->text_size = MLE_MAX(self->text_size * 2, self->text_len + worker->batch_text_len);
+        self->text = realloc(self->text, self->text_size);
+    }
+    memcpy(self->text + self->text_len, worker->batch_text, worker->batch_text_len);
+    self->text_len += worker->batch_text_len;
+    pthread_mutex_unlock(&self->lock);
+    worker->batch_results_len = 0;
+    worker->batch_text_len = 0;
+}
+
+// Timer callback that appends queued lines to invoker
+static void _grep_timer_cb(editor_t* editor, void* udata) {
+    grep_t* self;
+    int is_done;
+    self = (grep_t*)udata;
+    self->timer = NULL; // Freed by caller
+    pthread_mutex_lock(&self->lock);
+    if (self->invoker && self->text_len > 0) {
+        bview_append(self->invoker, self->text, self->text_len);
+        self->text_len = 0;
+    }
+    is_done = self->is_done;
+    pthread_mutex_unlock(&self->lock);
+    if (!is_done) {
+        editor_add_timer(editor, MLE_GREP_POLL_MS, _grep_timer_cb, self, &self->timer);
+    }
+}
+
+// Return dir/name, or name if dir is "."
+static char* _grep_join(char* dir, char* name) {
+    char* path;
+    if (strcmp(dir, ".") == 0) return strdup(name);
+    asprintf(&path, "%s/%s", dir, name);
+    return path;
+}
@@ -0,0 +1,262 @@
+#ifdef MLE_HEADLESS
+
+// An in-memory stand-in for the termbox calls mle uses. Build with
+// `make mle_headless` to render into a cell grid instead of a tty, e.g., to
+// run display benchmarks in CI.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mle.h"
+
+static int _headless_resize(int w, int h);
+static size_t _headless_attr_len(uint16_t fg, uint16_t bg);
+
+static struct tb_cell* _headless_back = NULL;
+static struct tb_cell* _headless_front = NULL;
+static int _headless_w = 0;
+static int _headless_h = 0;
+static uint16_t _headless_clear_fg = TB_DEFAULT;
+static uint16_t _headless_clear_bg = TB_DEFAULT;
+static int _headless_input_mode = TB_INPUT_ESC;
+static int _headless_output_mode = TB_OUTPUT_NORMAL;
+static struct tb_event* _headless_events = NULL;
+static size_t _headless_events_len = 0;
+static size_t _headless_events_size = 0;
+static size_t _headless_events_index = 0;
+static size_t _headless_cells_out = 0;
+static size_t _headless_bytes_out = 0;
+
+// Queue an event to be returned by tb_peek_event/tb_poll_event
+int headless_push_event(struct tb_event* event) {
+    if (_headless_events_len + 1 > _headless_events_size) {
+        _headless_events_size = _headless_events_size ? _headless_events_size * 2 : 64;
+        _headless_events = realloc(_headless_events, sizeof(struct tb_event) * _headless_events_size);
+    }
+    _headless_events[_headless_events_len++] = *event;
+    if (event->type == TB_EVENT_RESIZE) {
+        _headless_resize(event->w, event->h);
+    }
+    return MLE_OK;
+}
+
+// Return front buffer, i.e., the cells as of the last tb_present
+struct tb_cell* headless_front_buffer() {
+    return _headless_front;
+}
+
+// Return totals of cells and bytes written by tb_present
+void headless_get_output(size_t* ret_cells, size_t* ret_bytes) {
+    *ret_cells = _headless_cells_out;
+    *ret_bytes = _headless_bytes_out;
+}
+
+// Init grid. Size is taken from $COLUMNS and $LINES, defaulting to 80x24.
+int tb_init() {
+    char* cols;
+    char* lines;
+    cols = getenv("COLUMNS");
+    lines = getenv("LINES");
+    _headless_resize(
+        cols && atoi(cols) > 0 ? atoi(cols) : MLE_HEADLESS_DEFAULT_W,
+        lines && atoi(lines) > 0 ? atoi(lines) : MLE_HEADLESS_DEFAULT_H
+    );
+    return 0;
+}
+
+// Free grid and queued events
+void tb_shutdown() {
+    if (_headless_back) free(_headless_back);
+    if (_headless_front) free(_headless_front);
+    if (_headless_events) free(_headless_events);
+    _headless_back = NULL;
+    _headless_front = NULL;
+    _headless_events = NULL;
+    _headless_events_len = 0;
+    _headless_events_size = 0;
+    _headless_events_index = 0;
+    _headless_w = 0;
+    _headless_h = 0;
+}
+
+int tb_width() {
+    return _headless_w;
+}
+
+int tb_height() {
+    return _headless_h;
+}
+
+void tb_clear() {
+    int i;
+    for (i = 0; i < _headless_w * _headless_h; i++) {
+        _headless_back[i] = (struct tb_cell){ ' ', _headless_clear_fg, _headless_clear_bg };
+    }
+}
+
+void tb_set_clear_attributes(uint16_t fg, uint16_t bg) {
+    _headless_clear_fg = fg;
+    _headless_clear_bg = bg;
+}
+
+// Copy back buffer to front buffer. Changed cells are encoded the way
+// termbox writes them to a tty (cursor move when not contiguous, attributes
+// when fg/bg change, then the glyph) and tallied in the output counters.
+void tb_present() {
+    char seq[32];
+    int i;
+    int last_i;
+    uint16_t last_fg;
+    uint16_t last_bg;
+    struct tb_cell* cell;
+    if (!_headless_back) return;
+    last_i = -2;
+    last_fg = 0xffff;
+    last_bg = 0xffff;
+    for (i = 0; i < _headless_w * _headless_h; i++) {
+        cell = &_headless_back[i];
+        if (memcmp(cell, &_headless_front[i], sizeof(struct tb_cell)) == 0) continue;
+        _headless_cells_out += 1;
+        if (i != last_i + 1 || i % _headless_w == 0) {
+            _headless_bytes_out += snprintf(seq, sizeof(seq), "\033[%d;%dH", i / _headless_w + 1, i % _headless_w + 1);
+        }
+        if (cell->fg != last_fg || cell->bg != last_bg) {
+            _headless_bytes_out += _headless_attr_len(cell->fg, cell->bg);
+            last_fg = cell->fg;
+            last_bg = cell->bg;
+        }
+        _headless_bytes_out += tb_utf8_unicode_to_char(seq, cell->ch);
+        last_i = i;
+    }
+    memcpy(_headless_front, _headless_back, sizeof(struct tb_cell) * _headless_w * _headless_h);
+}
+
+void tb_set_cursor(int cx, int cy) {
+    // Nothing to do
+}
+
+void tb_put_cell(int x, int y, const struct tb_cell* cell) {
+    if (x < 0 || x >= _headless_w || y < 0 || y >= _headless_h) return;
+    _headless_back[y * _headless_w + x] = *cell;
+}
+
+void tb_change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg) {
+    if (x < 0 || x >= _headless_w || y < 0 || y >= _headless_h) return;
+    _headless_back[y * _headless_w + x] = (struct tb_cell){ ch, fg, bg };
+}
+
+void tb_blit(int x, int y, int w, int h, const struct tb_cell* cells) {
+    int sy;
+    if (x < 0 || y < 0 || x + w > _headless_w || y + h > _headless_h) return;
+    for (sy = 0; sy < h; sy++) {
+        memcpy(_headless_back + (y + sy) * _headless_w + x, cells + sy * w, sizeof(struct tb_cell) * w);
+    }
+}
+
+struct tb_cell* tb_cell_buffer() {
+    return _headless_back;
+}
+
+int tb_select_input_mode(int mode) {
+    if (mode) _headless_input_mode = mode;
+    return _headless_input_mode;
+}
+
+int tb_select_output_mode(int mode) {
+    if (mode) _headless_output_mode = mode;
+    return _headless_output_mode;
+}
+
+// Return next queued event type, or 0 if none are queued. There is nothing
+// to wait on, so timeout is ignored.
+int tb_peek_event(struct tb_event* event, int timeout) {
+    if (_headless_events_index >= _headless_events_len) return 0;
+    *event = _headless_events[_headless_events_index++];
+    return event->type;
+}
+
+// Return next queued event type. If none are queued, sleep until a signal
+// arrives, like a tty nobody is typing into, and return -1.
+int tb_poll_event(struct tb_event* event) {
+    int rc;
+    if ((rc = tb_peek_event(event, 0)) != 0) return rc;
+    pause();
+    return -1;
+}
+
+int tb_utf8_char_length(char c) {
+    unsigned char uc;
+    uc = (unsigned char)c;
+    if (uc < 0xc0) return 1;
+    if (uc < 0xe0) return 2;
+    if (uc < 0xf0) return 3;
+    if (uc < 0xf8) return 4;
+    if (uc < 0xfc) return 5;
+    return 6;
+}
+
+int tb_utf8_char_to_unicode(uint32_t* out, const char* c) {
+    static const unsigned char masks[6] = { 0x7f, 0x1f, 0x0f, 0x07, 0x03, 0x01 };
+    uint32_t result;
+    int len;
+    int i;
+    if (*c == 0) return TB_EOF;
+    len = tb_utf8_char_length(*c);
+    result = (unsigned char)c[0] & masks[len - 1];
+    for (i = 1; i < len; i++) {
+        result = (result << 6) | ((unsigned char)c[i] & 0x3f);
+    }
+    *out = result;
+    return len;
+}
+
+int tb_utf8_unicode_to_char(char* out, uint32_t c) {
+    int len;
+    int first;
+    int i;
+    if (c < 0x80) { first = 0; len = 1; }
+    else if (c < 0x800) { first = 0xc0; len = 2; }
+    else if (c < 0x10000) { first = 0xe0; len = 3; }
+    else if (c < 0x200000) { first = 0xf0; len = 4; }
+    else if (c < 0x4000000) { first = 0xf8; len = 5; }
+    else { first = 0xfc; len = 6; }
+    for (i = len - 1; i > 0; i--) {
+        out[i] = (char)((c & 0x3f) | 0x80);
+        c >>= 6;
+    }
+    out[0] = (char)(c | first);
+    return len;
+}
+
+// Return length of the sgr sequences termbox writes to switch to fg/bg
+static size_t _headless_attr_len(uint16_t fg, uint16_t bg) {
+    char seq[32];
+    size_t len;
+    len = 3; // \033[m
+    if (fg & TB_BOLD) len += 4;
+    if (bg & TB_BOLD) len += 4; // blink
+    if (fg & TB_UNDERLINE) len += 4;
+    if ((fg & TB_REVERSE) || (bg & TB_REVERSE)) len += 4;
+    if (_headless_output_mode == TB_OUTPUT_256) {
+        len += snprintf(seq, sizeof(seq), "\033[38;5;%dm\033[48;5;%dm", fg & 0xff, bg & 0xff);
+    } else {
+        if ((fg & 0xff) != TB_DEFAULT) len += snprintf(seq, sizeof(seq), "\033[3%dm", (fg & 0xff) - 1);
+        if ((bg & 0xff) != TB_DEFAULT) len += snprintf(seq, sizeof(seq), "\033[4%dm", (bg & 0xff) - 1);
+    }
+    return len;
+}
+
+// Reallocate grid to w x h, clearing it
+static int _headless_resize(int w, int h) {
+    if (w < 1 || h < 1) return MLE_ERR;
+    _headless_w = w;
+    _headless_h = h;
+    _headless_back = realloc(_headless_back, sizeof(struct tb_cell) * w * h);
+    _headless_front = realloc(_headless_front, sizeof(struct tb_cell) * w * h);
+    tb_clear();
+    memcpy(_headless_front, _headless_back, sizeof(struct tb_cell) * w * h);
+    return MLE_OK;
+}
+
+#endif
@@ -66,3 +66,4 @@ MLE_KEY_DEF("space", 0, 0, TB_KEY_SPACE)
 MLE_KEY_DEF("comma", 0, 44, 0)
 MLE_KEY_DEF("backspace2", 0, 0, TB_KEY_BACKSPACE2)
 MLE_KEY_DEF("C-8", 0, 0, TB_KEY_CTRL_8)
+MLE_KEY_DEF("paste", 0x20, 0, 0xffff)
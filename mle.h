@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <termbox.h>
 #include <limits.h>
+#include <sys/types.h>
+#include <pthread.h>
 #include "uthash.h"
 #include "mlbuf.h"
 
@@ -12,6 +14,14 @@ typedef struct editor_s editor_t; // A container for editor-wide globals
 typedef struct bview_s bview_t; // A view of a buffer
 typedef struct bview_rect_s bview_rect_t; // A rectangle in bview with a default styling
 typedef struct bview_listener_s bview_listener_t; // A listener to buffer events in a bview
+typedef struct bview_cell_cache_s bview_cell_cache_t; // A cached render of a bline in a bview
+typedef struct bview_status_s bview_status_t; // A snapshot of the fields shown in the status bar
+typedef struct bracket_sum_s bracket_sum_t; // Bracket depth changes in a line (or range of lines)
+typedef struct bracket_node_s bracket_node_t; // A line in a bracket nesting index
+typedef struct bracket_index_s bracket_index_t; // A bracket nesting index of a buffer
+typedef struct perf_hist_s perf_hist_t; // A log-linear latency histogram
+typedef struct trace_s trace_t; // A recorded or replayed stream of input events
+typedef struct trace_event_s trace_event_t; // A single timestamped input event in a trace_t
 typedef void (*bview_listener_cb_t)(bview_t* bview, baction_t* action, void* udata); // A bview_listener_t callback
 typedef struct cursor_s cursor_t; // A cursor (insertion mark + selection bound mark) in a buffer
 typedef struct loop_context_s loop_context_t; // Context for a single _editor_loop
@@ -21,16 +31,36 @@ typedef struct cmd_funcref_s cmd_funcref_t; // A reference to a command function
 typedef int (*cmd_init_func_t)(editor_t* editor, cmd_funcref_t* self, int is_deinit); // A command de/init function
 typedef struct kinput_s kinput_t; // A single key input (similar to a tb_event from termbox)
 typedef struct kmacro_s kmacro_t; // A sequence of kinputs and a name
+typedef struct kmacro_step_s kmacro_step_t; // A command resolved from a run of kmacro_t inputs
 typedef struct kmap_s kmap_t; // A map of keychords to functions
 typedef struct kmap_node_s kmap_node_t; // A node in a list of keymaps
 typedef struct kbinding_def_s kbinding_def_t; // A definition of a keymap
 typedef struct kbinding_s kbinding_t; // A single binding in a keymap
+typedef struct kdispatch_s kdispatch_t; // A flat lookup table from kinputs to bindings
+typedef struct kdispatch_entry_s kdispatch_entry_t; // A single slot in a kdispatch_t
 typedef struct syntax_s syntax_t; // A syntax definition
 typedef struct syntax_node_s syntax_node_t; // A node in a linked list of syntaxes
 typedef struct srule_def_s srule_def_t; // A definition of a syntax
 typedef struct async_proc_s async_proc_t; // An asynchronous process
 typedef void (*async_proc_cb_t)(async_proc_t* self, char* buf, size_t buf_len, int is_error, int is_eof, int is_timeout); // An async_proc_t callback
 typedef struct editor_prompt_params_s editor_prompt_params_t; // Extra params for editor_prompt
+typedef struct editor_timer_s editor_timer_t; // A pending timer in the editor event loop
+typedef void (*editor_timer_cb_t)(editor_t* editor, void* udata); // An editor_timer_t callback
+typedef struct proc_s proc_t; // A child process waiting to be reaped
+typedef struct shell_job_s shell_job_t; // Input and output of one run of a shell cmd
+typedef struct fsindex_s fsindex_t; // An in-memory index of file paths under a dir
+typedef struct fsindex_watch_s fsindex_watch_t; // An inotify watch on a dir in an fsindex_t
+typedef struct fsindex_match_s fsindex_match_t; // A path in an fsindex_t and its fuzzy score
+typedef struct fsindex_task_s fsindex_task_t; // A slice of candidates scored by one thread
+typedef struct grep_s grep_t; // An in-process recursive grep running on a thread pool
+typedef struct grep_item_s grep_item_t; // A file or dir waiting to be grepped
+typedef struct grep_worker_s grep_worker_t; // A grep thread and its deque of items
+typedef struct grep_ignore_s grep_ignore_t; // A pattern from an ignore file
+typedef struct grep_result_s grep_result_t; // A matching line found by grep
+typedef struct browse_s browse_t; // A dir tree shown in a browse menu
+typedef struct browse_row_s browse_row_t; // A line in a browse menu
+typedef struct browse_dir_s browse_dir_t; // A cached listing of a dir
+typedef struct browse_entry_s browse_entry_t; // An entry in a browse_dir_t
 typedef struct tb_event tb_event_t; // A termbox event
 
 // kinput_t
@@ -40,6 +70,27 @@ struct kinput_s {
     uint16_t key;
 };
 
+// kdispatch_entry_t
+struct kdispatch_entry_s {
+    #define MLE_KDISPATCH_NONE 0
+    #define MLE_KDISPATCH_LITERAL 1
+    #define MLE_KDISPATCH_NUMERIC 2
+    #define MLE_KDISPATCH_WILDCARD 3
+    kinput_t input;
+    int kind;
+    kbinding_t* binding; // Binding to dispatch to, after numeric/wildcard patterns
+    kbinding_t* literal; // Binding of input itself, ignoring patterns (for peeking)
+};
+
+// kdispatch_t
+struct kdispatch_s {
+    kdispatch_entry_t* entries;
+    size_t mask;
+    kdispatch_entry_t miss_digit;
+    kdispatch_entry_t miss_other;
+    cmd_funcref_t* default_funcref;
+};
+
 // bview_rect_t
 struct bview_rect_s {
     int x;
@@ -50,6 +101,55 @@ struct bview_rect_s {
     uint16_t bg;
 };
 
+// bview_status_t
+struct bview_status_s {
+    char* prompt_str;
+    char* kmap_name;
+    char* syntax_name;
+    int need_input;
+    int is_anchored;
+    int macro_state;
+    int async_frame;
+    int bview_num;
+    int bview_count;
+    bint_t line;
+    bint_t line_count;
+    bint_t col;
+    bint_t char_count;
+    int has_errstr;
+};
+
+// perf_hist_t
+struct perf_hist_s {
+    #define MLE_PERF_HIST_SUB_BITS 3
+    #define MLE_PERF_HIST_BUCKETS 256
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint32_t buckets[MLE_PERF_HIST_BUCKETS];
+};
+
+// trace_event_t
+struct trace_event_s {
+    uint64_t t_us; // Time since start of recording
+    tb_event_t ev;
+    uint64_t arrival_us; // Replay: when event was handed to the editor
+    uint64_t present_us; // Replay: end of first tb_present after arrival
+};
+
+// trace_t
+struct trace_s {
+    FILE* record_fp;
+    uint64_t record_start_us;
+    trace_event_t* events;
+    size_t events_len;
+    size_t events_index; // Next event to replay
+    size_t presented_index; // First replayed event not yet presented
+    uint64_t replay_start_us;
+    int is_replay;
+    int is_paced;
+};
+
 // editor_t
 struct editor_s {
     int w;
@@ -66,14 +166,51 @@ struct editor_s {
     bview_rect_t rect_prompt;
     syntax_t* syntax_map;
     int is_display_disabled;
+    int is_damaged;
+    int max_frame_latency;
+    int shell_max_procs;
+    struct timeval last_display_time;
+    struct tb_cell* display_shadow;
+    size_t display_shadow_len;
+    size_t display_cells_out;
+    size_t display_bytes_out;
+    #define MLE_PERF_INPUT 0
+    #define MLE_PERF_GET_COMMAND 1
+    #define MLE_PERF_CMD 2
+    #define MLE_PERF_DISPLAY 3
+    #define MLE_PERF_DRAW 4
+    #define MLE_PERF_PRESENT 5
+    #define MLE_PERF_COUNT 6
+    perf_hist_t perf_hists[MLE_PERF_COUNT];
+    uint64_t perf_input_us;
+    int perf_loop_seq;
+    char* perf_path;
+    trace_t trace;
+    bracket_index_t* bracket_index_map;
+    fsindex_t* fsindex;
+    browse_dir_t* browse_dirs;
+    bview_status_t status_last;
+    int edit_bview_count;
+    int is_edit_bview_num_dirty;
     kmacro_t* macro_map;
     kinput_t macro_toggle_key;
     kmacro_t* macro_record;
     kmacro_t* macro_apply;
     size_t macro_apply_input_index;
+    size_t macro_apply_step;
+    #define MLE_MACRO_REPEAT_COUNT 0
+    #define MLE_MACRO_REPEAT_EOB 1
+    #define MLE_MACRO_REPEAT_LINES 2
+    int macro_apply_mode;
+    uintmax_t macro_apply_count; // Repetitions left after the current one
+    bint_t macro_apply_line; // Cursor line at start of the current repetition
+    mark_t* macro_apply_next_line; // Start of the next line in MLE_MACRO_REPEAT_LINES
+    int macro_apply_is_batched;
+    int macro_apply_was_display_disabled;
     int is_recording_macro;
     cmd_funcref_t* func_map;
     kmap_t* kmap_map;
+    int kmap_gen;
     kmap_t* kmap_normal;
     kmap_t* kmap_prompt_input;
     kmap_t* kmap_prompt_yn;
@@ -86,9 +223,20 @@ struct editor_s {
     char* kmap_init_name;
     kmap_t* kmap_init;
     async_proc_t* async_procs;
-    FILE* tty;
+    char* async_readbuf;
+    editor_timer_t* timers;
+    editor_timer_t* async_frame_timer;
+    editor_timer_t* resize_timer;
+    proc_t* procs;
+    editor_timer_t* proc_timer;
+    int resize_w;
+    int resize_h;
+    #define MLE_EPOLL_MAX_EVENTS 16
+    int epollfd;
     int ttyfd;
     char* syntax_override;
+    char* bench_name;
+    char* script_path;
     int linenum_type;
     int tab_width;
     int tab_to_space;
@@ -103,6 +251,12 @@ struct editor_s {
     int is_in_init;
     char* insertbuf;
     size_t insertbuf_size;
+    char* paste;
+    size_t paste_len;
+    size_t paste_size;
+    #define MLE_EVENT_PUSHBACK_SIZE 64
+    tb_event_t event_pushback[MLE_EVENT_PUSHBACK_SIZE];
+    int event_pushback_len;
     #define MLE_ERRSTR_SIZE 256
     char errstr[MLE_ERRSTR_SIZE];
     int exit_code;
@@ -128,6 +282,7 @@ struct syntax_s {
     char* name;
     char* path_pattern;
     srule_node_t* srules;
+    int has_multi_rules;
     UT_hash_handle hh;
 };
 
@@ -165,6 +320,8 @@ struct bview_s {
     char* path;
     kmap_node_t* kmap_stack;
     kmap_node_t* kmap_tail;
+    kdispatch_t kmap_dispatch;
+    int kmap_dispatch_gen;
     cursor_t* cursors;
     cursor_t* active_cursor;
     char* last_search;
@@ -173,9 +330,28 @@ struct bview_s {
     int tab_to_space;
     syntax_t* syntax;
     async_proc_t* async_proc;
+    grep_t* grep;
+    fsindex_t* fsindex;
+    browse_t* browse;
+    char* append_buf;
+    size_t append_len;
+    size_t append_size;
+    mark_t* append_mark;
     cmd_func_t menu_callback;
     int is_menu;
     char init_cwd[PATH_MAX + 1];
+    int is_damaged;
+    char* damage_rows;
+    int damage_rows_len;
+    bint_t last_viewport_y;
+    bint_t last_cursor_line;
+    int last_linenum_width;
+    int edit_bview_num;
+    bview_cell_cache_t* cell_cache;
+    uint64_t last_sel_hash; // Selections drawn last frame
+    int last_sel_count;
+    bint_t last_sel_lo_line;
+    bint_t last_sel_hi_line;
     bview_listener_t* listeners;
     bview_t* top_next;
     bview_t* top_prev;
@@ -191,6 +367,45 @@ struct bview_listener_s {
     bview_listener_t* prev;
 };
 
+// bracket_sum_t
+struct bracket_sum_s {
+    int delta[3];
+    int min_after[3];
+    int min_before[3];
+};
+
+// bracket_node_t
+struct bracket_node_s {
+    bracket_sum_t line;
+    bracket_sum_t sum;
+    bint_t size;
+    uint32_t priority;
+    bracket_node_t* left;
+    bracket_node_t* right;
+};
+
+// bracket_index_t
+struct bracket_index_s {
+    buffer_t* buffer;
+    bracket_node_t* root;
+    uint32_t seed;
+    int is_stale;
+    UT_hash_handle hh;
+};
+
+// bview_cell_cache_t
+struct bview_cell_cache_s {
+    #define MLE_BVIEW_CELL_CACHE_MAX 2048
+    bline_t* bline;
+    bint_t viewport_x;
+    int color_col;
+    int tab_width;
+    int is_cursor_line;
+    struct tb_cell* cells;
+    int cells_len;
+    UT_hash_handle hh;
+};
+
 // cursor_t
 struct cursor_s {
     bview_t* bview;
@@ -210,6 +425,14 @@ struct kmacro_s {
     kinput_t* inputs;
     size_t inputs_len;
     size_t inputs_cap;
+    char** pastes;
+    size_t* paste_lens;
+    size_t pastes_len;
+    kmacro_step_t* steps;
+    size_t steps_len;
+    size_t steps_cap;
+    kmap_t* steps_kmap; // Kmap steps were resolved against
+    int steps_kmap_gen;
     UT_hash_handle hh;
 };
 
@@ -245,6 +468,7 @@ struct kbinding_s {
     cmd_funcref_t* funcref;
     char* static_param;
     kbinding_t* children;
+    kdispatch_t dispatch;
     UT_hash_handle hh;
 };
 
@@ -307,19 +531,225 @@ struct loop_context_s {
     cmd_funcref_t* last_cmd;
 };
 
+// kmacro_step_t
+struct kmacro_step_s {
+    cmd_funcref_t* funcref;
+    char* static_param;
+    kinput_t input; // Last input of the run
+    size_t input_start;
+    size_t input_end;
+    uintmax_t numeric_params[MLE_LOOP_CTX_MAX_NUMERIC_PARAMS];
+    int numeric_params_len;
+    uint32_t wildcard_params[MLE_LOOP_CTX_MAX_WILDCARD_PARAMS];
+    int wildcard_params_len;
+};
+
 // async_proc_t
 struct async_proc_s {
     editor_t* editor;
     bview_t* invoker;
-    FILE* pipe;
+    pid_t pid;
     int pipefd;
     int is_done;
-    struct timeval timeout;
+    editor_timer_t* timeout_timer;
     async_proc_cb_t callback;
+    void* udata;
     async_proc_t* next;
     async_proc_t* prev;
 };
 
+// editor_timer_t
+struct editor_timer_s {
+    uint64_t when_us;
+    editor_timer_cb_t callback;
+    void* udata;
+    editor_timer_t* next;
+    editor_timer_t* prev;
+};
+
+// shell_job_t
+struct shell_job_s {
+    char* input;
+    size_t input_len;
+    size_t input_off;
+    char* output; // Allocated once the job starts; always allocated and NUL-terminated on return, even on error
+    size_t output_len;
+    size_t output_size;
+    pid_t pid;
+    int readfd;
+    int writefd;
+    int rv; // MLE_OK if cmd ran to eof
+};
+
+// fsindex_watch_t
+struct fsindex_watch_s {
+    int wd;
+    char* dir; // Relative to fsindex root, or "" for root
+    UT_hash_handle hh;
+};
+
+// fsindex_match_t
+struct fsindex_match_s {
+    size_t index;
+    size_t path_len;
+    int score;
+};
+
+// fsindex_task_t
+struct fsindex_task_s {
+    fsindex_t* fsindex;
+    size_t* cands;
+    size_t cands_len;
+    char** terms;
+    int terms_len;
+    int is_case_sensitive;
+    fsindex_match_t* matches;
+    size_t matches_len;
+};
+
+// fsindex_t
+struct fsindex_s {
+    editor_t* editor;
+    char* root;
+    char** paths; // Relative to root; NULL if removed. Owned by the worker.
+    size_t paths_len;
+    size_t paths_size;
+    size_t paths_removed;
+    int inotify_fd;
+    fsindex_watch_t* watches; // Hash by wd
+    int is_unwatched; // Some dir could not be watched; rebuild once stale
+    uint64_t built_us; // When root was last walked
+    unsigned long gen; // Bumped when paths change
+    char* query; // Last query and its matches, ranked
+    size_t* matches;
+    size_t matches_len;
+    unsigned long matches_gen;
+    unsigned long stream_seq; // Request being streamed while walking
+    size_t stream_off; // Paths streamed so far for stream_seq
+    pthread_t thread;
+    int is_started;
+    int is_cancelled;
+    pthread_mutex_t lock; // Guards the fields below
+    pthread_cond_t cond;
+    char* req_query; // Latest query asked for
+    unsigned long req_seq; // Bumped per query
+    unsigned long done_seq; // Last query answered
+    bview_t* invoker; // Menu that results are appended to
+    char* text; // Result lines not yet appended to invoker
+    size_t text_len;
+    size_t text_size;
+    size_t text_lines; // Lines published for req_seq
+    int is_text_reset; // Clear invoker before appending text
+    editor_timer_t* timer;
+};
+
+// grep_ignore_t
+struct grep_ignore_s {
+    char* dir; // Dir of ignore file relative to grep root, or "" for root
+    char* pattern;
+    int is_anchored; // Match path relative to dir instead of basename
+    int is_dir_only;
+    grep_ignore_t* parent; // Next pattern to try, e.g., from a parent dir
+    grep_ignore_t* all_next; // All patterns, for freeing
+};
+
+// grep_item_t
+struct grep_item_s {
+    char* path;
+    int is_dir;
+    grep_ignore_t* ignore; // Patterns in effect for path
+};
+
+// grep_worker_t
+struct grep_worker_s {
+    grep_t* grep;
+    pthread_t thread;
+    int is_started;
+    pthread_mutex_t lock;
+    grep_item_t* items; // Owner pops from tail; thieves take from head
+    size_t items_head;
+    size_t items_len;
+    size_t items_size;
+    grep_result_t** batch_results; // Results of current file
+    size_t batch_results_len;
+    size_t batch_results_size;
+    char* batch_text;
+    size_t batch_text_len;
+    size_t batch_text_size;
+};
+
+// grep_result_t
+struct grep_result_s {
+    char* path;
+    bint_t linenum; // 1-based
+    bint_t col; // 0-based char offset of match
+};
+
+// grep_t
+struct grep_s {
+    editor_t* editor;
+    bview_t* invoker;
+    pcre* cre;
+    pcre_extra* cre_extra;
+    grep_worker_t* workers;
+    int workers_len;
+    size_t pending; // Items pushed but not yet done
+    unsigned long work_gen; // Bumped on push to wake idle workers
+    int is_done;
+    int is_cancelled;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    grep_ignore_t* ignores;
+    grep_result_t** results; // Line n of invoker is results[n]
+    size_t results_len;
+    size_t results_size;
+    char* text; // Menu lines not yet appended to invoker
+    size_t text_len;
+    size_t text_size;
+    editor_timer_t* timer;
+};
+
+// browse_entry_t
+struct browse_entry_s {
+    char* name;
+    mode_t mode; // S_IFDIR, S_IFREG, etc; symlinks are resolved
+};
+
+// browse_dir_t
+struct browse_dir_s {
+    char* path;
+    struct timespec mtime; // Listing is stale if dir mtime differs
+    browse_entry_t* entries; // Sorted by name
+    size_t entries_len;
+    UT_hash_handle hh;
+};
+
+// browse_row_t
+struct browse_row_s {
+    char* path; // Absolute
+    int depth; // -1 for parent dir row
+    int is_dir;
+    int is_expanded;
+};
+
+// browse_t
+struct browse_s {
+    editor_t* editor;
+    bview_t* invoker;
+    char* root;
+    browse_row_t* rows; // Line n of invoker is rows[n]
+    size_t rows_len;
+    size_t rows_size;
+};
+
+// proc_t
+struct proc_s {
+    pid_t pid; // Also the process group id
+    uint64_t kill_us; // When to SIGKILL if still running, or 0
+    proc_t* next;
+    proc_t* prev;
+};
+
 // editor_prompt_params_t
 struct editor_prompt_params_s {
     char* data;
@@ -345,7 +775,20 @@ int editor_prompt_menu(editor_t* editor, char* prompt, char* opt_buf_data, int o
 int editor_count_bviews_by_buffer(editor_t* editor, buffer_t* buffer);
 int editor_register_cmd(editor_t* editor, char* name, cmd_func_t opt_func, cmd_funcref_t** optret_funcref);
 int editor_get_input(editor_t* editor, cmd_context_t* ctx);
+int editor_apply_macro(editor_t* editor, kmacro_t* macro, int mode, uintmax_t count);
+int editor_run_script(editor_t* editor, int argc, char** argv);
+cmd_funcref_t* editor_get_command(editor_t* editor, cmd_context_t* ctx, kinput_t* opt_peek_input);
 int editor_display(editor_t* editor);
+int editor_damage(editor_t* editor, buffer_t* opt_buffer);
+int editor_resize(editor_t* editor, int w, int h);
+int editor_queue_resize(editor_t* editor, int w, int h);
+int editor_add_timer(editor_t* editor, long delay_ms, editor_timer_cb_t callback, void* udata, editor_timer_t** optret_timer);
+int editor_remove_timer(editor_t* editor, editor_timer_t* timer);
+int editor_peek_event(editor_t* editor, tb_event_t* ev, int timeout_ms);
+int editor_read_event(editor_t* editor, tb_event_t* ev, int timeout_ms);
+int editor_push_event(editor_t* editor, tb_event_t* ev);
+int editor_watch_fd(editor_t* editor, int fd, async_proc_t* opt_aproc);
+int editor_unwatch_fd(editor_t* editor, int fd);
 
 // bview functions
 bview_t* bview_new(editor_t* editor, char* opt_path, int opt_path_len, buffer_t* opt_buffer);
@@ -354,7 +797,13 @@ int bview_destroy(bview_t* self);
 int bview_resize(bview_t* self, int x, int y, int w, int h);
 int bview_draw(bview_t* self);
 int bview_draw_cursor(bview_t* self, int set_real_cursor);
+int bview_damage(bview_t* self);
+int bview_damage_lines(bview_t* self, bint_t start_line_index, bint_t end_line_index);
+int bview_render_bline_cells(bview_t* self, bline_t* bline, bint_t viewport_x, int is_cursor_line, struct tb_cell* cells);
 int bview_rectify_viewport(bview_t* self);
+int bview_append(bview_t* self, char* data, size_t data_len);
+int bview_flush_appends(bview_t* self);
+int bview_discard_appends(bview_t* self);
 int bview_center_viewport_y(bview_t* self);
 int bview_zero_viewport_y(bview_t* self);
 int bview_push_kmap(bview_t* bview, kmap_t* kmap);
@@ -371,6 +820,7 @@ bview_t* bview_get_split_root(bview_t* self);
 
 // cmd functions
 int cmd_insert_data(cmd_context_t* ctx);
+int cmd_insert_paste(cmd_context_t* ctx);
 int cmd_insert_newline(cmd_context_t* ctx);
 int cmd_insert_tab(cmd_context_t* ctx);
 int cmd_delete_before(cmd_context_t* ctx);
@@ -398,6 +848,7 @@ int cmd_search(cmd_context_t* ctx);
 int cmd_search_next(cmd_context_t* ctx);
 int cmd_replace(cmd_context_t* ctx);
 int cmd_redraw(cmd_context_t* ctx);
+int cmd_show_perf(cmd_context_t* ctx);
 int cmd_find_word(cmd_context_t* ctx);
 int cmd_isearch(cmd_context_t* ctx);
 int cmd_delete_word_before(cmd_context_t* ctx);
@@ -424,6 +875,7 @@ int cmd_move_until_back(cmd_context_t* ctx);
 int cmd_copy_by(cmd_context_t* ctx);
 int cmd_cut_by(cmd_context_t* ctx);
 int cmd_apply_macro_by(cmd_context_t* ctx);
+int cmd_apply_macro_repeat(cmd_context_t* ctx);
 int cmd_undo(cmd_context_t* ctx);
 int cmd_redo(cmd_context_t* ctx);
 int cmd_quit(cmd_context_t* ctx);
@@ -441,17 +893,81 @@ int cmdinit_vim_normal(editor_t* editor, cmd_funcref_t* self, int is_deinit);
 // async functions
 async_proc_t* async_proc_new(bview_t* invoker, int timeout_sec, int timeout_usec, async_proc_cb_t callback, char* shell_cmd);
 int async_proc_set_invoker(async_proc_t* aproc, bview_t* invoker);
+size_t async_proc_read(async_proc_t* aproc);
 int async_proc_destroy(async_proc_t* aproc);
 
+// proc functions
+int proc_spawn(char* cmd, char* opt_shell, int* optret_fdread, int* optret_fdwrite, pid_t* ret_pid);
+int proc_reap(editor_t* editor, pid_t pid, int is_cancel);
+int proc_destroy_all(editor_t* editor);
+
+// bracket functions
+int bracket_index_find_pair(editor_t* editor, mark_t* mark, bline_t** ret_line, bint_t* ret_col);
+int bracket_index_find_top(editor_t* editor, mark_t* mark, bline_t** ret_line, bint_t* ret_col);
+int bracket_index_update(editor_t* editor, buffer_t* buffer, baction_t* action);
+int bracket_index_destroy(editor_t* editor, buffer_t* buffer);
+
+// perf functions
+uint64_t perf_now_us();
+int perf_record(editor_t* editor, int metric, uint64_t start_us);
+int perf_format(editor_t* editor, char** ret_str, size_t* ret_str_len);
+int perf_dump(editor_t* editor, char* path);
+
+// trace functions
+int trace_record_open(editor_t* editor, char* path);
+int trace_record(editor_t* editor, tb_event_t* ev);
+int trace_replay_open(editor_t* editor, char* path, int is_paced);
+int trace_replay_next(editor_t* editor, tb_event_t* ret_ev, int timeout_ms);
+int trace_replay_due_ms(editor_t* editor);
+int trace_presented(editor_t* editor, uint64_t present_us);
+int trace_write_latency(editor_t* editor, FILE* fp);
+int trace_destroy(editor_t* editor);
+
+// fsindex functions
+fsindex_t* fsindex_new(editor_t* editor, char* root);
+int fsindex_search(fsindex_t* self, char* query, bview_t* invoker);
+int fsindex_set_invoker(fsindex_t* self, bview_t* invoker);
+int fsindex_destroy(fsindex_t* self);
+
+// grep functions
+grep_t* grep_new(editor_t* editor, char* pattern, char* root);
+int grep_set_invoker(grep_t* self, bview_t* invoker);
+grep_result_t* grep_get_result(grep_t* self, size_t index);
+int grep_destroy(grep_t* self);
+
+// browse functions
+browse_t* browse_new(editor_t* editor, char* root);
+int browse_get_text(browse_t* self, char** ret_data, size_t* ret_data_len);
+int browse_set_invoker(browse_t* self, bview_t* invoker);
+browse_row_t* browse_get_row(browse_t* self, size_t index);
+int browse_toggle(browse_t* self, size_t index);
+int browse_set_root(browse_t* self, char* root);
+int browse_destroy(browse_t* self);
+int browse_clear_cache(editor_t* editor);
+
+// bench functions
+int bench_run(editor_t* editor, char* name);
+
+// headless functions
+#ifdef MLE_HEADLESS
+int headless_push_event(struct tb_event* event);
+struct tb_cell* headless_front_buffer();
+void headless_get_output(size_t* ret_cells, size_t* ret_bytes);
+#endif
+
 // util functions
 int util_shell_exec(editor_t* editor, char* cmd, long timeout_s, char* input, size_t input_len, char* opt_shell, char** ret_output, size_t* ret_output_len);
-int util_popen2(char* cmd, char* opt_shell, int* ret_fdread, int* ret_fdwrite);
+int util_shell_exec_multi(editor_t* editor, char* cmd, long timeout_s, char* opt_shell, shell_job_t* jobs, size_t jobs_len, int max_procs);
+int util_popen2(char* cmd, char* opt_shell, int* ret_fdread, int* ret_fdwrite, pid_t* optret_pid);
+int util_thread_create(pthread_t* thread, void* (*fn)(void*), void* arg);
 int util_get_bracket_pair(uint32_t ch, int* optret_is_closing);
 int util_is_file(char* path, char* opt_mode, FILE** optret_file);
 int util_is_dir(char* path);
 int util_pcre_match(char* re, char* subj);
 int util_pcre_replace(char* re, char* subj, char* repl, char** ret_result, int* ret_result_len);
 int util_timeval_is_gt(struct timeval* a, struct timeval* b);
+long util_timeval_diff_ms(struct timeval* a, struct timeval* b);
+size_t util_ascii_printable_len(char* data, size_t len);
 char* util_escape_shell_arg(char* str, int len);
 int tb_print(int x, int y, uint16_t fg, uint16_t bg, char *str);
 int tb_printf(bview_rect_t rect, int x, int y, uint16_t fg, uint16_t bg, const char *fmt, ...);
@@ -474,6 +990,41 @@ extern editor_t _editor;
 #define MLE_DEFAULT_TAB_TO_SPACE 1
 #define MLE_DEFAULT_TRIM_PASTE 1
 #define MLE_DEFAULT_MACRO_TOGGLE_KEY "M-r"
+#define MLE_DEFAULT_MAX_FRAME_LATENCY 50
+
+#define MLE_PASTE_TIMEOUT_MS 1000
+#define MLE_PASTE_START_TIMEOUT_MS 50
+#define MLE_PASTE_MODE_ON "\x1b[?2004h"
+#define MLE_PASTE_MODE_OFF "\x1b[?2004l"
+
+#define MLE_ASYNC_FRAME_MS 250
+#define MLE_ASYNC_READ_MAX (256 * 1024)
+#define MLE_RESIZE_DEBOUNCE_MS 50
+
+#define MLE_SHELL_READ_MIN (64 * 1024)
+#define MLE_SHELL_TICK_MS 100
+#define MLE_SHELL_PROGRESS_MS 500
+#define MLE_SHELL_TIMEOUT_S 1
+
+#define MLE_FSEARCH_MAX_RESULTS 10000
+#define MLE_FSEARCH_MAX_THREADS 16
+#define MLE_FSEARCH_TASK_MIN 4096
+#define MLE_FSEARCH_POLL_MS 20
+#define MLE_FSEARCH_STALE_MS 5000
+#define MLE_FSEARCH_STREAM_EVERY 256
+
+#define MLE_GREP_MAX_THREADS 16
+#define MLE_GREP_POLL_MS 50
+#define MLE_GREP_LINE_MAX 512
+#define MLE_GREP_BINARY_PEEK 8192
+
+#define MLE_PROC_REAP_MS 100
+#define MLE_PROC_KILL_GRACE_MS 500
+
+#define MLE_TRACE_HEADER "# mle trace v1"
+
+#define MLE_HEADLESS_DEFAULT_W 80
+#define MLE_HEADLESS_DEFAULT_H 24
 
 #define MLE_LOG_ERR(fmt, ...) do { \
     fprintf(stderr, (fmt), __VA_ARGS__); \
@@ -512,6 +1063,10 @@ extern editor_t _editor;
 // Sentinel values for numeric and wildcard kinputs
 #define MLE_KINPUT_NUMERIC (kinput_t){ 0x40, 0xffffffff, 0xffff }
 #define MLE_KINPUT_WILDCARD (kinput_t){ 0x80, 0xffffffff, 0xffff }
+#define MLE_KINPUT_PASTE (kinput_t){ 0x20, 0, 0xffff }
+#define MLE_KINPUT_IS_PASTE(pi) ((pi)->mod == 0x20 && (pi)->key == 0xffff)
+#define MLE_KINPUT_EQ(pa, pb) ((pa)->ch == (pb)->ch && (pa)->key == (pb)->key && (pa)->mod == (pb)->mod)
+#define MLE_KINPUT_IS_DIGIT(pi) ((pi)->ch >= '0' && (pi)->ch <= '9')
 
 #define MLE_LINENUM_TYPE_ABS 0
 #define MLE_LINENUM_TYPE_REL 1
@@ -523,8 +1078,6 @@ extern editor_t _editor;
     : 0 \
 )
 
-#define MLE_BRACKET_PAIR_MAX_SEARCH 10000
-
 #define MLE_RE_WORD_FORWARD "((?<=\\w)\\W|$)"
 #define MLE_RE_WORD_BACK "((?<=\\W)\\w|^)"
 
@@ -560,7 +1113,6 @@ TODO
 [ ] experiment with adding ['>','<'] to brkt pairs for <C-d d>'ing html
 [ ] aproc-bview refactor
 [ ] factor out code into async_proc_read
-[ ] large paste cuts off midway?
 [ ] styles perf
 [ ] perf with large files
 [ ] drop/goto mark with char
@@ -571,7 +1123,6 @@ TODO
 [ ] srule priority / isearch hili in middle of multiline rule
 [ ] slow indent
 [ ] click to set cursor/focus
-[ ] do not draw screen input continuous user inputs
 [ ] cmd_replace back references
 [ ] can't match ^$
 [ ] flash messages "replaced N instances", "wrote N bytes"
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mle.h"
+
+static int _perf_hist_bucket(uint64_t usec);
+static uint64_t _perf_hist_bucket_max(int bucket);
+static uint64_t _perf_hist_percentile(perf_hist_t* hist, int pct);
+
+static char* _perf_names[MLE_PERF_COUNT] = {
+    "input_latency",
+    "get_command",
+    "cmd",
+    "display",
+    "bview_draw",
+    "tb_present"
+};
+
+// Return a monotonic timestamp in microseconds
+uint64_t perf_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Record time elapsed since start_us in the histogram for metric
+int perf_record(editor_t* editor, int metric, uint64_t start_us) {
+    perf_hist_t* hist;
+    uint64_t now_us;
+    uint64_t usec;
+    if (metric < 0 || metric >= MLE_PERF_COUNT) return MLE_ERR;
+    now_us = perf_now_us();
+    usec = now_us > start_us ? now_us - start_us : 0;
+    hist = &editor->perf_hists[metric];
+    hist->count += 1;
+    hist->sum_us += usec;
+    if (usec > hist->max_us) hist->max_us = usec;
+    hist->buckets[_perf_hist_bucket(usec)] += 1;
+    return MLE_OK;
+}
+
+// Format a table of all metrics. Caller frees *ret_str.
+int perf_format(editor_t* editor, char** ret_str, size_t* ret_str_len) {
+    perf_hist_t* hist;
+    char* str;
+    size_t str_size;
+    int len;
+    int i;
+
+    str_size = (MLE_PERF_COUNT + 4) * 96;
+    str = malloc(str_size);
+    len = snprintf(str, str_size, "%-14s %10s %10s %10s %10s %10s %10s\n",
+        "metric (usec)", "count", "avg", "p50", "p95", "p99", "max");
+    for (i = 0; i < MLE_PERF_COUNT; i++) {
+        hist = &editor->perf_hists[i];
+        len += snprintf(str + len, str_size - len, "%-14s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+            _perf_names[i],
+            (unsigned long long)hist->count,
+            (unsigned long long)(hist->count > 0 ? hist->sum_us / hist->count : 0),
+            (unsigned long long)_perf_hist_percentile(hist, 50),
+            (unsigned long long)_perf_hist_percentile(hist, 95),
+            (unsigned long long)_perf_hist_percentile(hist, 99),
+            (unsigned long long)hist->max_us
+        );
+    }
+    len += snprintf(str + len, str_size - len, "%-14s %10llu\n%-14s %10llu\n",
+        "cells_out", (unsigned long long)editor->display_cells_out,
+        "bytes_out", (unsigned long long)editor->display_bytes_out
+    );
+    *ret_str = str;
+    *ret_str_len = (size_t)MLE_MIN(len, (int)str_size - 1);
+    return MLE_OK;
+}
+
+// Write a table of all metrics to path, followed by per-event latency if a
+// trace was replayed
+int perf_dump(editor_t* editor, char* path) {
+    FILE* fp;
+    char* str;
+    size_t str_len;
+    if (!(fp = fopen(path, "w"))) {
+        MLE_LOG_ERR("Could not open perf dump file: %s\n", path);
+        return MLE_ERR;
+    }
+    perf_format(editor, &str, &str_len);
+    fwrite(str, 1, str_len, fp);
+    if (editor->trace.is_replay) trace_write_latency(editor, fp);
+    fclose(fp);
+    free(str);
+    return MLE_OK;
+}
+
+// Return histogram bucket for usec. Buckets are log-linear: values below
+// 2^MLE_PERF_HIST_SUB_BITS get one bucket each, after that every power of two
+// is split into 2^MLE_PERF_HIST_SUB_BITS equal buckets.
+static int _perf_hist_bucket(uint64_t usec) {
+    int exp;
+    int sub;
+    int bucket;
+    if (usec < (1 << MLE_PERF_HIST_SUB_BITS)) return (int)usec;
+    exp = 63 - __builtin_clzll(usec);
+    sub = (int)((usec >> (exp - MLE_PERF_HIST_SUB_BITS)) & ((1 << MLE_PERF_HIST_SUB_BITS) - 1));
+    bucket = ((exp - MLE_PERF_HIST_SUB_BITS + 1) << MLE_PERF_HIST_SUB_BITS) + sub;
+    return MLE_MIN(bucket, MLE_PERF_HIST_BUCKETS - 1);
+}
+
+// Return largest usec that falls in bucket
+static uint64_t _perf_hist_bucket_max(int bucket) {
+    int exp;
+    int sub;
+    if (bucket < (1 << MLE_PERF_HIST_SUB_BITS)) return (uint64_t)bucket;
+    exp = (bucket >> MLE_PERF_HIST_SUB_BITS) + MLE_PERF_HIST_SUB_BITS - 1;
+    sub = bucket & ((1 << MLE_PERF_HIST_SUB_BITS) - 1);
+    return ((uint64_t)((1 << MLE_PERF_HIST_SUB_BITS) + sub + 1) << (exp - MLE_PERF_HIST_SUB_BITS)) - 1;
+}
+
+// Return pct-th percentile of hist (upper bound of its bucket, capped at max)
+static uint64_t _perf_hist_percentile(perf_hist_t* hist, int pct) {
+    uint64_t target;
+    uint64_t seen;
+    int i;
+    if (hist->count < 1) return 0;
+    target = (hist->count * pct + 99) / 100;
+    seen = 0;
+    for (i = 0; i < MLE_PERF_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            return MLE_MIN(_perf_hist_bucket_max(i), hist->max_us);
+        }
+    }
+    return hist->max_us;
+}
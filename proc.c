@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include "utlist.h"
+#include "mle.h"
+
+extern char** environ;
+
+static void _proc_reap_cb(editor_t* editor, void* udata);
+
+// Spawn `opt_shell -c cmd` in its own process group. posix_spawn does not copy
+// the editor's page tables like fork does, so this stays cheap no matter how
+// much is loaded. If optret_fdread is set, the child's stdout is piped to it.
+// If optret_fdwrite is set, it is piped to the child's stdin, else stdin is
+// inherited.
+int proc_spawn(char* cmd, char* opt_shell, int* optret_fdread, int* optret_fdwrite, pid_t* ret_pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigs;
+    char* argv[4];
+    int pout[2] = { -1, -1 };
+    int pin[2] = { -1, -1 };
+    short flags;
+    int rc;
+
+    // Set shell
+    opt_shell = opt_shell ? opt_shell : "sh";
+    argv[0] = opt_shell;
+    argv[1] = "-c";
+    argv[2] = cmd;
+    argv[3] = NULL;
+
+    // Make pipes. O_CLOEXEC keeps the parent ends out of other children.
+    if (optret_fdread && pipe2(pout, O_CLOEXEC)) {
+        return MLE_ERR;
+    }
+    if (optret_fdwrite && pipe2(pin, O_CLOEXEC)) {
+        if (optret_fdread) { close(pout[0]); close(pout[1]); }
+        return MLE_ERR;
+    }
+
+    // Wire child ends to stdout and stdin
+    posix_spawn_file_actions_init(&actions);
+    if (optret_fdread) posix_spawn_file_actions_adddup2(&actions, pout[1], STDOUT_FILENO);
+    if (optret_fdwrite) posix_spawn_file_actions_adddup2(&actions, pin[0], STDIN_FILENO);
+
+    // Start child in a new process group with default signal handling so
+    // the whole group can be cancelled at once
+    posix_spawnattr_init(&attr);
+    flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    sigaddset(&sigs, SIGPIPE);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGQUIT);
+    sigaddset(&sigs, SIGHUP);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+
+    rc = posix_spawnp(ret_pid, opt_shell, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    // Close child ends
+    if (optret_fdread) close(pout[1]);
+    if (optret_fdwrite) close(pin[0]);
+    if (rc != 0) {
+        if (optret_fdread) close(pout[0]);
+        if (optret_fdwrite) close(pin[1]);
+        return MLE_ERR;
+    }
+    if (optret_fdread) *optret_fdread = pout[0];
+    if (optret_fdwrite) *optret_fdwrite = pin[1];
+    return MLE_OK;
+}
+
+// Reap pid without blocking. If it is still running, it is polled from the
+// editor loop until it exits. If is_cancel, its process group is sent
+// SIGTERM, then SIGKILL if it lingers past MLE_PROC_KILL_GRACE_MS.
+int proc_reap(editor_t* editor, pid_t pid, int is_cancel) {
+    proc_t* proc;
+    if (pid <= 0) return MLE_ERR;
+    if (is_cancel) kill(-pid, SIGTERM);
+    if (waitpid(pid, NULL, WNOHANG) != 0) {
+        return MLE_OK; // Exited (or not ours to wait on)
+    }
+    proc = calloc(1, sizeof(proc_t));
+    proc->pid = pid;
+    proc->kill_us = is_cancel ? perf_now_us() + (uint64_t)MLE_PROC_KILL_GRACE_MS * 1000 : 0;
+    DL_APPEND(editor->procs, proc);
+    if (!editor->proc_timer) {
+        editor_add_timer(editor, MLE_PROC_REAP_MS, _proc_reap_cb, NULL, &editor->proc_timer);
+    }
+    return MLE_OK;
+}
+
+// Kill cancelled procs and stop polling. Called on editor exit.
+int proc_destroy_all(editor_t* editor) {
+    proc_t* proc;
+    proc_t* proc_tmp;
+    DL_FOREACH_SAFE(editor->procs, proc, proc_tmp) {
+        if (proc->kill_us) kill(-proc->pid, SIGKILL);
+        waitpid(proc->pid, NULL, WNOHANG);
+        DL_DELETE(editor->procs, proc);
+        free(proc);
+    }
+    if (editor->proc_timer) {
+        editor_remove_timer(editor, editor->proc_timer);
+        editor->proc_timer = NULL;
+    }
+    return MLE_OK;
+}
+
+// Timer callback that reaps exited procs and escalates overdue cancels
+static void _proc_reap_cb(editor_t* editor, void* udata) {
+    proc_t* proc;
+    proc_t* proc_tmp;
+    uint64_t now_us;
+    editor->proc_timer = NULL; // Freed by caller
+    now_us = perf_now_us();
+    DL_FOREACH_SAFE(editor->procs, proc, proc_tmp) {
+        if (waitpid(proc->pid, NULL, WNOHANG) != 0) {
+            DL_DELETE(editor->procs, proc);
+            free(proc);
+        } else if (proc->kill_us && now_us >= proc->kill_us) {
+            kill(-proc->pid, SIGKILL);
+            proc->kill_us = 0;
+        }
+    }
+    if (editor->procs) {
+        editor_add_timer(editor, MLE_PROC_REAP_MS, _proc_reap_cb, NULL, &editor->proc_timer);
+    }
+}
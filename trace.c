@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mle.h"
+
+static void _trace_sleep_until(uint64_t when_us);
+
+// Start recording input events to path
+int trace_record_open(editor_t* editor, char* path) {
+    trace_t* trace;
+    trace = &editor->trace;
+    if (!(trace->record_fp = fopen(path, "w"))) {
+        MLE_LOG_ERR("Could not open trace file: %s\n", path);
+        return MLE_ERR;
+    }
+    fprintf(trace->record_fp, "%s\n", MLE_TRACE_HEADER);
+    trace->record_start_us = perf_now_us();
+    return MLE_OK;
+}
+
+// Append ev to the trace being recorded, if any
+int trace_record(editor_t* editor, tb_event_t* ev) {
+    trace_t* trace;
+    trace = &editor->trace;
+    if (!trace->record_fp) return MLE_OK;
+    fprintf(trace->record_fp, "%llu %u %u %u %u %d %d\n",
+        (unsigned long long)(perf_now_us() - trace->record_start_us),
+        (unsigned)ev->type, (unsigned)ev->mod, (unsigned)ev->key, (unsigned)ev->ch,
+        (int)ev->w, (int)ev->h
+    );
+    return MLE_OK;
+}
+
+// Load a recorded trace for replay. If is_paced, events are replayed at their
+// recorded times, else as fast as the editor takes them.
+int trace_replay_open(editor_t* editor, char* path, int is_paced) {
+    trace_t* trace;
+    trace_event_t* tevent;
+    FILE* fp;
+    char line[128];
+    unsigned long long t_us;
+    unsigned type;
+    unsigned mod;
+    unsigned key;
+    unsigned ch;
+    int w;
+    int h;
+    size_t events_size;
+    int linenum;
+
+    trace = &editor->trace;
+    if (!(fp = fopen(path, "r"))) {
+        MLE_LOG_ERR("Could not open trace file: %s\n", path);
+        return MLE_ERR;
+    }
+    events_size = 0;
+    linenum = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        linenum += 1;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "%llu %u %u %u %u %d %d", &t_us, &type, &mod, &key, &ch, &w, &h) != 7) {
+            MLE_LOG_ERR("%s:%d: Bad trace event\n", path, linenum);
+            fclose(fp);
+            return MLE_ERR;
+        }
+        if (trace->events_len + 1 > events_size) {
+            events_size = events_size ? events_size * 2 : 256;
+            trace->events = realloc(trace->events, sizeof(trace_event_t) * events_size);
+        }
+        tevent = &trace->events[trace->events_len++];
+        memset(tevent, 0, sizeof(trace_event_t));
+        tevent->t_us = (uint64_t)t_us;
+        tevent->ev.type = (uint8_t)type;
+        tevent->ev.mod = (uint8_t)mod;
+        tevent->ev.key = (uint16_t)key;
+        tevent->ev.ch = (uint32_t)ch;
+        tevent->ev.w = w;
+        tevent->ev.h = h;
+    }
+    fclose(fp);
+    trace->events_index = 0;
+    trace->presented_index = 0;
+    trace->is_replay = 1;
+    trace->is_paced = is_paced;
+    trace->replay_start_us = perf_now_us();
+    return MLE_OK;
+}
+
+// Set ret_ev to the next replayed event and return its type. If the next
+// event is not due yet, wait up to timeout_ms for it (forever if negative),
+// and return 0 if it is still not due. Return -1 when the trace is done.
+int trace_replay_next(editor_t* editor, tb_event_t* ret_ev, int timeout_ms) {
+    trace_t* trace;
+    trace_event_t* tevent;
+    uint64_t due_us;
+    uint64_t now_us;
+
+    trace = &editor->trace;
+    if (trace->events_index >= trace->events_len) return -1;
+    tevent = &trace->events[trace->events_index];
+    now_us = perf_now_us();
+    due_us = now_us;
+    if (trace->is_paced) {
+        due_us = trace->replay_start_us + tevent->t_us;
+        if (due_us > now_us) {
+            if (timeout_ms >= 0 && (due_us - now_us + 999) / 1000 > (uint64_t)timeout_ms) {
+                return 0;
+            }
+            _trace_sleep_until(due_us);
+        }
+    }
+    tevent->arrival_us = due_us;
+    trace->events_index += 1;
+    *ret_ev = tevent->ev;
+    return (int)tevent->ev.type;
+}
+
+// Return ms until next replayed event is due, or -1 if none is pending
+int trace_replay_due_ms(editor_t* editor) {
+    trace_t* trace;
+    uint64_t due_us;
+    uint64_t now_us;
+    trace = &editor->trace;
+    if (trace->events_index >= trace->events_len) return -1;
+    if (!trace->is_paced) return 0;
+    due_us = trace->replay_start_us + trace->events[trace->events_index].t_us;
+    now_us = perf_now_us();
+    if (due_us <= now_us) return 0;
+    return (int)MLE_MIN((due_us - now_us + 999) / 1000, (uint64_t)INT_MAX);
+}
+
+// Stamp replayed events that arrived before this tb_present
+int trace_presented(editor_t* editor, uint64_t present_us) {
+    trace_t* trace;
+    trace = &editor->trace;
+    while (trace->presented_index < trace->events_index) {
+        trace->events[trace->presented_index].present_us = present_us;
+        trace->presented_index += 1;
+    }
+    return MLE_OK;
+}
+
+// Write per-event input-to-present latency of replayed events to fp
+int trace_write_latency(editor_t* editor, FILE* fp) {
+    trace_t* trace;
+    trace_event_t* tevent;
+    size_t i;
+    trace = &editor->trace;
+    fprintf(fp, "\n%-8s %12s %4s %6s %8s %12s\n", "event", "t_us", "type", "key", "ch", "latency_us");
+    for (i = 0; i < trace->events_index; i++) {
+        tevent = &trace->events[i];
+        fprintf(fp, "%-8zu %12llu %4u %6u %8u ",
+            i,
+            (unsigned long long)tevent->t_us,
+            (unsigned)tevent->ev.type,
+            (unsigned)tevent->ev.key,
+            (unsigned)tevent->ev.ch
+        );
+        if (tevent->present_us >= tevent->arrival_us && tevent->present_us > 0) {
+            fprintf(fp, "%12llu\n", (unsigned long long)(tevent->present_us - tevent->arrival_us));
+        } else {
+            fprintf(fp, "%12s\n", "-"); // Never presented
+        }
+    }
+    return MLE_OK;
+}
+
+// Close recording and free replay events
+int trace_destroy(editor_t* editor) {
+    trace_t* trace;
+    trace = &editor->trace;
+    if (trace->record_fp) fclose(trace->record_fp);
+    if (trace->events) free(trace->events);
+    memset(trace, 0, sizeof(trace_t));
+    return MLE_OK;
+}
+
+// Sleep until monotonic time when_us
+static void _trace_sleep_until(uint64_t when_us) {
+    struct timespec ts;
+    uint64_t now_us;
+    while ((now_us = perf_now_us()) < when_us) {
+        ts.tv_sec = (time_t)((when_us - now_us) / 1000000);
+        ts.tv_nsec = (long)((when_us - now_us) % 1000000) * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
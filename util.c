@@ -3,143 +3,191 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "mle.h"
 
-// Run a shell command, optionally feeding stdin, collecting stdout
+static int _util_shell_job_start(editor_t* editor, char* cmd, char* opt_shell, shell_job_t* job);
+static int _util_shell_job_pump(editor_t* editor, shell_job_t* job);
+static void _util_shell_job_finish(editor_t* editor, shell_job_t* job, int rv);
+static int _util_shell_exec_is_cancelled(editor_t* editor);
+
+// Run a shell command, optionally feeding stdin, collecting stdout. See
+// util_shell_exec_multi.
 int util_shell_exec(editor_t* editor, char* cmd, long timeout_s, char* input, size_t input_len, char* opt_shell, char** ret_output, size_t* ret_output_len) {
+    shell_job_t job;
     int rv;
-    int readfd;
-    int writefd;
-    char* readbuf;
-    size_t readbuf_len;
-    size_t readbuf_size;
-    ssize_t rc;
-    ssize_t nbytes;
-    fd_set readfds;
-    struct timeval timeout;
-
-    // Open cmd
-    if (!util_popen2(cmd, opt_shell, &readfd, &writefd)) {
-        MLE_RETURN_ERR(editor, "Failed to exec shell cmd: %s", cmd);
-    }
+    memset(&job, 0, sizeof(shell_job_t));
+    job.input = input;
+    job.input_len = input_len;
+    rv = util_shell_exec_multi(editor, cmd, timeout_s, opt_shell, &job, 1, 1);
+    *ret_output = job.output;
+    *ret_output_len = job.output_len;
+    return rv == MLE_OK ? job.rv : rv;
+}
 
-    // Close write pipe if no input
-    if (input_len < 1) {
-        close(writefd);
+// Run a shell command once per job, up to max_procs at a time (0 for number
+// of cpus), feeding each its input and collecting its output. Input is written
+// while output is read, so neither pipe can fill up and stall the other. If
+// timeout_s > 0, all cmds are cancelled after that many seconds. From the
+// editor loop, progress is shown on the prompt line once the cmds run longer
+// than MLE_SHELL_PROGRESS_MS, and from then on C-c cancels them. Elsewhere (e.g., scripts
+// or startup) there is no way to cancel, so timeout_s defaults to
+// MLE_SHELL_TIMEOUT_S. Return MLE_ERR if
+// cancelled or timed out; per-job results are in job->rv.
+int util_shell_exec_multi(editor_t* editor, char* cmd, long timeout_s, char* opt_shell, shell_job_t* jobs, size_t jobs_len, int max_procs) {
+    shell_job_t* job;
+    struct pollfd* pfds;
+    size_t next;
+    size_t ndone;
+    size_t i;
+    int nrunning;
+    int nfds;
+    int rv;
+    int is_interactive;
+    int is_progress_shown;
+    uint64_t start_us;
+    uint64_t now_us;
+    uint64_t tick_us;
+    size_t bytes_in;
+    size_t bytes_out;
+
+    // Init jobs
+    if (max_procs < 1) max_procs = MLE_MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    for (i = 0; i < jobs_len; i++) {
+        job = &jobs[i];
+        job->input_off = 0;
+        job->output = NULL; // Allocated once the job starts
+        job->output_size = 0;
+        job->output_len = 0;
+        job->readfd = -1;
+        job->writefd = -1;
+        job->rv = MLE_ERR;
     }
+    pfds = malloc(sizeof(struct pollfd) * 2 * max_procs);
 
-    // Read-write loop
-    readbuf = NULL;
-    readbuf_len = 0;
-    readbuf_size = 0;
+    // Run until all jobs are done
     rv = MLE_OK;
-    do {
-        // Write to shell cmd if input is remaining
-        if (input_len > 0) {
-            rc = write(writefd, input, input_len);
-            if (rc > 0) {
-                input += rc;
-                input_len -= rc;
-                if (input_len < 1) {
-                    close(writefd);
-                    writefd = 0;
-                }
+    next = 0;
+    ndone = 0;
+    nrunning = 0;
+    is_interactive = editor->loop_depth > 0 && !editor->script_path ? 1 : 0;
+    if (!is_interactive && timeout_s <= 0) timeout_s = MLE_SHELL_TIMEOUT_S;
+    is_progress_shown = 0;
+    start_us = perf_now_us();
+    tick_us = start_us;
+    while (ndone < jobs_len) {
+        // Start jobs while there are free slots
+        while (next < jobs_len && nrunning < max_procs) {
+            if (_util_shell_job_start(editor, cmd, opt_shell, &jobs[next]) == MLE_OK) {
+                nrunning += 1;
             } else {
-                // write err
-                MLE_SET_ERR(editor, "write error: %s", strerror(errno));
-                rv = MLE_ERR;
-                break;
+                ndone += 1;
             }
+            next += 1;
         }
-
-        // Read shell cmd, timing out after timeout_sec
-        timeout.tv_sec = timeout_s;
-        timeout.tv_usec = 0;
-        FD_ZERO(&readfds);
-        FD_SET(readfd, &readfds);
-        rc = select(readfd + 1, &readfds, NULL, NULL, &timeout);
-        if (rc < 0) {
-            // Err on select
-            MLE_SET_ERR(editor, "select error: %s", strerror(errno));
+        if (nrunning < 1) continue;
+
+        // Wait on all running pipes, waking up every tick to check for cancel
+        nfds = 0;
+        for (i = 0; i < next; i++) {
+            job = &jobs[i];
+            if (job->readfd >= 0) pfds[nfds++] = (struct pollfd){ job->readfd, POLLIN, 0 };
+            if (job->writefd >= 0) pfds[nfds++] = (struct pollfd){ job->writefd, POLLOUT, 0 };
+        }
+        if (poll(pfds, nfds, MLE_SHELL_TICK_MS) < 0 && errno != EINTR) {
+            MLE_SET_ERR(editor, "poll error: %s", strerror(errno));
             rv = MLE_ERR;
             break;
-        } else if (rc == 0) {
-            // Timed out
+        }
+
+        // Move data for every running job
+        for (i = 0; i < next; i++) {
+            job = &jobs[i];
+            if (job->readfd < 0) continue;
+            if (_util_shell_job_pump(editor, job)) {
+                nrunning -= 1;
+                ndone += 1;
+            }
+        }
+
+        // Check for timeout, cancel, and show progress once per tick
+        now_us = perf_now_us();
+        if (now_us < tick_us || ndone >= jobs_len) continue;
+        tick_us = now_us + MLE_SHELL_TICK_MS * 1000;
+        if (timeout_s > 0 && now_us - start_us >= (uint64_t)timeout_s * 1000000) {
+            rv = MLE_ERR; // Timed out
+            break;
+        } else if (!is_interactive || now_us - start_us < MLE_SHELL_PROGRESS_MS * 1000) {
+            continue; // Leave keys typed ahead of a short cmd alone
+        } else if (_util_shell_exec_is_cancelled(editor)) {
+            MLE_SET_ERR(editor, "Cancelled shell cmd: %s", cmd);
             rv = MLE_ERR;
             break;
-        } else {
-            // Read a kilobyte of data
-            if (readbuf_len + 1024 + 1 > readbuf_size) {
-                readbuf = realloc(readbuf, readbuf_len + 1024 + 1);
-                readbuf_size = readbuf_len + 1024 + 1;
-            }
-            nbytes = read(readfd, readbuf + readbuf_len, 1024);
-            if (nbytes < 0) {
-                // read err or EAGAIN/EWOULDBLOCK
-                MLE_SET_ERR(editor, "read error: %s", strerror(errno));
-                rv = MLE_ERR;
-                break;
-            } else if (nbytes > 0) {
-                // Got data
-                readbuf_len += nbytes;
+        } else if (!editor->is_display_disabled) {
+            bytes_in = 0;
+            bytes_out = 0;
+            for (i = 0; i < next; i++) {
+                bytes_in += jobs[i].input_off;
+                bytes_out += jobs[i].output_len;
             }
+            tb_printf(editor->rect_prompt, 0, 0, 0, 0, "%-*.*s", editor->rect_prompt.w, editor->rect_prompt.w, "");
+            tb_printf(editor->rect_prompt, 0, 0, 0, 0, "%.*s: %zu/%zu done, %.1fM in, %.1fM out, %llus (C-c to cancel)",
+                MLE_MAX(0, editor->rect_prompt.w - 64), cmd, ndone, jobs_len,
+                (double)bytes_in / (1024 * 1024), (double)bytes_out / (1024 * 1024),
+                (unsigned long long)((now_us - start_us) / 1000000)
+            );
+            tb_present();
+            is_progress_shown = 1;
         }
-    } while(nbytes > 0);
+    }
 
-    // Close pipes
-    if (readfd) close(readfd);
-    if (writefd) close(writefd);
+    // Cancel whatever is still running
+    for (i = 0; i < next; i++) {
+        if (jobs[i].readfd >= 0) _util_shell_job_finish(editor, &jobs[i], MLE_ERR);
+    }
 
-    *ret_output = readbuf;
-    *ret_output_len = readbuf_len;
+    // Give jobs that never started an empty output
+    for (i = next; i < jobs_len; i++) {
+        jobs[i].output = calloc(1, 1);
+        jobs[i].output_size = 1;
+    }
+    free(pfds);
+
+    // Repaint over progress
+    if (is_progress_shown) editor_damage(editor, NULL);
 
     return rv;
 }
 
-
-// Like popen, but bidirectional. Returns 1 on success, 0 on failure.
-int util_popen2(char* cmd, char* opt_shell, int* ret_fdread, int* ret_fdwrite) {
-    FILE* fr;
+// Like popen, but bidirectional. Returns 1 on success, 0 on failure. If
+// optret_pid is not set, the caller cannot reap the child.
+int util_popen2(char* cmd, char* opt_shell, int* ret_fdread, int* ret_fdwrite, pid_t* optret_pid) {
     pid_t pid;
-    int pin[2];
-    int pout[2];
-
-    // Set shell
-    opt_shell = opt_shell ? opt_shell : "sh";
-
-    // Make pipes
-    if (pipe(pin)) return 0;
-    if (pipe(pout)) return 0;
-
-    // Fork
-    pid = fork();
-    if (pid < 0) {
-        // Fork failed
+    if (proc_spawn(cmd, opt_shell, ret_fdread, ret_fdwrite, &pid) != MLE_OK) {
         return 0;
-    } else if (pid == 0) {
-        // Child
-        close(pout[0]);
-        dup2(pout[1], STDOUT_FILENO);
-        close(pout[1]);
-
-        close(pin[1]);
-        dup2(pin[0], STDIN_FILENO);
-        close(pin[0]);
-
-        execlp(opt_shell, opt_shell, "-c", cmd, NULL);
-        exit(EXIT_FAILURE);
     }
-    // Parent
-    close(pout[1]);
-    close(pin[0]);
-    fr = fdopen(dup(pout[0]), "r");
-    setvbuf(fr, NULL, _IONBF, 0);
-    fclose(fr);
-    *ret_fdread = pout[0];
-    *ret_fdwrite = pin[1];
+    if (optret_pid) *optret_pid = pid;
     return 1;
 }
 
+// Like pthread_create, but the thread starts with every signal blocked, so
+// signals (e.g., SIGWINCH, SIGTERM) are only ever handled by the editor thread
+int util_thread_create(pthread_t* thread, void* (*fn)(void*), void* arg) {
+    sigset_t all;
+    sigset_t orig;
+    int rc;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &orig);
+    rc = pthread_create(thread, NULL, fn, arg);
+    pthread_sigmask(SIG_SETMASK, &orig, NULL);
+    return rc;
+}
+
 // Return paired bracket if ch is a bracket, else return 0
 int util_get_bracket_pair(uint32_t ch, int* optret_is_closing) {
     switch (ch) {
@@ -328,6 +376,40 @@ int util_timeval_is_gt(struct timeval* a, struct timeval* b) {
     return 0;
 }
 
+// Return a - b in milliseconds
+long util_timeval_diff_ms(struct timeval* a, struct timeval* b) {
+    return (long)(a->tv_sec - b->tv_sec) * 1000L + (long)(a->tv_usec - b->tv_usec) / 1000L;
+}
+
+// Return length of the leading run of printable ASCII (0x20 thru 0x7e) in
+// data. Checks 16 bytes at a time with SSE2 when available.
+size_t util_ascii_printable_len(char* data, size_t len) {
+    size_t i;
+    unsigned char c;
+    i = 0;
+#ifdef __SSE2__
+    __m128i v;
+    __m128i lo;
+    __m128i del;
+    int mask;
+    lo = _mm_set1_epi8(0x20);
+    del = _mm_set1_epi8(0x7f);
+    for (; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((__m128i*)(data + i));
+        // Signed compare: bytes >= 0x80 are negative so count as < 0x20
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, lo), _mm_cmpeq_epi8(v, del)));
+        if (mask) {
+            return i + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        c = (unsigned char)data[i];
+        if (c < 0x20 || c >= 0x7f) break;
+    }
+    return i;
+}
+
 // Ported from php_escape_shell_arg
 // https://github.com/php/php-src/blob/master/ext/standard/exec.c
 char* util_escape_shell_arg(char* str, int l) {
@@ -444,3 +526,114 @@ int tb_printf_attr(bview_rect_t rect, int x, int y, const char *fmt, ...) {
     }
     return c;
 }
+
+// Spawn cmd for job with non-blocking pipes
+static int _util_shell_job_start(editor_t* editor, char* cmd, char* opt_shell, shell_job_t* job) {
+    if (!util_popen2(cmd, opt_shell, &job->readfd, &job->writefd, &job->pid)) {
+        job->readfd = -1;
+        job->writefd = -1;
+        job->output = calloc(1, 1);
+        job->output_size = 1;
+        MLE_RETURN_ERR(editor, "Failed to exec shell cmd: %s", cmd);
+    }
+
+    // Allocate the read buffer only now, so at most max_procs are live at once
+    job->output_size = MLE_SHELL_READ_MIN + 1;
+    job->output = malloc(job->output_size);
+    job->output[0] = '\0';
+    fcntl(job->readfd, F_SETFL, fcntl(job->readfd, F_GETFL) | O_NONBLOCK);
+    fcntl(job->writefd, F_SETFL, fcntl(job->writefd, F_GETFL) | O_NONBLOCK);
+
+    // Close write pipe if no input
+    if (job->input_len < 1) {
+        close(job->writefd);
+        job->writefd = -1;
+    }
+    return MLE_OK;
+}
+
+// Write as much input as the pipe will take and read all available output.
+// Return 1 if the job is done, else 0.
+static int _util_shell_job_pump(editor_t* editor, shell_job_t* job) {
+    ssize_t nbytes;
+
+    // Write input
+    if (job->writefd >= 0) {
+        nbytes = write(job->writefd, job->input + job->input_off, job->input_len - job->input_off);
+        if (nbytes > 0) {
+            job->input_off += (size_t)nbytes;
+        } else if (nbytes < 0 && errno == EPIPE) {
+            job->input_off = job->input_len; // Cmd stopped reading; keep its output
+        } else if (nbytes < 0 && errno != EAGAIN && errno != EINTR) {
+            MLE_SET_ERR(editor, "write error: %s", strerror(errno));
+            _util_shell_job_finish(editor, job, MLE_ERR);
+            return 1;
+        }
+        if (job->input_off >= job->input_len) {
+            close(job->writefd);
+            job->writefd = -1;
+        }
+    }
+
+    // Read output, doubling the buffer as needed
+    while (1) {
+        if (job->output_len + MLE_SHELL_READ_MIN + 1 > job->output_size) {
+            job->output_size = MLE_MAX(job->output_size * 2, job->output_len + MLE_SHELL_READ_MIN + 1);
+            job->output = realloc(job->output, job->output_size);
+        }
+        nbytes = read(job->readfd, job->output + job->output_len, job->output_size - job->output_len - 1);
+        if (nbytes > 0) {
+            job->output_len += (size_t)nbytes;
+        } else if (nbytes == 0) {
+            _util_shell_job_finish(editor, job, MLE_OK); // Eof
+            return 1;
+        } else if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        } else {
+            MLE_SET_ERR(editor, "read error: %s", strerror(errno));
+            _util_shell_job_finish(editor, job, MLE_ERR);
+            return 1;
+        }
+    }
+}
+
+// Close job pipes and reap its cmd, cancelling it unless rv is MLE_OK
+static void _util_shell_job_finish(editor_t* editor, shell_job_t* job, int rv) {
+    if (job->readfd >= 0) close(job->readfd);
+    if (job->writefd >= 0) close(job->writefd);
+    job->readfd = -1;
+    job->writefd = -1;
+    proc_reap(editor, job->pid, rv == MLE_OK ? 0 : 1);
+
+    // Shrink output to fit before handing it off
+    job->output_size = job->output_len + 1;
+    job->output = realloc(job->output, job->output_size);
+    job->output[job->output_len] = '\0';
+    job->rv = rv;
+}
+
+// Return 1 if C-c was pressed. Other keys are put back for the editor loop.
+// New events are read only while there is room to put them back; the rest
+// stay queued in termbox.
+static int _util_shell_exec_is_cancelled(editor_t* editor) {
+    tb_event_t ev;
+    int i;
+    for (i = 0; i < editor->event_pushback_len; i++) {
+        ev = editor->event_pushback[i];
+        if (ev.type == TB_EVENT_KEY && ev.key == TB_KEY_CTRL_C) {
+            editor->event_pushback_len -= 1;
+            memmove(editor->event_pushback + i, editor->event_pushback + i + 1, sizeof(tb_event_t) * (editor->event_pushback_len - i));
+            return 1;
+        }
+    }
+    while (editor->event_pushback_len < MLE_EVENT_PUSHBACK_SIZE && editor_read_event(editor, &ev, 0) > 0) {
+        if (ev.type == TB_EVENT_RESIZE) {
+            editor_queue_resize(editor, ev.w, ev.h);
+        } else if (ev.type == TB_EVENT_KEY && ev.key == TB_KEY_CTRL_C) {
+            return 1;
+        } else {
+            editor_push_event(editor, &ev);
+        }
+    }
+    return 0;
+}